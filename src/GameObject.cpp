@@ -24,3 +24,13 @@ void GameObject::DrawGameObject(VkCommandBuffer cmdBuf, VkPipelineLayout pipelin
 	}
 	mRenderInfo.PreviousModelMatrix = mRenderInfo.CurrentModelMatrix;
 }
+
+void GameObject::DrawGameObjectDepth(VkCommandBuffer cmdBuf, VkPipelineLayout pipeline)
+{
+	mRenderInfo.CurrentModelMatrix = GetTransform()->ProduceModelTransform();
+	auto renderable = GetRenderable();
+	if (renderable)
+	{
+		renderable->DrawDepth(cmdBuf, &mRenderInfo, pipeline);
+	}
+}
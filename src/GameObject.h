@@ -27,6 +27,8 @@ public:
 	}
 
 	void DrawGameObject(VkCommandBuffer cmdBuf, VkPipelineLayout pipeline);
+	// Depth pre-pass. Called before DrawGameObject in the same frame, keeps the previous model matrix.
+	void DrawGameObjectDepth(VkCommandBuffer cmdBuf, VkPipelineLayout pipeline);
 
 	DEFAULT_DESTRUCTOR_OBJECT(GameObject)
 private:
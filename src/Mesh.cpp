@@ -3,7 +3,16 @@
 void GPU_MESH::destroy()
 {
     vertex_buffer.destroy();
+    position_buffer.destroy();
     index_buffer.destroy();
     vertex_count = 0;
     index_count = 0;
-}
\ No newline at end of file
+}
+Vk_Buffer create_position_buffer(const Triangle_Mesh& mesh, const char* name)
+{
+    std::vector<Vector3> positions(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++)
+        positions[i] = mesh.vertices[i].pos;
+    return vk_create_buffer(positions.size() * sizeof(Vector3), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        positions.data(), name);
+}
@@ -37,8 +37,11 @@ struct TAATransform
 struct GPU_MESH
 {
     Vk_Buffer vertex_buffer;
+    Vk_Buffer position_buffer; // positions only (Vector3), vertex stream of the depth pre-pass
     Vk_Buffer index_buffer;
     uint32_t vertex_count = 0;
     uint32_t index_count = 0;
     void destroy();
 };
+
+Vk_Buffer create_position_buffer(const Triangle_Mesh& mesh, const char* name);
@@ -1,9 +1,7 @@
 #include "RenderableComponent.h"
 #include "demo.h"
 
-RenderableComponent::RenderableComponent():
-	mMesh(std::make_unique<GPU_MESH>())
-	// mTexture(std::make_unique<Vk_Image>())
+RenderableComponent::RenderableComponent()
 {
 
 }
@@ -11,32 +9,26 @@ RenderableComponent::RenderableComponent():
 void RenderableComponent::Destroy()
 {
 	BaseComponent::Destroy();
-	if (mMesh)
-	{
-		mMesh->destroy();
-		mMesh = nullptr;
-	}
-	if (mTexture)
-	{
-		mTexture->destroy();
-		mTexture = nullptr;
-	}
+	// The asset manager destroys the mesh and the texture.
+	mMesh = Asset_Handle{};
+	mTexture = Asset_Handle{};
 	mRenderInfoBuffer.destroy();
 }
 
 void RenderableComponent::Draw(VkCommandBuffer cmdBuf, RenderInfo* renderInfo)
 {
 	const VkDeviceSize zero_offset = 0;
+	const GPU_MESH* mesh = mMesh.mesh();
 
-	vkCmdBindVertexBuffers(cmdBuf, 0, 1, &mMesh->vertex_buffer.handle, &zero_offset);
-	vkCmdBindIndexBuffer(cmdBuf, mMesh->index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(cmdBuf, mMesh->index_count, 1, 0, 0, 0);
+	vkCmdBindVertexBuffers(cmdBuf, 0, 1, &mesh->vertex_buffer.handle, &zero_offset);
+	vkCmdBindIndexBuffer(cmdBuf, mesh->index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdDrawIndexed(cmdBuf, mesh->index_count, 1, 0, 0, 0);
 }
 
 void RenderableComponent::BindTextureToPipeline(VkCommandBuffer cmdBuf, VkPipelineLayout pipeline)
 {
 	const auto imageInfo = VkDescriptorImageInfo{ VK_NULL_HANDLE,
-	   mTexture->view,
+	   mTexture.texture()->view,
 	   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
 	auto write = VkWriteDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
 
@@ -70,17 +62,43 @@ void RenderableComponent::PushModelMatrixToPipeline(VkCommandBuffer cmdBuf, VkPi
 		pipeline, 1, 1, &write);
 }
 
+void RenderableComponent::EnsureRenderInfoBuffer()
+{
+	if (!mRenderInfoBuffer.handle)
+	{
+		mRenderInfoBuffer = vk_create_mapped_buffer(sizeof(RenderInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			&mMappedRenderInfoBuffer, "RenderInfo");
+	}
+}
+
 void RenderableComponent::DrawWithTextures(VkCommandBuffer cmdBuf, RenderInfo* renderInfo, VkPipelineLayout pipeline)
 {
+	if (!IsResident())
+	{
+		return;
+	}
 	if (renderInfo)
 	{
-		if (!mRenderInfoBuffer.handle)
-		{
-			mRenderInfoBuffer = vk_create_mapped_buffer(sizeof(RenderInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-				&mMappedRenderInfoBuffer, "RenderInfo");
-		}
+		EnsureRenderInfoBuffer();
 		PushModelMatrixToPipeline(cmdBuf, pipeline, renderInfo);
 	}
 	BindTextureToPipeline(cmdBuf, pipeline);
 	Draw(cmdBuf, renderInfo);
 }
+
+void RenderableComponent::DrawDepth(VkCommandBuffer cmdBuf, RenderInfo* renderInfo, VkPipelineLayout pipeline)
+{
+	// Skipped like DrawWithTextures, an object without a texture must not write depth either.
+	if (!IsResident())
+	{
+		return;
+	}
+	EnsureRenderInfoBuffer();
+	PushModelMatrixToPipeline(cmdBuf, pipeline, renderInfo);
+
+	const VkDeviceSize zero_offset = 0;
+	const GPU_MESH* mesh = mMesh.mesh();
+	vkCmdBindVertexBuffers(cmdBuf, 0, 1, &mesh->position_buffer.handle, &zero_offset);
+	vkCmdBindIndexBuffer(cmdBuf, mesh->index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdDrawIndexed(cmdBuf, mesh->index_count, 1, 0, 0, 0);
+}
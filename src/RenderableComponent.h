@@ -3,7 +3,7 @@
 
 #include "BaseComponent.h"
 #include "Mesh.h"
-struct GPU_MESH;
+#include "asset_manager.h"
 
 struct RenderInfo
 {
@@ -17,14 +17,21 @@ class RenderableComponent :
 public:
     RenderableComponent();
 
-    std::unique_ptr<GPU_MESH>& GetGPUMesh()
+    // The mesh and the texture are owned by the Asset_Manager that returned the handles.
+    // Nothing is drawn until both are resident.
+    void SetMesh(Asset_Handle mesh)
     {
-        return mMesh;
+        mMesh = std::move(mesh);
     }
 
-    std::unique_ptr<Vk_Image>& GetTexture()
+    void SetTexture(Asset_Handle texture)
     {
-        return mTexture;
+        mTexture = std::move(texture);
+    }
+
+    bool IsResident() const
+    {
+        return mMesh.request && mTexture.request && mMesh.is_resident() && mTexture.is_resident();
     }
 
     virtual void Destroy() override;
@@ -35,14 +42,18 @@ public:
 
     virtual void DrawWithTextures(VkCommandBuffer cmdBuf, RenderInfo* renderInfo, VkPipelineLayout pipeline);
 
+    // Depth pre-pass draw: model matrices and the position-only vertex stream, no texture.
+    virtual void DrawDepth(VkCommandBuffer cmdBuf, RenderInfo* renderInfo, VkPipelineLayout pipeline);
+
     DEFAULT_DESTRUCTOR_COMPONENT(RenderableComponent)
 
 protected:
+    void EnsureRenderInfoBuffer();
     virtual void PushModelMatrixToPipeline(VkCommandBuffer cmdBuf, VkPipelineLayout pipeline, RenderInfo* renderInfo);
 
 private:
-    std::unique_ptr<GPU_MESH> mMesh;
-    std::unique_ptr<Vk_Image> mTexture = nullptr;
+    Asset_Handle mMesh;
+    Asset_Handle mTexture;
 
     Vk_Buffer mRenderInfoBuffer;
     void* mMappedRenderInfoBuffer;
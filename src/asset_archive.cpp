@@ -0,0 +1,405 @@
+#include "asset_archive.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Asset_Archive g_asset_archive;
+
+namespace {
+constexpr char archive_magic[4] = { 'V', 'K', 'P', 'A' };
+constexpr uint32_t archive_version = 1;
+constexpr uint32_t archive_alignment = 64;
+
+struct Archive_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t alignment;
+    uint64_t index_offset;
+    uint64_t index_size;
+};
+
+// Followed by name_length bytes of the name, padded to 8 bytes.
+struct Archive_Index_Entry {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t uncompressed_size;
+    uint32_t compression;
+    uint32_t name_length;
+};
+
+constexpr uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}
+
+//
+// LZ4 block format: sequences of [token][literal length][literals][offset][match length].
+// The last sequence has literals only, the last 5 bytes are always literals and the last
+// match starts at least 12 bytes before the end.
+//
+static void lz4_write_length(std::vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(uint8_t(length));
+}
+
+static void lz4_write_sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_length,
+    size_t offset, size_t match_length)
+{
+    const size_t match_code = match_length >= 4 ? match_length - 4 : 0;
+    out.push_back(uint8_t((std::min<size_t>(literal_length, 15) << 4) | (match_length ? std::min<size_t>(match_code, 15) : 0)));
+    if (literal_length >= 15)
+        lz4_write_length(out, literal_length - 15);
+    out.insert(out.end(), literals, literals + literal_length);
+    if (match_length == 0)
+        return;
+    out.push_back(uint8_t(offset));
+    out.push_back(uint8_t(offset >> 8));
+    if (match_code >= 15)
+        lz4_write_length(out, match_code - 15);
+}
+
+std::vector<uint8_t> lz4_compress(const uint8_t* data, size_t size) {
+    constexpr uint32_t hash_bits = 16;
+    constexpr size_t no_position = SIZE_MAX;
+    std::vector<size_t> hash_table(size_t(1) << hash_bits, no_position);
+    auto read_u32 = [data](size_t position) {
+        uint32_t value;
+        memcpy(&value, data + position, 4);
+        return value;
+    };
+
+    std::vector<uint8_t> out;
+    out.reserve(size + size / 255 + 16);
+    size_t anchor = 0;
+    size_t position = 0;
+    const size_t match_start_limit = size > 12 ? size - 12 : 0;
+    const size_t match_end_limit = size > 5 ? size - 5 : 0;
+    while (position < match_start_limit) {
+        const uint32_t sequence = read_u32(position);
+        const uint32_t hash = (sequence * 2654435761u) >> (32 - hash_bits);
+        const size_t candidate = hash_table[hash];
+        hash_table[hash] = position;
+
+        if (candidate == no_position || position - candidate > 65535 || read_u32(candidate) != sequence) {
+            position++;
+            continue;
+        }
+        size_t match_length = 4;
+        while (position + match_length < match_end_limit && data[candidate + match_length] == data[position + match_length])
+            match_length++;
+
+        lz4_write_sequence(out, data + anchor, position - anchor, position - candidate, match_length);
+        position += match_length;
+        anchor = position;
+    }
+    lz4_write_sequence(out, data + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+bool lz4_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    size_t in = 0;
+    size_t out = 0;
+    auto read_length = [&](size_t& length) {
+        uint8_t byte;
+        do {
+            if (in >= src_size)
+                return false;
+            byte = src[in++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (in < src_size) {
+        const uint8_t token = src[in++];
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(literal_length))
+            return false;
+        if (literal_length > src_size - in || literal_length > dst_size - out)
+            return false;
+        if (literal_length > 0)
+            memcpy(dst + out, src + in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == src_size)
+            break; // last sequence
+
+        if (src_size - in < 2)
+            return false;
+        const size_t offset = size_t(src[in]) | (size_t(src[in + 1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > out)
+            return false;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(match_length))
+            return false;
+        match_length += 4;
+        if (match_length > dst_size - out)
+            return false;
+        // Byte by byte, the match can overlap the bytes it produces.
+        for (size_t i = 0; i < match_length; i++)
+            dst[out + i] = dst[out - offset + i];
+        out += match_length;
+    }
+    return out == dst_size;
+}
+
+//
+// Asset_Archive
+//
+bool Asset_Archive::open(const std::string& archive_file, const std::string& base_directory) {
+    close();
+#ifdef _WIN32
+    file_handle = CreateFileA(archive_file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        printf("Asset archive: failed to open %s\n", archive_file.c_str());
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file_handle, &file_size);
+    mapping_size = uint64_t(file_size.QuadPart);
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle)
+        mapping = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+#else
+    const int fd = ::open(archive_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("Asset archive: failed to open %s\n", archive_file.c_str());
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        mapping_size = uint64_t(file_stat.st_size);
+        void* address = mmap(nullptr, size_t(mapping_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        mapping = (address == MAP_FAILED) ? nullptr : static_cast<const uint8_t*>(address);
+    }
+    ::close(fd); // the mapping keeps the file referenced
+#endif
+    if (!mapping) {
+        printf("Asset archive: failed to map %s\n", archive_file.c_str());
+        close();
+        return false;
+    }
+
+    Archive_Header header;
+    bool valid = mapping_size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, mapping, sizeof(header));
+        valid = memcmp(header.magic, archive_magic, 4) == 0 && header.version == archive_version &&
+            header.index_offset <= mapping_size && header.index_size <= mapping_size - header.index_offset;
+    }
+    uint64_t position = valid ? header.index_offset : 0;
+    const uint64_t index_end = valid ? header.index_offset + header.index_size : 0;
+    for (uint32_t i = 0; valid && i < header.entry_count; i++) {
+        Archive_Index_Entry index_entry;
+        valid = position <= index_end && index_end - position >= sizeof(index_entry);
+        if (!valid)
+            break;
+        memcpy(&index_entry, mapping + position, sizeof(index_entry));
+        position += sizeof(index_entry);
+        valid = index_entry.name_length <= index_end - position &&
+            index_entry.offset <= mapping_size && index_entry.size <= mapping_size - index_entry.offset &&
+            index_entry.compression <= uint32_t(Archive_Compression::lz4);
+        if (!valid)
+            break;
+        std::string name(reinterpret_cast<const char*>(mapping + position), index_entry.name_length);
+        position += align_up(index_entry.name_length, 8);
+        entries[std::move(name)] = Asset_Archive_Entry{ index_entry.offset, index_entry.size, index_entry.uncompressed_size,
+            Archive_Compression(index_entry.compression) };
+    }
+    if (!valid) {
+        printf("Asset archive: %s is not a valid archive\n", archive_file.c_str());
+        close();
+        return false;
+    }
+    this->base_directory = std::filesystem::path(base_directory).lexically_normal().generic_string();
+    printf("Asset archive: %s, %u files\n", archive_file.c_str(), entry_count());
+    return true;
+}
+
+void Asset_Archive::close() {
+#ifdef _WIN32
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+#else
+    if (mapping)
+        munmap(const_cast<uint8_t*>(mapping), size_t(mapping_size));
+#endif
+    mapping = nullptr;
+    mapping_size = 0;
+    entries.clear();
+}
+
+void Asset_Archive::ignore_directory(const std::string& directory) {
+    ignored_directories.push_back(std::filesystem::path(directory).lexically_normal().generic_string() + "/");
+}
+
+std::string Asset_Archive::get_entry_name(const std::string& path) const {
+    return std::filesystem::path(path).lexically_normal().lexically_relative(base_directory).generic_string();
+}
+
+const Asset_Archive_Entry* Asset_Archive::find(const std::string& path) const {
+    if (!mapping)
+        return nullptr;
+    const std::string name = get_entry_name(path);
+    for (const std::string& directory : ignored_directories) {
+        if (name.starts_with(directory))
+            return nullptr;
+    }
+    auto it = entries.find(name);
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+std::span<const uint8_t> Asset_Archive::get_stored_bytes(const Asset_Archive_Entry& entry) const {
+    return { mapping + entry.offset, size_t(entry.size) };
+}
+
+bool Asset_Archive::decompress(const Asset_Archive_Entry& entry, std::vector<uint8_t>& data) const {
+    const std::span<const uint8_t> stored = get_stored_bytes(entry);
+    if (entry.compression == Archive_Compression::none) {
+        data.assign(stored.begin(), stored.end());
+        return true;
+    }
+    data.resize(size_t(entry.uncompressed_size));
+    return lz4_decompress(stored.data(), stored.size(), data.data(), data.size());
+}
+
+bool read_asset_file(const std::string& path, Asset_File& file) {
+    if (const Asset_Archive_Entry* entry = g_asset_archive.find(path)) {
+        if (entry->compression == Archive_Compression::none) {
+            file.bytes = g_asset_archive.get_stored_bytes(*entry);
+            return true;
+        }
+        if (!g_asset_archive.decompress(*entry, file.storage))
+            return false;
+        file.bytes = file.storage;
+        return true;
+    }
+
+    std::ifstream stream(path, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    if (!stream)
+        return false;
+    const std::streamoff size = stream.tellg();
+    if (size < 0)
+        return false;
+    file.storage.resize(size_t(size));
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(file.storage.data()), size);
+    if (!stream)
+        return false;
+    file.bytes = file.storage;
+    return true;
+}
+
+bool write_asset_archive(const std::string& directory, const std::string& archive_file, bool compress) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path archive_path = fs::weakly_canonical(archive_file, ec);
+
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory, ec)) {
+        if (entry.is_regular_file() && fs::weakly_canonical(entry.path(), ec) != archive_path)
+            files.push_back(entry.path());
+    }
+    if (ec) {
+        printf("Asset archive: failed to list %s\n", directory.c_str());
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    FILE* out = fopen(archive_file.c_str(), "wb");
+    if (!out) {
+        printf("Asset archive: failed to create %s\n", archive_file.c_str());
+        return false;
+    }
+    auto write_padding = [out](uint64_t position, uint64_t alignment) {
+        static const uint8_t zeros[archive_alignment]{};
+        const uint64_t padding = align_up(position, alignment) - position;
+        fwrite(zeros, 1, size_t(padding), out);
+        return position + padding;
+    };
+
+    Archive_Header header{};
+    memcpy(header.magic, archive_magic, 4);
+    header.version = archive_version;
+    header.entry_count = uint32_t(files.size());
+    header.alignment = archive_alignment;
+    fwrite(&header, sizeof(header), 1, out);
+    uint64_t position = write_padding(sizeof(header), archive_alignment);
+
+    std::vector<std::pair<std::string, Archive_Index_Entry>> index;
+    uint64_t total_size = 0;
+    for (const fs::path& file : files) {
+        Asset_File contents;
+        if (!read_asset_file(file.string(), contents)) {
+            printf("Asset archive: failed to read %s\n", file.string().c_str());
+            fclose(out);
+            return false;
+        }
+        Archive_Index_Entry entry{};
+        entry.offset = position;
+        entry.uncompressed_size = contents.bytes.size();
+        entry.compression = uint32_t(Archive_Compression::none);
+
+        std::span<const uint8_t> payload = contents.bytes;
+        std::vector<uint8_t> compressed;
+        if (compress && file.extension() != ".spv" && !payload.empty()) {
+            compressed = lz4_compress(payload.data(), payload.size());
+            if (compressed.size() <= payload.size() - payload.size() / 8) {
+                payload = compressed;
+                entry.compression = uint32_t(Archive_Compression::lz4);
+            }
+        }
+        entry.size = payload.size();
+        fwrite(payload.data(), 1, payload.size(), out);
+        position = write_padding(position + payload.size(), archive_alignment);
+        total_size += entry.uncompressed_size;
+
+        const std::string name = fs::path(file).lexically_relative(directory).generic_string();
+        entry.name_length = uint32_t(name.size());
+        index.emplace_back(name, entry);
+        printf("%-50s %10llu -> %10llu%s\n", name.c_str(), (unsigned long long)entry.uncompressed_size,
+            (unsigned long long)entry.size, entry.compression ? " lz4" : "");
+    }
+
+    header.index_offset = position;
+    for (const auto& [name, entry] : index) {
+        fwrite(&entry, sizeof(entry), 1, out);
+        fwrite(name.data(), 1, name.size(), out);
+        position = write_padding(position + sizeof(entry) + name.size(), 8);
+    }
+    header.index_size = position - header.index_offset;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    const bool ok = ferror(out) == 0;
+    fclose(out);
+
+    printf("Asset archive: %s, %zu files, %llu bytes of data, %llu bytes archive\n", archive_file.c_str(), files.size(),
+        (unsigned long long)total_size, (unsigned long long)position);
+    return ok;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Packed asset archive (.pak), built from the data directory by the asset-packer tool.
+//
+// Layout: header, entry payloads, index. Every payload starts at a multiple of the header's
+// alignment, so uncompressed payloads can be used in place from the memory mapping (SPIR-V
+// words, staging buffer copies). The index stores for each entry its path relative to the
+// data directory ('/' separators), payload offset and size, uncompressed size and compression.
+enum class Archive_Compression : uint32_t {
+    none = 0,
+    lz4 = 1, // LZ4 block format
+};
+
+struct Asset_Archive_Entry {
+    uint64_t offset;
+    uint64_t size;              // stored size
+    uint64_t uncompressed_size;
+    Archive_Compression compression;
+};
+
+// Read-only memory-mapped archive.
+struct Asset_Archive {
+    Asset_Archive() = default;
+    Asset_Archive(const Asset_Archive&) = delete;
+    Asset_Archive& operator=(const Asset_Archive&) = delete;
+    ~Asset_Archive() { close(); }
+
+    // base_directory is the directory the archive was built from. Files are looked up by their
+    // path relative to it, so callers keep using get_resource_path.
+    bool open(const std::string& archive_file, const std::string& base_directory);
+    void close();
+    bool is_open() const { return mapping != nullptr; }
+
+    // Files under this directory (relative to the base directory) are not looked up in the archive.
+    void ignore_directory(const std::string& directory);
+
+    // path is a file path under the base directory. Returns null if the archive does not have it.
+    const Asset_Archive_Entry* find(const std::string& path) const;
+    // Stored bytes of the entry, inside the mapping.
+    std::span<const uint8_t> get_stored_bytes(const Asset_Archive_Entry& entry) const;
+    bool decompress(const Asset_Archive_Entry& entry, std::vector<uint8_t>& data) const;
+
+    uint32_t entry_count() const { return uint32_t(entries.size()); }
+
+private:
+    std::string get_entry_name(const std::string& path) const;
+
+    std::string base_directory;
+    std::vector<std::string> ignored_directories;
+    std::unordered_map<std::string, Asset_Archive_Entry> entries;
+    const uint8_t* mapping = nullptr;
+    uint64_t mapping_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+// Archive used by read_asset_file, opened with --archive.
+extern Asset_Archive g_asset_archive;
+
+// Contents of an asset file. bytes points into the archive mapping for uncompressed entries,
+// otherwise into storage.
+struct Asset_File {
+    std::span<const uint8_t> bytes;
+    std::vector<uint8_t> storage;
+};
+
+// Reads the file from g_asset_archive if it is there, otherwise from disk.
+bool read_asset_file(const std::string& path, Asset_File& file);
+
+// Packs all files under directory into archive_file. With compress, entries are stored LZ4
+// compressed when it saves at least 1/8 of the size, except SPIR-V, which is used in place.
+bool write_asset_archive(const std::string& directory, const std::string& archive_file, bool compress);
+
+std::vector<uint8_t> lz4_compress(const uint8_t* data, size_t size);
+// dst_size must be the exact uncompressed size. Returns false for malformed input.
+bool lz4_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size);
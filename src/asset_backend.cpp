@@ -0,0 +1,57 @@
+#include "asset_manager.h"
+#include "asset_archive.h"
+#include "profiler.h"
+
+#include "stb_image.h"
+
+static void load_asset(Asset_Kind kind, const std::string& path, float mesh_scale, Asset_Data& data) {
+    if (kind == Asset_Kind::mesh) {
+        PROFILE_ZONE("Load mesh asset");
+        data.mesh = load_obj_model(path, mesh_scale);
+        return;
+    }
+    PROFILE_ZONE("Decode texture asset");
+    int component_count;
+    Asset_File file;
+    stbi_uc* pixels = nullptr;
+    if (read_asset_file(path, file)) {
+        pixels = stbi_load_from_memory(file.bytes.data(), int(file.bytes.size()), &data.width, &data.height,
+            &component_count, STBI_rgb_alpha);
+    }
+    if (pixels == nullptr)
+        error("failed to load image file: " + path);
+    data.pixels.assign(pixels, pixels + size_t(data.width) * data.height * 4);
+    stbi_image_free(pixels);
+}
+
+static std::shared_ptr<GPU_MESH> create_mesh(const std::string& path, const Asset_Data& data) {
+    PROFILE_ZONE("Upload mesh asset");
+    auto mesh = std::make_shared<GPU_MESH>();
+    const std::string vertex_buffer_name = path + " vertices";
+    const std::string index_buffer_name = path + " indices";
+    const std::string position_buffer_name = path + " positions";
+    mesh->vertex_buffer = vk_create_buffer(data.mesh.vertices.size() * sizeof(data.mesh.vertices[0]),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, data.mesh.vertices.data(), vertex_buffer_name.c_str());
+    mesh->vertex_count = uint32_t(data.mesh.vertices.size());
+    mesh->position_buffer = create_position_buffer(data.mesh, position_buffer_name.c_str());
+    mesh->index_buffer = vk_create_buffer(data.mesh.indices.size() * sizeof(data.mesh.indices[0]),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, data.mesh.indices.data(), index_buffer_name.c_str());
+    mesh->index_count = uint32_t(data.mesh.indices.size());
+    return mesh;
+}
+
+static std::shared_ptr<Vk_Image> create_texture(const std::string& path, const Asset_Data& data) {
+    PROFILE_ZONE("Upload texture asset");
+    return std::make_shared<Vk_Image>(vk_create_texture(data.width, data.height, VK_FORMAT_R8G8B8A8_SRGB, true,
+        data.pixels.data(), 4, path.c_str()));
+}
+
+Asset_Backend vk_get_asset_backend() {
+    Asset_Backend backend;
+    backend.load = load_asset;
+    backend.create_mesh = create_mesh;
+    backend.create_texture = create_texture;
+    backend.destroy_mesh = [](GPU_MESH& mesh) { mesh.destroy(); };
+    backend.destroy_texture = [](Vk_Image& texture) { texture.destroy(); };
+    return backend;
+}
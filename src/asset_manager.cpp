@@ -0,0 +1,209 @@
+#include "asset_manager.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <thread>
+
+void Asset_Manager::initialize(Asset_Backend asset_backend) {
+    backend = std::move(asset_backend);
+}
+
+std::string Asset_Manager::make_key(const Asset_Request& request) {
+    if (request.kind == Asset_Kind::texture)
+        return "texture:" + request.path;
+    return "mesh:" + request.path + ":" + std::to_string(request.mesh_scale);
+}
+
+void Asset_Manager::resolve(Asset_Request& request, Asset_State state) {
+    request.state.store(state, std::memory_order_release);
+}
+
+Asset_Handle Asset_Manager::push_request(Asset_Kind kind, const std::string& path, float mesh_scale, Asset_Priority priority) {
+    auto request = std::make_shared<Asset_Request>();
+    request->kind = kind;
+    request->path = path;
+    request->mesh_scale = mesh_scale;
+    request->priority = priority;
+    request_count.fetch_add(1, std::memory_order_relaxed);
+    unresolved_count.fetch_add(1, std::memory_order_relaxed);
+    request_queues[size_t(priority)].push(request);
+    return Asset_Handle{ request };
+}
+
+Asset_Handle Asset_Manager::request_mesh(const std::string& path, Asset_Priority priority, float scale) {
+    return push_request(Asset_Kind::mesh, path, scale, priority);
+}
+
+Asset_Handle Asset_Manager::request_texture(const std::string& path, Asset_Priority priority) {
+    return push_request(Asset_Kind::texture, path, 1.f, priority);
+}
+
+void Asset_Manager::start_load(const std::string& key, const std::shared_ptr<Asset_Request>& request) {
+    auto load = std::make_unique<Load>();
+    load->kind = request->kind;
+    load->path = request->path;
+    load->mesh_scale = request->mesh_scale;
+    request->state.store(Asset_State::loading, std::memory_order_relaxed);
+    load->requests.push_back(request);
+
+    // The job writes into *load, which stays at the same address until the job is finished.
+    Load* target = load.get();
+    load->job = g_job_system.run([this, target] {
+        backend.load(target->kind, target->path, target->mesh_scale, target->data);
+    });
+    loads.emplace(key, std::move(load));
+    load_count++;
+}
+
+void Asset_Manager::finish_load(Load& load) {
+    const size_t cancelled = std::count_if(load.requests.begin(), load.requests.end(),
+        [](const auto& request) { return request->cancel_requested.load(std::memory_order_relaxed); });
+
+    bool loaded = true;
+    try {
+        g_job_system.wait(load.job);
+    }
+    catch (const std::exception&) {
+        loaded = false;
+    }
+    const std::string key = make_key(*load.requests.front());
+
+    // Nobody wants the asset anymore, the parsed data is dropped without an upload.
+    if (cancelled == load.requests.size()) {
+        for (const auto& request : load.requests)
+            resolve(*request, Asset_State::cancelled);
+        cancelled_count += cancelled;
+        unresolved_count.fetch_sub(uint32_t(load.requests.size()), std::memory_order_relaxed);
+        return;
+    }
+
+    std::shared_ptr<GPU_MESH> mesh;
+    std::shared_ptr<Vk_Image> texture;
+    if (loaded && load.kind == Asset_Kind::mesh) {
+        mesh = backend.create_mesh(load.path, load.data);
+        resident_meshes[key] = mesh;
+    }
+    else if (loaded) {
+        texture = backend.create_texture(load.path, load.data);
+        resident_textures[key] = texture;
+    }
+    else {
+        failed_count++;
+    }
+    load.data = Asset_Data();
+
+    // The asset stays resident for the other requests, the cancelled ones get no reference to it.
+    for (const auto& request : load.requests) {
+        if (request->cancel_requested.load(std::memory_order_relaxed)) {
+            resolve(*request, Asset_State::cancelled);
+            cancelled_count++;
+            continue;
+        }
+        request->mesh = mesh;
+        request->texture = texture;
+        resolve(*request, loaded ? Asset_State::resident : Asset_State::failed);
+    }
+    unresolved_count.fetch_sub(uint32_t(load.requests.size()), std::memory_order_relaxed);
+}
+
+void Asset_Manager::update() {
+    PROFILE_ZONE("Asset_Manager::update");
+
+    // Finished loads first, they free slots for the waiting requests.
+    uint32_t upload_count = 0;
+    for (auto it = loads.begin(); it != loads.end() && upload_count < max_uploads_per_update;) {
+        if (!g_job_system.is_finished(it->second->job)) {
+            ++it;
+            continue;
+        }
+        finish_load(*it->second);
+        it = loads.erase(it);
+        upload_count++;
+    }
+
+    for (size_t priority = 0; priority < request_queues.size(); priority++) {
+        std::shared_ptr<Asset_Request> request;
+        while (request_queues[priority].pop(request))
+            waiting_requests[priority].push_back(std::move(request));
+    }
+
+    // Highest priority first. A request that waits for a load slot holds back the requests behind it.
+    for (auto& queue : waiting_requests) {
+        while (!queue.empty()) {
+            Asset_Request& request = *queue.front();
+            const std::string key = make_key(request);
+            auto mesh = resident_meshes.find(key);
+            auto texture = resident_textures.find(key);
+            auto load = loads.find(key);
+
+            if (request.cancel_requested.load(std::memory_order_relaxed)) {
+                resolve(request, Asset_State::cancelled);
+                cancelled_count++;
+                unresolved_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            else if (mesh != resident_meshes.end() || texture != resident_textures.end()) {
+                if (mesh != resident_meshes.end())
+                    request.mesh = mesh->second;
+                else
+                    request.texture = texture->second;
+                resolve(request, Asset_State::resident);
+                coalesced_count++;
+                unresolved_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            else if (load != loads.end()) {
+                request.state.store(Asset_State::loading, std::memory_order_relaxed);
+                load->second->requests.push_back(queue.front());
+                coalesced_count++;
+            }
+            else if (loads.size() < max_loads_in_flight) {
+                start_load(key, queue.front());
+            }
+            else {
+                break;
+            }
+            queue.pop_front();
+        }
+    }
+}
+
+void Asset_Manager::finish_requests() {
+    while (unresolved_count.load(std::memory_order_relaxed) != 0) {
+        update();
+        std::this_thread::yield();
+    }
+}
+
+void Asset_Manager::shutdown() {
+    for (auto& [key, load] : loads) {
+        try {
+            g_job_system.wait(load->job);
+        }
+        catch (const std::exception&) {
+        }
+        for (const auto& request : load->requests)
+            resolve(*request, Asset_State::cancelled);
+    }
+    loads.clear();
+    for (auto& queue : waiting_requests)
+        queue.clear();
+    for (auto& [key, mesh] : resident_meshes)
+        backend.destroy_mesh(*mesh);
+    for (auto& [key, texture] : resident_textures)
+        backend.destroy_texture(*texture);
+    resident_meshes.clear();
+    resident_textures.clear();
+}
+
+Asset_Manager_Stats Asset_Manager::get_stats() const {
+    Asset_Manager_Stats stats{};
+    stats.requests = request_count.load(std::memory_order_relaxed);
+    stats.coalesced = coalesced_count;
+    stats.cancelled = cancelled_count;
+    stats.loads = load_count;
+    stats.failed = failed_count;
+    stats.resident_count = uint32_t(resident_meshes.size() + resident_textures.size());
+    stats.loads_in_flight = uint32_t(loads.size());
+    for (const auto& queue : waiting_requests)
+        stats.queued += uint32_t(queue.size());
+    return stats;
+}
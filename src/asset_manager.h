@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Mesh.h"
+#include "job_system.h"
+#include "mpsc_queue.h"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class Asset_Kind {
+    mesh,
+    texture,
+};
+
+enum class Asset_Priority {
+    high,
+    normal,
+    low,
+    count
+};
+
+enum class Asset_State : uint32_t {
+    queued,
+    loading,
+    resident,
+    failed,
+    cancelled,
+};
+
+// Shared by the requester and the manager. The asset pointers are published by the
+// release store of state, read them only after state() returned resident.
+struct Asset_Request {
+    Asset_Kind kind;
+    std::string path;
+    float mesh_scale;
+    Asset_Priority priority;
+    std::atomic<Asset_State> state = Asset_State::queued;
+    std::atomic<bool> cancel_requested = false;
+    std::shared_ptr<GPU_MESH> mesh;
+    std::shared_ptr<Vk_Image> texture;
+};
+
+struct Asset_Handle {
+    std::shared_ptr<Asset_Request> request;
+
+    Asset_State state() const { return request->state.load(std::memory_order_acquire); }
+    bool is_resident() const { return state() == Asset_State::resident; }
+    // Null until the asset is resident.
+    GPU_MESH* mesh() const { return is_resident() ? request->mesh.get() : nullptr; }
+    Vk_Image* texture() const { return is_resident() ? request->texture.get() : nullptr; }
+    // The request is dropped if it is not resident yet. A load shared with other requests
+    // (same path) continues while at least one of them is not cancelled.
+    void cancel() const { request->cancel_requested.store(true, std::memory_order_relaxed); }
+};
+
+struct Asset_Manager_Stats {
+    uint64_t requests;
+    uint64_t coalesced;     // served by a load that was in flight or by a resident asset
+    uint64_t cancelled;
+    uint64_t loads;         // files read
+    uint64_t failed;
+    uint32_t resident_count;
+    uint32_t loads_in_flight;
+    uint32_t queued;        // taken from the request queues, waiting for a load slot
+};
+
+// Parsed mesh or decoded image, written on g_job_system and uploaded by update().
+struct Asset_Data {
+    Triangle_Mesh mesh;
+    std::vector<uint8_t> pixels; // RGBA8
+    int width = 0;
+    int height = 0;
+};
+
+// File loading and GPU resource creation used by the manager. vk_get_asset_backend() returns the
+// real one, the asset manager test replaces it to run without a device.
+struct Asset_Backend {
+    // Runs on g_job_system. Throws if the file can not be loaded.
+    std::function<void(Asset_Kind kind, const std::string& path, float mesh_scale, Asset_Data& data)> load;
+    // The others run on the thread that calls update() and shutdown().
+    std::function<std::shared_ptr<GPU_MESH>(const std::string& path, const Asset_Data& data)> create_mesh;
+    std::function<std::shared_ptr<Vk_Image>(const std::string& path, const Asset_Data& data)> create_texture;
+    std::function<void(GPU_MESH& mesh)> destroy_mesh;
+    std::function<void(Vk_Image& texture)> destroy_texture;
+};
+
+// Loads meshes (load_obj_model) and textures (stb_image) in the background. Requests can be
+// made from any thread through lock-free queues, one per priority. update() runs on the render
+// thread: it takes the requests, starts file parsing and decoding on g_job_system and creates the
+// GPU resources for finished loads, because buffer and image uploads submit to vk.queue.
+// Resident assets are kept until shutdown and shared by all requests for the same path.
+struct Asset_Manager {
+    uint32_t max_loads_in_flight = 8;
+    uint32_t max_uploads_per_update = 4; // bounds the time update() spends in uploads per frame
+
+    void initialize(Asset_Backend backend);
+    // Waits for the loads in flight and destroys the GPU resources. The device must be idle.
+    void shutdown();
+
+    Asset_Handle request_mesh(const std::string& path, Asset_Priority priority = Asset_Priority::normal, float scale = 1.f);
+    Asset_Handle request_texture(const std::string& path, Asset_Priority priority = Asset_Priority::normal);
+
+    void update();
+    // Calls update() until all requests are resolved.
+    void finish_requests();
+
+    Asset_Manager_Stats get_stats() const;
+
+private:
+    struct Load {
+        Asset_Kind kind;
+        std::string path;
+        float mesh_scale;
+        std::vector<std::shared_ptr<Asset_Request>> requests;
+        Job_Handle job;
+        Asset_Data data; // written by the job
+    };
+
+    Asset_Handle push_request(Asset_Kind kind, const std::string& path, float mesh_scale, Asset_Priority priority);
+    void start_load(const std::string& key, const std::shared_ptr<Asset_Request>& request);
+    void finish_load(Load& load);
+    static std::string make_key(const Asset_Request& request);
+    static void resolve(Asset_Request& request, Asset_State state);
+
+    Asset_Backend backend;
+    std::array<Mpsc_Queue<std::shared_ptr<Asset_Request>>, size_t(Asset_Priority::count)> request_queues;
+    std::atomic<uint64_t> request_count = 0;
+    std::atomic<uint32_t> unresolved_count = 0;
+
+    // Render thread only.
+    std::array<std::deque<std::shared_ptr<Asset_Request>>, size_t(Asset_Priority::count)> waiting_requests;
+    std::unordered_map<std::string, std::unique_ptr<Load>> loads; // in flight, by key
+    std::unordered_map<std::string, std::shared_ptr<GPU_MESH>> resident_meshes;
+    std::unordered_map<std::string, std::shared_ptr<Vk_Image>> resident_textures;
+    uint64_t coalesced_count = 0;
+    uint64_t cancelled_count = 0;
+    uint64_t load_count = 0;
+    uint64_t failed_count = 0;
+};
+
+// Reads files with read_asset_file (archive or loose files) and creates Vulkan buffers and images.
+Asset_Backend vk_get_asset_backend();
@@ -0,0 +1,171 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+Benchmark_Key Benchmark_Script::sample(double time) const {
+    if (keys.empty())
+        return Benchmark_Key{ time, Vector3(0, 0.5, 3.0), 0.f };
+    if (time <= keys.front().time)
+        return keys.front();
+    if (time >= keys.back().time)
+        return keys.back();
+
+    auto next = std::upper_bound(keys.begin(), keys.end(), time,
+        [](double t, const Benchmark_Key& key) { return t < key.time; });
+    const Benchmark_Key& k0 = *(next - 1);
+    const Benchmark_Key& k1 = *next;
+    const float t = float((time - k0.time) / (k1.time - k0.time));
+
+    Benchmark_Key key;
+    key.time = time;
+    key.camera_pos = k0.camera_pos + (k1.camera_pos - k0.camera_pos) * t;
+    key.object_yaw = k0.object_yaw + (k1.object_yaw - k0.object_yaw) * t;
+    return key;
+}
+
+Benchmark_Script load_benchmark_script(const std::string& file_name) {
+    std::ifstream file(file_name);
+    if (!file)
+        error("failed to open benchmark script: " + file_name);
+
+    Benchmark_Script script;
+    script.file_name = file_name;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream stream(line);
+        std::string command;
+        if (!(stream >> command))
+            continue;
+
+        bool ok = true;
+        if (command == "warmup_frames")
+            ok = bool(stream >> script.warmup_frames);
+        else if (command == "frames")
+            ok = bool(stream >> script.measured_frames) && script.measured_frames > 0;
+        else if (command == "time_step")
+            ok = bool(stream >> script.time_step) && script.time_step > 0.0;
+        else if (command == "antialiasing")
+            ok = bool(stream >> script.antialiasing_option) && script.antialiasing_option >= 0 && script.antialiasing_option <= 2;
+        else if (command == "compute_post_process")
+            ok = bool(stream >> script.compute_post_process);
+        else if (command == "resolution_scale")
+            ok = bool(stream >> script.resolution_scale) && script.resolution_scale > 0.f && script.resolution_scale <= 1.f;
+        else if (command == "key") {
+            Benchmark_Key key;
+            ok = bool(stream >> key.time >> key.camera_pos.x >> key.camera_pos.y >> key.camera_pos.z >> key.object_yaw);
+            ok = ok && (script.keys.empty() || key.time > script.keys.back().time);
+            if (ok)
+                script.keys.push_back(key);
+        }
+        else
+            ok = false;
+
+        if (!ok)
+            error(file_name + ":" + std::to_string(line_number) + ": invalid benchmark command: " + line);
+    }
+    return script;
+}
+
+namespace {
+struct Statistics {
+    double average, min, max, p50, p90, p95, p99;
+};
+}
+
+static Statistics compute_statistics(std::vector<double> values) {
+    Statistics stats{};
+    if (values.empty())
+        return stats;
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (double v : values)
+        sum += v;
+    auto percentile = [&values](double p) {
+        size_t index = std::min(values.size() - 1, size_t(p * (values.size() - 1) + 0.5));
+        return values[index];
+    };
+    stats.average = sum / values.size();
+    stats.min = values.front();
+    stats.max = values.back();
+    stats.p50 = percentile(0.50);
+    stats.p90 = percentile(0.90);
+    stats.p95 = percentile(0.95);
+    stats.p99 = percentile(0.99);
+    return stats;
+}
+
+static void write_statistics(FILE* file, const char* name, const Statistics& s, bool last) {
+    fprintf(file, "    \"%s\": { \"avg\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+        name, s.average, s.min, s.p50, s.p90, s.p95, s.p99, s.max, last ? "" : ",");
+}
+
+void Benchmark_Recorder::write(const std::string& directory, const Benchmark_Script& script,
+    const std::string& device_name, uint32_t width, uint32_t height) const
+{
+    std::filesystem::create_directories(directory);
+
+    const std::string csv_file_name = (std::filesystem::path(directory) / "benchmark.csv").string();
+    FILE* csv = fopen(csv_file_name.c_str(), "w");
+    if (!csv)
+        error("failed to write " + csv_file_name);
+    fprintf(csv, "frame,time,cpu_ms");
+    for (const std::string& name : gpu_interval_names)
+        fprintf(csv, ",gpu_%s_ms", name.c_str());
+    fprintf(csv, "\n");
+    for (size_t i = 0; i < frames.size(); i++) {
+        fprintf(csv, "%zu,%.4f,%.4f", i, frames[i].time, frames[i].cpu_ms);
+        for (float gpu_ms : frames[i].gpu_ms)
+            fprintf(csv, ",%.4f", gpu_ms);
+        fprintf(csv, "\n");
+    }
+    fclose(csv);
+
+    const std::string json_file_name = (std::filesystem::path(directory) / "benchmark.json").string();
+    FILE* json = fopen(json_file_name.c_str(), "w");
+    if (!json)
+        error("failed to write " + json_file_name);
+
+    std::string escaped_script_name = script.file_name;
+    std::replace(escaped_script_name.begin(), escaped_script_name.end(), '\\', '/');
+
+    fprintf(json, "{\n");
+    fprintf(json, "  \"script\": \"%s\",\n", escaped_script_name.c_str());
+    fprintf(json, "  \"device\": \"%s\",\n", device_name.c_str());
+    fprintf(json, "  \"width\": %u,\n", width);
+    fprintf(json, "  \"height\": %u,\n", height);
+    fprintf(json, "  \"warmup_frames\": %u,\n", script.warmup_frames);
+    fprintf(json, "  \"measured_frames\": %zu,\n", frames.size());
+    fprintf(json, "  \"time_step\": %.6f,\n", script.time_step);
+    fprintf(json, "  \"milliseconds\": {\n");
+
+    std::vector<double> values(frames.size());
+    for (size_t i = 0; i < frames.size(); i++)
+        values[i] = frames[i].cpu_ms;
+    write_statistics(json, "cpu", compute_statistics(values), gpu_interval_names.empty());
+
+    for (size_t k = 0; k < gpu_interval_names.size(); k++) {
+        for (size_t i = 0; i < frames.size(); i++)
+            values[i] = frames[i].gpu_ms[k];
+        const std::string name = "gpu_" + gpu_interval_names[k];
+        write_statistics(json, name.c_str(), compute_statistics(values), k == gpu_interval_names.size() - 1);
+    }
+    fprintf(json, "  },\n");
+    fprintf(json, "  \"memory_bytes\": {\n");
+    for (size_t i = 0; i < memory_bytes.size(); i++) {
+        fprintf(json, "    \"%s\": %llu%s\n", memory_bytes[i].first.c_str(), (unsigned long long)memory_bytes[i].second,
+            i + 1 == memory_bytes.size() ? "" : ",");
+    }
+    fprintf(json, "  }\n}\n");
+    fclose(json);
+
+    printf("Benchmark: %zu frames written to %s and %s\n", frames.size(), csv_file_name.c_str(), json_file_name.c_str());
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "lib.h"
+
+#include <string>
+#include <vector>
+
+// Benchmark script (--benchmark <script>). The scene is driven along a fixed timeline with
+// a fixed time step, so runs on the same machine are comparable across commits.
+//
+// One command per line, '#' starts a comment:
+//   warmup_frames 60            frames rendered before measurements start
+//   frames 600                  measured frames
+//   time_step 0.0166667         time_delta of every frame, in seconds
+//   antialiasing 2              0 - None, 1 - FXAA, 2 - TAA
+//   compute_post_process 1      0 or 1
+//   resolution_scale 0.75       fixed resolution scale, dynamic resolution is disabled
+//   key 0.0  0 0.5 3.0  0       time, camera position (x y z), object yaw in degrees
+// Camera position and object yaw are interpolated linearly between keys.
+struct Benchmark_Key {
+    double time;
+    Vector3 camera_pos;
+    float object_yaw;
+};
+
+struct Benchmark_Script {
+    std::string file_name;
+    uint32_t warmup_frames = 60;
+    uint32_t measured_frames = 600;
+    double time_step = 1.0 / 60.0;
+    int antialiasing_option = -1;   // -1 - keep the default
+    int compute_post_process = -1;  // -1 - keep the default
+    float resolution_scale = 1.f;
+    std::vector<Benchmark_Key> keys;  // sorted by time
+
+    Benchmark_Key sample(double time) const;
+};
+
+Benchmark_Script load_benchmark_script(const std::string& file_name);
+
+struct Benchmark_Frame {
+    double time;
+    double cpu_ms;
+    std::vector<float> gpu_ms;  // indexed like Benchmark_Recorder::gpu_interval_names
+};
+
+// Per-frame timings of the measured frames. write() produces <directory>/benchmark.csv
+// with one row per frame and <directory>/benchmark.json with the run settings and percentiles.
+struct Benchmark_Recorder {
+    std::vector<std::string> gpu_interval_names;
+    std::vector<Benchmark_Frame> frames;
+    std::vector<std::pair<std::string, uint64_t>> memory_bytes; // memory usage at the end of the run
+
+    void write(const std::string& directory, const Benchmark_Script& script,
+        const std::string& device_name, uint32_t width, uint32_t height) const;
+};
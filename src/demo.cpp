@@ -4,11 +4,14 @@
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_vulkan.h"
 #include "imgui/imgui_impl_glfw.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "render_target_pool.h"
 
+#include <algorithm>
 #include <array>
-#include <stb_image_write.h>
+#include <cstdio>
 
-#include "Constants.h"
 #include "TransformComponent.h"
 
 static VkFormat get_depth_image_format() {
@@ -24,19 +27,77 @@ static VkFormat get_depth_image_format() {
     return VK_FORMAT_UNDEFINED;
 }
 
-void Vk_Demo::initialize(GLFWwindow* window) {
+// Motion vectors are signed uv offsets, so they need a linear two-channel format.
+static VkFormat get_motion_vector_image_format() {
+    VkFormat candidates[2] = { VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16_SNORM };
+    const VkFormatFeatureFlags required_features = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    for (auto format : candidates) {
+        VkFormatProperties props{};
+        vkGetPhysicalDeviceFormatProperties(vk.physical_device, format, &props);
+        if ((props.optimalTilingFeatures & required_features) == required_features) {
+            return format;
+        }
+    }
+    error("failed to select motion vector attachment format");
+    return VK_FORMAT_UNDEFINED;
+}
+
+// Format of the storage image written by postprocess.comp. Its content is blitted to the swapchain.
+constexpr VkFormat post_process_output_format = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+// Should match TILE_SIZE in postprocess.comp.glsl.
+constexpr uint32_t post_process_tile_size = 16;
+constexpr float min_resolution_scale = 0.5f;
+
+constexpr VkShaderStageFlags post_process_shader_stages = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+static const char* antialiasing_option_names[] = { "None", "FXAA", "TAA" };
+
+#ifndef SHADER_SOURCE_DIR
+#define SHADER_SOURCE_DIR "src/shaders"
+#endif
+
+// Set by --shader-hot-reload command line option.
+bool g_shader_hot_reload = false;
+
+// Specializes constant_id 0 (aliasingOption) of the post-process shaders.
+struct Post_Process_Specialization {
+    int32_t aliasing_option;
+    VkSpecializationMapEntry map_entry{ 0, 0, sizeof(int32_t) };
+    VkSpecializationInfo info{ 1, &map_entry, sizeof(int32_t), &aliasing_option };
+
+    Post_Process_Specialization(int option) : aliasing_option(option) {}
+    Post_Process_Specialization(const Post_Process_Specialization&) = delete;
+};
+
+static bool is_compute_post_process_supported() {
+    VkFormatProperties output_props{};
+    vkGetPhysicalDeviceFormatProperties(vk.physical_device, post_process_output_format, &output_props);
+    VkFormatProperties swapchain_props{};
+    vkGetPhysicalDeviceFormatProperties(vk.physical_device, vk.surface_format.format, &swapchain_props);
+
+    const VkFormatFeatureFlags output_features = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+    return (output_props.optimalTilingFeatures & output_features) == output_features &&
+        (swapchain_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT) != 0;
+}
+
+void Vk_Demo::initialize(GLFWwindow* window, const Headless_Options& headless_options) {
+    headless = headless_options;
+    g_job_system.initialize(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
     Vk_Init_Params vk_init_params;
     vk_init_params.error_reporter = &error;
 
+    // Surface and swapchain extensions go first, headless mode skips them.
     std::array instance_extensions = {
         VK_KHR_SURFACE_EXTENSION_NAME,
-        VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
 #ifdef VK_USE_PLATFORM_WIN32_KHR
         VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
 #endif
 #ifdef VK_USE_PLATFORM_XCB_KHR
         VK_KHR_XCB_SURFACE_EXTENSION_NAME,
 #endif
+        VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
     };
     std::array device_extensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -45,6 +106,12 @@ void Vk_Demo::initialize(GLFWwindow* window) {
     };
     vk_init_params.instance_extensions = std::span{ instance_extensions };
     vk_init_params.device_extensions = std::span{ device_extensions };
+    if (headless.enabled) {
+        vk_init_params.instance_extensions = vk_init_params.instance_extensions.last(1);
+        vk_init_params.device_extensions = vk_init_params.device_extensions.subspan(1);
+        vk_init_params.headless = true;
+        vk_init_params.headless_extent = { headless.width, headless.height };
+    }
 
     // Specify required features.
     VkPhysicalDeviceFeatures2 features2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
@@ -78,7 +145,8 @@ void Vk_Demo::initialize(GLFWwindow* window) {
         VK_FORMAT_R8G8B8A8_SRGB,
     };
     vk_init_params.supported_surface_formats = std::span{ surface_formats };
-    vk_init_params.surface_usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    vk_init_params.surface_usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    vk_init_params.pipeline_cache_file = get_resource_path("pipeline_cache.bin");
 
     vk_initialize(window, vk_init_params);
 
@@ -93,99 +161,90 @@ void Vk_Demo::initialize(GLFWwindow* window) {
             VK_VERSION_PATCH(physical_device_properties.properties.apiVersion)
         );
     }
-    auto& gpu_mesh = *castleModel.GetRenderable()->GetGPUMesh();
-    // Geometry buffers.
-    {
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/mesh.obj"), 1.25f);
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/Baloo.obj"), 1.f);
-        Triangle_Mesh mesh = load_obj_model(get_resource_path("model/mine_craft_castle.obj"), 1.f);
-        {
-            const VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            gpu_mesh.vertex_buffer = vk_create_buffer(size, usage, mesh.vertices.data(), "vertex_buffer");
-            gpu_mesh.vertex_count = uint32_t(mesh.vertices.size());
-        }
-        {
-            const VkDeviceSize size = mesh.indices.size() * sizeof(mesh.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            gpu_mesh.index_buffer = vk_create_buffer(size, usage, mesh.indices.data(), "index_buffer");
-            gpu_mesh.index_count = uint32_t(mesh.indices.size());
-        }
 
-        {
-            const VkDeviceSize size = quad.vertices.size() * sizeof(quad.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            quad_mesh.vertex_buffer = vk_create_buffer(size, usage, quad.vertices.data(), "post-process-vertex_buffer");
-            quad_mesh.vertex_count = static_cast<uint32_t>(quad.vertices.size());
-        }
-        {
-            const VkDeviceSize size = quad.indices.size() * sizeof(quad.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            quad_mesh.index_buffer = vk_create_buffer(size, usage, quad.indices.data(), "post-process-index_buffer");
-            quad_mesh.index_count = static_cast<uint32_t>(quad.indices.size());
-        }
+    descriptor_set_layout = Vk_Descriptor_Set_Layout()
+        .uniform_buffer(0, VK_SHADER_STAGE_VERTEX_BIT)
+        .sampled_image(1, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .sampler(2, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .create("set_layout");
+
+    main_texture_descriptor_set_layout = Vk_Descriptor_Set_Layout()
+        .sampled_image(0, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.uniform_buffer(1, VK_SHADER_STAGE_VERTEX_BIT)
+        .create("main_texture_set_layout", true);
+
+    post_process_descriptor_set_layout = Vk_Descriptor_Set_Layout()
+        .default_post_process(post_process_shader_stages)
+		.sampled_image(3, post_process_shader_stages)
+		.sampled_image(5, post_process_shader_stages)
+		.sampler(4, post_process_shader_stages)
+        .storage_image(6, VK_SHADER_STAGE_COMPUTE_BIT)
+        .create("post_process_set_layout");
+
+    auto pushConstant = VkPushConstantRange{ };
+    pushConstant.stageFlags = post_process_shader_stages;
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(Post_Process_Push_Constatnts);
+
+    pipeline_layout = vk_create_pipeline_layout({ descriptor_set_layout, main_texture_descriptor_set_layout }, {}, "pipeline_layout");
+    post_process_pipeline_layout = vk_create_pipeline_layout({ post_process_descriptor_set_layout }, { pushConstant }, "post_process_pipeline_layout");
+
+    // Pipelines are compiled on g_job_system while the meshes and textures below are loaded.
+    pipeline_compiler.initialize();
+    secondary_recorder.initialize();
+    depth_image_format = get_depth_image_format();
+    motion_vec_image_format = get_motion_vector_image_format();
+
+    pipeline = submit_mesh_pipeline(false);
+    depth_equal_pipeline = submit_mesh_pipeline(true);
+    depth_prepass_pipeline = submit_depth_prepass_pipeline();
+    for (int option = 0; option < antialiasing_option_count; option++) {
+        post_process_pipelines[option] = submit_post_process_pipeline(option);
+        post_process_compute_pipelines[option] = submit_post_process_compute_pipeline(option);
     }
+    compute_post_process_supported = is_compute_post_process_supported();
 
-    auto& tankMesh = *tankModel.GetRenderable()->GetGPUMesh();
-    {
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/mesh.obj"), 1.25f);
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/Baloo.obj"), 1.f);
-        Triangle_Mesh mesh = load_obj_model(get_resource_path("model/Tank.obj"), 1.f);
-        {
-            const VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            tankMesh.vertex_buffer = vk_create_buffer(size, usage, mesh.vertices.data(), "tank_vertex_buffer");
-            tankMesh.vertex_count = uint32_t(mesh.vertices.size());
-        }
-        {
-            const VkDeviceSize size = mesh.indices.size() * sizeof(mesh.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            tankMesh.index_buffer = vk_create_buffer(size, usage, mesh.indices.data(), "tank_index_buffer");
-            tankMesh.index_count = uint32_t(mesh.indices.size());
-        }
+    if (g_shader_hot_reload) {
+        shader_reloader.initialize(SHADER_SOURCE_DIR, get_resource_path("spirv"));
     }
 
-    auto& balooMesh = *balooModel.GetRenderable()->GetGPUMesh();
+    // Models and textures go through the asset manager: obj parsing and image decoding run on
+    // g_job_system, the uploads happen in update(). The first frame waits for all of them.
+    asset_manager.initialize(vk_get_asset_backend());
     {
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/mesh.obj"), 1.25f);
-        // Triangle_Mesh mesh = load_obj_model(get_resource_path("model/Baloo.obj"), 1.f);
-        Triangle_Mesh mesh = load_obj_model(get_resource_path("model/Baloo.obj"), 1.f);
-        {
-            const VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-            balooMesh.vertex_buffer = vk_create_buffer(size, usage, mesh.vertices.data(), "baloo_vertex_buffer");
-            balooMesh.vertex_count = uint32_t(mesh.vertices.size());
+        struct Model_Assets {
+            GameObject& model;
+            const char* mesh_file;
+            const char* texture_file;
+        };
+        const std::array<Model_Assets, 3> models{ {
+            { castleModel, "model/mine_craft_castle.obj", "model/mine_craft_castle.jpg" },
+            { tankModel, "model/Tank.obj", "model/Tank_Base_color.png" },
+            { balooModel, "model/Baloo.obj", "model/baloo_diff.png" },
+        } };
+        std::vector<Asset_Handle> handles;
+        for (const Model_Assets& assets : models) {
+            handles.push_back(asset_manager.request_mesh(get_resource_path(assets.mesh_file), Asset_Priority::high));
+            handles.push_back(asset_manager.request_texture(get_resource_path(assets.texture_file), Asset_Priority::high));
+            assets.model.GetRenderable()->SetMesh(handles[handles.size() - 2]);
+            assets.model.GetRenderable()->SetTexture(handles.back());
         }
-        {
-            const VkDeviceSize size = mesh.indices.size() * sizeof(mesh.indices[0]);
-            VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            balooMesh.index_buffer = vk_create_buffer(size, usage, mesh.indices.data(), "baloo_index_buffer");
-            balooMesh.index_count = uint32_t(mesh.indices.size());
+        // Shares the castle texture.
+        texture = asset_manager.request_texture(get_resource_path("model/mine_craft_castle.jpg"), Asset_Priority::high);
+        handles.push_back(texture);
+
+        asset_manager.finish_requests();
+        for (const Asset_Handle& handle : handles) {
+            if (!handle.is_resident())
+                error("failed to load " + handle.request->path);
         }
     }
+    castleModel.GetTransform()->Transform.position.x = -.5f;
+    tankModel.GetTransform()->Transform.position.x = .5f;
+    balooModel.GetTransform()->Transform.position.z = -2.f;
 
-    // Texture.
+    // Sampler.
     {
-        // texture = vk_load_texture(get_resource_path("model/diffuse.jpg"));
-        // texture = vk_load_texture(get_resource_path("model/baloo_diff.png"));
-        texture = vk_load_texture(get_resource_path("model/mine_craft_castle.jpg"));
-
-        auto& modelTexture = castleModel.GetRenderable()->GetTexture();
-        auto tempImage = vk_load_texture(get_resource_path("model/mine_craft_castle.jpg"));
-        modelTexture = std::make_unique<Vk_Image>(std::move(tempImage));
-        castleModel.GetTransform()->Transform.position.x = -.5f;
-
-
-        auto& tankModelTexture = tankModel.GetRenderable()->GetTexture();
-        auto tankTempImage = vk_load_texture(get_resource_path("model/Tank_Base_color.png"));
-        tankModelTexture = std::make_unique<Vk_Image>(std::move(tankTempImage));
-        tankModel.GetTransform()->Transform.position.x = .5f;
-
-        auto& balooModelTexture = balooModel.GetRenderable()->GetTexture();
-        auto balooTempImage = vk_load_texture(get_resource_path("model/baloo_diff.png"));
-        balooModelTexture = std::make_unique<Vk_Image>(std::move(balooTempImage));
-        balooModel.GetTransform()->Transform.position.z = -2.f;
-
         VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
         create_info.magFilter = VK_FILTER_LINEAR;
         create_info.minFilter = VK_FILTER_LINEAR;
@@ -224,106 +283,6 @@ void Vk_Demo::initialize(GLFWwindow* window) {
     uniform_buffer = vk_create_mapped_buffer(static_cast<VkDeviceSize>(sizeof(TAATransform)),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &mapped_uniform_buffer, "uniform_buffer");
 
-    descriptor_set_layout = Vk_Descriptor_Set_Layout()
-        .uniform_buffer(0, VK_SHADER_STAGE_VERTEX_BIT)
-        .sampled_image(1, VK_SHADER_STAGE_FRAGMENT_BIT)
-        .sampler(2, VK_SHADER_STAGE_FRAGMENT_BIT)
-        .create("set_layout");
-
-    main_texture_descriptor_set_layout = Vk_Descriptor_Set_Layout()
-        .sampled_image(0, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.uniform_buffer(1, VK_SHADER_STAGE_VERTEX_BIT)
-        .create("main_texture_set_layout", true);
-
-    post_process_descriptor_set_layout = Vk_Descriptor_Set_Layout()
-        .default_post_process()
-		.sampled_image(3, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.sampled_image(5, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.sampler(4, VK_SHADER_STAGE_FRAGMENT_BIT)
-        .create("post_process_set_layout");
-
-    auto pushConstant = VkPushConstantRange{ };
-    pushConstant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    pushConstant.offset = 0;
-    pushConstant.size = sizeof(Post_Process_Push_Constatnts);
-
-    pipeline_layout = vk_create_pipeline_layout({ descriptor_set_layout, main_texture_descriptor_set_layout }, {}, "pipeline_layout");
-    post_process_pipeline_layout = vk_create_pipeline_layout({ post_process_descriptor_set_layout }, { pushConstant }, "post_process_pipeline_layout");
-    // Pipeline.
-    Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
-    {
-        Vk_Shader_Module vertex_shader(get_resource_path("spirv/mesh.vert.spv"));
-        Vk_Shader_Module fragment_shader(get_resource_path("spirv/mesh.frag.spv"));
-
-        // VkVertexInputBindingDescription
-        state.vertex_bindings[0].binding = 0;
-        state.vertex_bindings[0].stride = sizeof(Vertex);
-        state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        state.vertex_binding_count = 1;
-
-        // VkVertexInputAttributeDescription
-        state.vertex_attributes[0].location = 0; // position
-        state.vertex_attributes[0].binding = 0;
-        state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        state.vertex_attributes[0].offset = 0;
-
-        state.vertex_attributes[1].location = 1; // uv
-        state.vertex_attributes[1].binding = 0;
-        state.vertex_attributes[1].format = VK_FORMAT_R32G32_SFLOAT;
-        state.vertex_attributes[1].offset = 12;
-
-        state.vertex_attribute_count = 2;
-
-        state.color_attachment_formats[0] = vk.surface_format.format;
-        state.color_attachment_formats[1] = vk.surface_format.format;
-        state.color_attachment_count = 2;
-        state.depth_attachment_format = get_depth_image_format();
-
-        state.attachment_blend_state_count = 2;
-
-        auto& attachment_blend_state = state.attachment_blend_state[1];
-        attachment_blend_state = VkPipelineColorBlendAttachmentState{};
-        attachment_blend_state.blendEnable = VK_FALSE;
-        attachment_blend_state.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-            VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-
-        pipeline = vk_create_graphics_pipeline(state, vertex_shader.handle, fragment_shader.handle, pipeline_layout, "draw_mesh_pipeline");
-    }
-
-    Vk_Graphics_Pipeline_State post_process_state = get_default_graphics_pipeline_state();
-    {
-        Vk_Shader_Module post_process_vertex_shader(get_resource_path("spirv/postprocess.vert.spv"));
-        Vk_Shader_Module post_process_fragment_shader(get_resource_path("spirv/postprocess.frag.spv"));
-
-        // VkVertexInputBindingDescription
-        post_process_state.vertex_bindings[0].binding = 0;
-        post_process_state.vertex_bindings[0].stride = sizeof(Vertex);
-        post_process_state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        post_process_state.vertex_binding_count = 1;
-
-        // VkVertexInputAttributeDescription
-        post_process_state.vertex_attributes[0].location = 0; // position
-        post_process_state.vertex_attributes[0].binding = 0;
-        post_process_state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        post_process_state.vertex_attributes[0].offset = 0;
-
-        post_process_state.vertex_attributes[1].location = 1; // uv
-        post_process_state.vertex_attributes[1].binding = 0;
-        post_process_state.vertex_attributes[1].format = VK_FORMAT_R32G32_SFLOAT;
-        post_process_state.vertex_attributes[1].offset = 12;
-
-        post_process_state.vertex_attribute_count = 2;
-
-        post_process_state.color_attachment_formats[0] = vk.surface_format.format;
-        post_process_state.color_attachment_count = 1;
-        post_process_state.depth_attachment_format = get_depth_image_format();
-
-        post_process_pipeline = vk_create_graphics_pipeline(
-            post_process_state,
-            post_process_vertex_shader.handle, post_process_fragment_shader.handle,
-            post_process_pipeline_layout,
-            "post_process_draw_mesh_pipeline");
-    }
 
     // Descriptor buffer.
     {
@@ -361,7 +320,7 @@ void Vk_Demo::initialize(GLFWwindow* window) {
         // Write descriptor 1 (sampled image)
         {
             VkDescriptorImageInfo image_info;
-            image_info.imageView = texture.view;
+            image_info.imageView = texture.texture()->view;
             image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
             VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
@@ -396,9 +355,11 @@ void Vk_Demo::initialize(GLFWwindow* window) {
 
         VkDeviceSize layout_size_in_bytes = 0;
         vkGetDescriptorSetLayoutSizeEXT(vk.device, post_process_descriptor_set_layout, &layout_size_in_bytes);
+        const VkDeviceSize alignment = descriptor_buffer_properties.descriptorBufferOffsetAlignment;
+        post_process_descriptor_set_stride = (layout_size_in_bytes + alignment - 1) / alignment * alignment;
 
         post_process_descriptor_buffer = vk_create_mapped_buffer(
-            layout_size_in_bytes,
+            2 * post_process_descriptor_set_stride,
             VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT,
             &post_process_mapped_descriptor_buffer_ptr, "post_process_descriptor_buffer"
         );
@@ -431,8 +392,10 @@ void Vk_Demo::initialize(GLFWwindow* window) {
 
             VkDeviceSize offset;
             vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 2, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
-                static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + offset);
+            for (int i = 0; i < 2; i++) {
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
+                    static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + i * post_process_descriptor_set_stride + offset);
+            }
         }
 
         {
@@ -442,17 +405,20 @@ void Vk_Demo::initialize(GLFWwindow* window) {
 
             VkDeviceSize offset;
             vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 4, &offset);
-            vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
-                static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + offset);
+            for (int i = 0; i < 2; i++) {
+                vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.samplerDescriptorSize,
+                    static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + i * post_process_descriptor_set_stride + offset);
+            }
         }
     }
 
-    // ImGui setup.
-    {
+    // ImGui setup. There is no window and no GUI in headless mode.
+    if (!headless.enabled) {
         ImGui::CreateContext();
         ImGui_ImplGlfw_InitForVulkan(window, true);
 
-        state.color_attachment_count = 1;
+        // GUI is drawn into the swapchain image only.
+        const VkFormat color_attachment_format = vk.surface_format.format;
 
         ImGui_ImplVulkan_InitInfo init_info{};
         init_info.Instance = vk.instance;
@@ -461,13 +427,14 @@ void Vk_Demo::initialize(GLFWwindow* window) {
         init_info.QueueFamily = vk.queue_family_index;
         init_info.Queue = vk.queue;
         init_info.DescriptorPool = vk.imgui_descriptor_pool;
+        init_info.PipelineCache = vk.pipeline_cache;
 		init_info.MinImageCount = 2;
 		init_info.ImageCount = (uint32_t)vk.swapchain_info.images.size();
         init_info.UseDynamicRendering = true;
         init_info.PipelineRenderingCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
-        init_info.PipelineRenderingCreateInfo.colorAttachmentCount = state.color_attachment_count;
-        init_info.PipelineRenderingCreateInfo.pColorAttachmentFormats = state.color_attachment_formats;
-        init_info.PipelineRenderingCreateInfo.depthAttachmentFormat = state.depth_attachment_format;
+        init_info.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
+        init_info.PipelineRenderingCreateInfo.pColorAttachmentFormats = &color_attachment_format;
+        init_info.PipelineRenderingCreateInfo.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
 
         ImGui_ImplVulkan_Init(& init_info);
         ImGui::StyleColorsDark();
@@ -475,35 +442,53 @@ void Vk_Demo::initialize(GLFWwindow* window) {
     }
 
     restore_resolution_dependent_resources();
-    gpu_times.frame = time_keeper.allocate_time_interval();
+    gpu_times.frame = time_keeper.allocate_time_interval("frame");
+    gpu_times.post_process = time_keeper.allocate_time_interval("post_process");
+    gpu_times.depth_prepass = time_keeper.allocate_time_interval("depth_prepass");
+    gpu_times.scene = time_keeper.allocate_time_interval("scene");
+    gpu_times.copy_to_post_process = time_keeper.allocate_time_interval("copy_to_post_process");
+    gpu_times.antialiasing = time_keeper.allocate_time_interval("antialiasing");
+    gpu_times.blit_post_process_output = time_keeper.allocate_time_interval("blit_post_process_output");
+    gpu_times.history_copy = time_keeper.allocate_time_interval("history_copy");
+    gpu_times.screenshot = time_keeper.allocate_time_interval("screenshot");
+    gpu_times.gui = time_keeper.allocate_time_interval("gui");
     time_keeper.initialize_time_intervals();
 
     screenshot_file_name = "Tank.png";
     screenshot_file_name.reserve(1024);
+    if (headless.save_image_interval != 0) {
+        Capture_Options options;
+        options.interval = headless.save_image_interval;
+        options.policy = Capture_Policy::wait;
+        options.output_directory = headless.output_directory;
+        start_capture(options);
+    }
 }
 
 void Vk_Demo::shutdown() {
     VK_CHECK(vkDeviceWaitIdle(vk.device));
 
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
-    motion_vec_image.destroy();
-    prev_frame_image.destroy();
-    post_process_image.destroy();
-    screenshot_image.destroy();
+    if (!headless.enabled) {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+    }
     release_resolution_dependent_resources();
-    quad_mesh.destroy();
+    stop_capture();
+    screenshot_writer.shutdown();
+    for (Screenshot_Readback& readback : screenshot_readbacks) {
+        readback.buffer.destroy();
+        readback.mapped = nullptr;
+    }
     // castleModel.GetRenderable()->GetTexture()->destroy();
     tankModel.Destroy();
     castleModel.Destroy();
     balooModel.Destroy();
     // secondaryTexture.destroy();
-    texture.destroy();
+    texture = Asset_Handle{};
     post_process_descriptor_buffer.destroy();
     descriptor_buffer.destroy();
     uniform_buffer.destroy();
-    staging_buffer.destroy();
 
     vkDestroySampler(vk.device, nearest_sampler, nullptr);
     vkDestroySampler(vk.device, linear_sampler, nullptr);
@@ -512,46 +497,181 @@ void Vk_Demo::shutdown() {
 	vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
     vkDestroyPipelineLayout(vk.device, post_process_pipeline_layout, nullptr);
     vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
-    vkDestroyPipeline(vk.device, post_process_pipeline, nullptr);
-    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    shader_reloader.shutdown();
+    pipeline_compiler.shutdown();
+    secondary_recorder.shutdown();
+    asset_manager.shutdown();
+    g_job_system.shutdown();
+    for (const Pending_Pipeline& pending : pending_pipelines) {
+        try {
+            vkDestroyPipeline(vk.device, pending.pipeline.get(), nullptr);
+        }
+        catch (const std::exception&) {
+        }
+    }
+    for (const Retired_Pipeline& retired : retired_pipelines) {
+        vkDestroyPipeline(vk.device, retired.pipeline, nullptr);
+    }
+    for (const Vk_Pipeline_Handle& compute_pipeline : post_process_compute_pipelines) {
+        vkDestroyPipeline(vk.device, compute_pipeline.get(), nullptr);
+    }
+    for (const Vk_Pipeline_Handle& post_process_pipeline : post_process_pipelines) {
+        vkDestroyPipeline(vk.device, post_process_pipeline.get(), nullptr);
+    }
+    vkDestroyPipeline(vk.device, pipeline.get(), nullptr);
+    vkDestroyPipeline(vk.device, depth_equal_pipeline.get(), nullptr);
+    vkDestroyPipeline(vk.device, depth_prepass_pipeline.get(), nullptr);
+    g_render_target_pool.shutdown();
 
     vk_shutdown();
 }
 
-void Vk_Demo::release_resolution_dependent_resources() {
-    motion_vec_image.destroy();
-    prev_frame_image.destroy();
-    post_process_image.destroy();
-    depth_buffer_image.destroy();
+// Pipeline creation jobs load SPIR-V themselves, so the same functions are used to rebuild
+// pipelines when shaders are hot-reloaded.
+Vk_Pipeline_Handle Vk_Demo::submit_mesh_pipeline(bool after_depth_prepass) {
+    Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
+    if (after_depth_prepass) {
+        state.depth_stencil_state.depthWriteEnable = VK_FALSE;
+        state.depth_stencil_state.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+
+    // VkVertexInputBindingDescription
+    state.vertex_bindings[0].binding = 0;
+    state.vertex_bindings[0].stride = sizeof(Vertex);
+    state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    state.vertex_binding_count = 1;
+
+    // VkVertexInputAttributeDescription
+    state.vertex_attributes[0].location = 0; // position
+    state.vertex_attributes[0].binding = 0;
+    state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    state.vertex_attributes[0].offset = 0;
+
+    state.vertex_attributes[1].location = 1; // uv
+    state.vertex_attributes[1].binding = 0;
+    state.vertex_attributes[1].format = VK_FORMAT_R32G32_SFLOAT;
+    state.vertex_attributes[1].offset = 12;
+
+    state.vertex_attribute_count = 2;
+
+    state.color_attachment_formats[0] = vk.surface_format.format;
+    state.color_attachment_formats[1] = motion_vec_image_format;
+    state.color_attachment_count = 2;
+    state.depth_attachment_format = depth_image_format;
+
+    state.attachment_blend_state_count = 2;
 
-    screenshot_image.destroy();
-    staging_buffer.destroy();
+    auto& attachment_blend_state = state.attachment_blend_state[1];
+    attachment_blend_state = VkPipelineColorBlendAttachmentState{};
+    attachment_blend_state.blendEnable = VK_FALSE;
+    attachment_blend_state.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    return pipeline_compiler.submit([state, layout = pipeline_layout, after_depth_prepass]() {
+        Vk_Shader_Module vertex_shader(get_resource_path("spirv/mesh.vert.spv"));
+        Vk_Shader_Module fragment_shader(get_resource_path("spirv/mesh.frag.spv"));
+        return vk_create_graphics_pipeline(state, vertex_shader.handle, fragment_shader.handle, layout,
+            after_depth_prepass ? "draw_mesh_depth_equal_pipeline" : "draw_mesh_pipeline");
+    });
 }
 
-void Vk_Demo::restore_resolution_dependent_resources() {
-    // create depth buffer
-    VkFormat depth_format = get_depth_image_format();
-    // if (depth_buffer_image.handle == nullptr)
-    {
-        post_process_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_B8G8R8A8_SRGB,
-            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, "post_process");
+// Depth only, the vertex stream is GPU_MESH::position_buffer.
+Vk_Pipeline_Handle Vk_Demo::submit_depth_prepass_pipeline() {
+    Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
+
+    state.vertex_bindings[0].binding = 0;
+    state.vertex_bindings[0].stride = sizeof(Vector3);
+    state.vertex_bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    state.vertex_binding_count = 1;
+
+    state.vertex_attributes[0].location = 0; // position
+    state.vertex_attributes[0].binding = 0;
+    state.vertex_attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    state.vertex_attributes[0].offset = 0;
+    state.vertex_attribute_count = 1;
 
-        prev_frame_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_B8G8R8A8_SRGB,
-            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, "prev_frame");
+    state.color_attachment_count = 0;
+    state.attachment_blend_state_count = 0;
+    state.depth_attachment_format = depth_image_format;
 
-        motion_vec_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_B8G8R8A8_SRGB,
-            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, "motion_vec");
+    return pipeline_compiler.submit([state, layout = pipeline_layout]() {
+        Vk_Shader_Module vertex_shader(get_resource_path("spirv/depth_prepass.vert.spv"));
+        return vk_create_graphics_pipeline(state, vertex_shader.handle, VK_NULL_HANDLE, layout, "depth_prepass_pipeline");
+    });
+}
 
-        screenshot_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_B8G8R8A8_SRGB,
-            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, "screenshot");
+Vk_Pipeline_Handle Vk_Demo::submit_post_process_pipeline(int option) {
+    Vk_Graphics_Pipeline_State post_process_state = get_default_graphics_pipeline_state();
 
-        VkDeviceSize buffer_size = vk.surface_size.width * vk.surface_size.height * 4;
-        staging_buffer =
-            vk_create_mapped_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &screenshot_host,
-                "Screenshot host");
+    // Full-screen triangle is generated in the vertex shader, no vertex input.
+    post_process_state.vertex_binding_count = 0;
+    post_process_state.vertex_attribute_count = 0;
+    post_process_state.rasterization_state.cullMode = VK_CULL_MODE_NONE;
+
+    post_process_state.color_attachment_formats[0] = vk.surface_format.format;
+    post_process_state.color_attachment_count = 1;
+    post_process_state.depth_stencil_state.depthTestEnable = VK_FALSE;
+    post_process_state.depth_stencil_state.depthWriteEnable = VK_FALSE;
+
+    return pipeline_compiler.submit([post_process_state, layout = post_process_pipeline_layout, option]() {
+        Vk_Shader_Module post_process_vertex_shader(get_resource_path("spirv/postprocess.vert.spv"));
+        Vk_Shader_Module post_process_fragment_shader(get_resource_path("spirv/postprocess.frag.spv"));
+        Post_Process_Specialization specialization(option);
+        std::string name = std::string("post_process_draw_mesh_pipeline (") + antialiasing_option_names[option] + ")";
+        return vk_create_graphics_pipeline(
+            post_process_state,
+            post_process_vertex_shader.handle, post_process_fragment_shader.handle,
+            layout,
+            name.c_str(), &specialization.info);
+    });
+}
+
+// Compute version of the post-processing pass.
+Vk_Pipeline_Handle Vk_Demo::submit_post_process_compute_pipeline(int option) {
+    return pipeline_compiler.submit([layout = post_process_pipeline_layout, option]() {
+        Vk_Shader_Module post_process_compute_shader(get_resource_path("spirv/postprocess.comp.spv"));
+        Post_Process_Specialization specialization(option);
+        std::string name = std::string("post_process_compute_pipeline (") + antialiasing_option_names[option] + ")";
+        return vk_create_compute_pipeline(post_process_compute_shader.handle,
+            layout, name.c_str(), &specialization.info);
+    });
+}
+
+// Called between frames. The images may still be used by the frames in flight and are retired,
+// only the frames that copy into readback buffers are waited for.
+void Vk_Demo::release_resolution_dependent_resources() {
+    for (uint32_t i = 0; i < screenshot_readback_count; i++) {
+        if (screenshot_readbacks[i].copy_submitted) {
+            VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[screenshot_readbacks[i].frame_slot], VK_FALSE, UINT64_MAX));
+            submit_screenshot_readback(i);
+        }
+    }
+    flush_screenshots();
+    render_graph.release();
+    g_render_target_pool.destroy_image(prev_frame_image);
+    // Stream frames must have the same size.
+    if (capture.format == Image_File_Format::y4m) {
+        stop_capture();
     }
+}
+
+// Transient images are created by the render graph, only the images that live between frames are created here.
+void Vk_Demo::restore_resolution_dependent_resources() {
+    prev_frame_image = g_render_target_pool.create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_B8G8R8A8_SRGB,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, "prev_frame");
+    // The initial layout transition is recorded by the next frame's render graph.
+    prev_frame_image_undefined = true;
+
+    last_frame_time = Clock::now();
+}
+
+// Called when the render graph has (re)created its transient images. Writes the set of the frame
+// that is being recorded, the set of the other frame may still be in use.
+void Vk_Demo::write_post_process_descriptors(int frame_slot) {
+    uint8_t* set = static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + frame_slot * post_process_descriptor_set_stride;
+
     VkDescriptorImageInfo image_info;
-    image_info.imageView = post_process_image.view;
+    image_info.imageView = render_graph.get_view(graph_images.post_process);
     image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     VkDescriptorGetInfoEXT descriptor_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
@@ -565,51 +685,24 @@ void Vk_Demo::restore_resolution_dependent_resources() {
 
     VkDeviceSize offset;
     vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 1, &offset);
-    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
-        static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + offset);
+    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize, set + offset);
 
     image_info.imageView = prev_frame_image.view;
     vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 3, &offset);
-    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
-        static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + offset);
+    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize, set + offset);
 
-    image_info.imageView = motion_vec_image.view;
+    image_info.imageView = render_graph.get_view(graph_images.motion_vec);
     vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 5, &offset);
-    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize,
-        static_cast<uint8_t*>(post_process_mapped_descriptor_buffer_ptr) + offset);
-
-    depth_buffer_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, depth_format,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, "depth_buffer");
-
-    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
-        const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
-        vk_cmd_image_barrier_for_subresource(command_buffer, depth_buffer_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-    });
-
-    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
-        const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        vk_cmd_image_barrier_for_subresource(command_buffer, prev_frame_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        });
-
-    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
-        const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        vk_cmd_image_barrier_for_subresource(command_buffer, motion_vec_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        });
-
-    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
-        const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        vk_cmd_image_barrier_for_subresource(command_buffer, screenshot_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        });
-
-    last_frame_time = Clock::now();
+    vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.sampledImageDescriptorSize, set + offset);
+
+    if (compute_post_process) {
+        image_info.imageView = render_graph.get_view(graph_images.post_process_output);
+        image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        descriptor_info.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptor_info.data.pStorageImage = &image_info;
+        vkGetDescriptorSetLayoutBindingOffsetEXT(vk.device, post_process_descriptor_set_layout, 6, &offset);
+        vkGetDescriptorEXT(vk.device, &descriptor_info, descriptor_buffer_properties.storageImageDescriptorSize, set + offset);
+    }
 }
 
 void Vk_Demo::update_scale_by_delta(const float& delta)
@@ -618,12 +711,19 @@ void Vk_Demo::update_scale_by_delta(const float& delta)
 }
 
 void Vk_Demo::run_frame() {
+    PROFILE_ZONE("run_frame");
+    Timestamp frame_start;
     Time current_time = Clock::now();
     time_delta = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_frame_time).count() / 1e6;
     if (animate) {
         sim_time += time_delta;
     }
     last_frame_time = current_time;
+    // Uploads submit to vk.queue, so they happen here and not on the loading threads.
+    asset_manager.update();
+    if (benchmark_active) {
+        apply_benchmark_frame();
+    }
 
 	float aspect_ratio = (float)vk.surface_size.width / (float)vk.surface_size.height;
 	Matrix4x4 projection_transform = perspective_transform_opengl_z01(radians(45.0f), aspect_ratio, 0.1f, 50.0f);
@@ -654,302 +754,745 @@ void Vk_Demo::run_frame() {
 
     memcpy(mapped_uniform_buffer, &main_frame_uniform, sizeof(TAATransform));
 
-    do_imgui();
+    if (!headless.enabled) {
+        do_imgui();
+    }
     draw_frame();
-    if (need_screenshot)
-    {
-        vkQueueWaitIdle(vk.queue);
-
-        uint8_t* mapped = reinterpret_cast<uint8_t*>(screenshot_host);
-        std::vector<uint8_t> rgba;
-        rgba.resize(vk.surface_size.width * vk.surface_size.height * 4);
-
-        for (uint32_t i = 0; i < vk.surface_size.width * vk.surface_size.height; ++i) {
-            uint8_t b = mapped[i * 4 + 0];
-            uint8_t g = mapped[i * 4 + 1];
-            uint8_t r = mapped[i * 4 + 2];
-            uint8_t a = mapped[i * 4 + 3];
-            rgba[i * 4 + 0] = r;
-            rgba[i * 4 + 1] = g;
-            rgba[i * 4 + 2] = b;
-            rgba[i * 4 + 3] = a;
-        }
 
-        stbi_write_png(screenshot_file_name.c_str(),
-            vk.surface_size.width,
-            vk.surface_size.height, 4, rgba.data(), static_cast<int>(vk.surface_size.width * 4));
+    main_frame_uniform.prev = main_frame_uniform.cur;
 
-        need_screenshot = false;
+    if (benchmark_active) {
+        record_benchmark_frame(elapsed_nanoseconds(frame_start) / 1e6);
     }
-
-    main_frame_uniform.prev = main_frame_uniform.cur;
 }
 
-void Vk_Demo::draw_frame() {
-    vk_begin_frame();
-    vk_begin_gpu_marker_scope(vk.command_buffer, "draw_frame");
-    time_keeper.next_frame();
-    gpu_times.frame->begin();
-
-    VkDescriptorBufferBindingInfoEXT descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
-    descriptor_buffer_binding_info.address = descriptor_buffer.device_address;
-    descriptor_buffer_binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
-    vkCmdBindDescriptorBuffersEXT(vk.command_buffer, 1, &descriptor_buffer_binding_info);
-
-    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT /* execution dependency with acquire semaphore wait */, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-    VkViewport viewport{};
-    viewport.width = float(vk.surface_size.width);
-    viewport.height = float(vk.surface_size.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(vk.command_buffer, 0, 1, &viewport);
-
-    VkRect2D scissor{};
-    scissor.extent = vk.surface_size;
-    vkCmdSetScissor(vk.command_buffer, 0, 1, &scissor);
-
-    VkRenderingAttachmentInfo color_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-    color_attachment.imageView = vk.swapchain_info.image_views[vk.swapchain_image_index];
-    color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    color_attachment.clearValue.color = { 0.32f, 0.32f, 0.4f, 0.0f };
-
-    VkRenderingAttachmentInfo motion_vec_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-    motion_vec_attachment.imageView = motion_vec_image.view;
-    motion_vec_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    motion_vec_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    motion_vec_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    motion_vec_attachment.clearValue.color = { 0.f, 0.f, 0.f, 0.0f };
-
-    VkRenderingAttachmentInfo depth_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-    depth_attachment.imageView = depth_buffer_image.view;
-    depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depth_attachment.clearValue.depthStencil = { 1.f, 0 };
-
-    std::array colorAttachments{ color_attachment, motion_vec_attachment };
-
-    VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
-    rendering_info.renderArea.extent = vk.surface_size;
-    rendering_info.layerCount = 1;
-    rendering_info.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
-    rendering_info.pColorAttachments = colorAttachments.data();
-    rendering_info.pDepthAttachment = &depth_attachment;
-
-
-    vk_begin_gpu_marker_scope(vk.command_buffer, "Draw main frame");
-
-    // auto& gpu_mesh = *castleModel.GetRenderable()->GetGPUMesh();
+void Vk_Demo::start_benchmark(const std::string& script_file, const std::string& output_directory) {
+    benchmark_script = load_benchmark_script(script_file);
+    benchmark_output_directory = output_directory;
+
+    // Everything that depends on wall clock time or on the previous frames' timings is fixed.
+    if (benchmark_script.antialiasing_option >= 0)
+        aliasingOption = benchmark_script.antialiasing_option;
+    if (benchmark_script.compute_post_process >= 0)
+        compute_post_process = benchmark_script.compute_post_process != 0 && compute_post_process_supported;
+    dynamic_resolution = false;
+    resolution_scale = benchmark_script.resolution_scale;
+    update_render_extent();
+    animate = false;
+    vsync = false;
+    show_ui = false;
+
+    benchmark_recorder.gpu_interval_names.clear();
+    for (uint32_t i = 0; i < time_keeper.time_interval_count; i++)
+        benchmark_recorder.gpu_interval_names.push_back(time_keeper.time_intervals[i].name);
+    benchmark_recorder.frames.clear();
+    benchmark_recorder.frames.reserve(benchmark_script.measured_frames);
+    benchmark_frame = 0;
+    benchmark_active = true;
+    benchmark_done = false;
+    printf("Benchmark: %s, %u warm-up frames, %u measured frames\n", script_file.c_str(),
+        benchmark_script.warmup_frames, benchmark_script.measured_frames);
+}
 
-	color_attachment_transition_for_copy_src();
+void Vk_Demo::apply_benchmark_frame() {
+    const double time = benchmark_frame * benchmark_script.time_step;
+    const Benchmark_Key key = benchmark_script.sample(time);
+    time_delta = benchmark_script.time_step;
+    sim_time = time;
+    camera_pos = key.camera_pos;
+    castleModel.GetTransform()->Transform.yaw = key.object_yaw;
+    tankModel.GetTransform()->Transform.yaw = -key.object_yaw;
+    balooModel.GetTransform()->Transform.yaw = sin(static_cast<float>(time)) * 20.f;
+}
 
-    post_process_transition_for_copy_dst(post_process_image.handle);
+void Vk_Demo::record_benchmark_frame(double cpu_ms) {
+    const uint32_t warmup_frames = benchmark_script.warmup_frames;
+    const uint32_t measured_frames = benchmark_script.measured_frames;
+    const uint32_t frame = benchmark_frame++;
+
+    if (frame >= warmup_frames && frame < warmup_frames + measured_frames)
+        benchmark_recorder.frames.push_back(Benchmark_Frame{ frame * benchmark_script.time_step, cpu_ms, {} });
+
+    // Timestamps read back in this frame were written by the frame that used the same query pool.
+    if (frame >= 2) {
+        const uint32_t gpu_frame = frame - 2;
+        if (gpu_frame >= warmup_frames && gpu_frame < warmup_frames + measured_frames) {
+            // Passes that were not executed in that frame are recorded as 0.
+            std::vector<float>& gpu_ms = benchmark_recorder.frames[gpu_frame - warmup_frames].gpu_ms;
+            for (uint32_t i = 0; i < time_keeper.time_interval_count; i++)
+                gpu_ms.push_back(time_keeper.time_intervals[i].raw_length_ms);
+        }
+    }
 
-    vk_cmd_image_barrier(vk.command_buffer, motion_vec_image.handle,
-        VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    if (benchmark_frame == warmup_frames + measured_frames + 2) {
+        const Vk_Memory_Stats memory_stats = vk_get_memory_stats();
+        benchmark_recorder.memory_bytes.clear();
+        for (size_t i = 0; i < memory_stats.heaps.size(); i++) {
+            const std::string heap = "heap" + std::to_string(i);
+            benchmark_recorder.memory_bytes.emplace_back(heap + "_usage", memory_stats.heaps[i].usage);
+            benchmark_recorder.memory_bytes.emplace_back(heap + "_budget", memory_stats.heaps[i].budget);
+        }
+        for (uint32_t i = 0; i < vk_memory_category_count; i++) {
+            benchmark_recorder.memory_bytes.emplace_back(vk_memory_category_name(Vk_Memory_Category(i)),
+                memory_stats.category_bytes[i]);
+        }
 
-    vkCmdBeginRendering(vk.command_buffer, &rendering_info);
-    const VkDeviceSize zero_offset = 0;
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(vk.physical_device, &properties);
+        benchmark_recorder.write(benchmark_output_directory, benchmark_script, properties.deviceName,
+            vk.surface_size.width, vk.surface_size.height);
+        vk_write_memory_stats_json((std::filesystem::path(benchmark_output_directory) / "memory_stats.json").string());
+        benchmark_active = false;
+        benchmark_done = true;
+    }
+}
 
-    const uint32_t buffer_index = 0;
-    const VkDeviceSize set_offset = 0;
-    vkCmdSetDescriptorBufferOffsetsEXT(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &buffer_index, &set_offset);
-    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+void Vk_Demo::run_headless() {
+    if (benchmark_active) {
+        while (!benchmark_finished())
+            run_frame();
+        VK_CHECK(vkDeviceWaitIdle(vk.device));
+        return;
+    }
 
-    //vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &gpu_mesh.vertex_buffer.handle, &zero_offset);
-    //vkCmdBindIndexBuffer(vk.command_buffer, gpu_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
-    //vkCmdDrawIndexed(vk.command_buffer, gpu_mesh.index_count, 1, 0, 0, 0);
+    std::filesystem::create_directories(headless.output_directory);
+    const std::filesystem::path output_directory(headless.output_directory);
+
+    std::vector<double> cpu_times_ms(headless.frame_count);
+    std::vector<double> gpu_times_ms(headless.frame_count);
+    std::vector<bool> gpu_time_measured(headless.frame_count);
+    for (uint32_t i = 0; i < headless.frame_count; i++) {
+        Timestamp t;
+        run_frame();
+        cpu_times_ms[i] = elapsed_nanoseconds(t) / 1e6;
+        // Timestamps read back in this frame were written by the frame that used the same query pool.
+        if (i >= 2 && gpu_times.frame->measured) {
+            gpu_times_ms[i - 2] = gpu_times.frame->raw_length_ms;
+            gpu_time_measured[i - 2] = true;
+        }
+    }
+    VK_CHECK(vkDeviceWaitIdle(vk.device));
+    flush_screenshots();
+
+    const std::string timings_file = (output_directory / "headless_timings.csv").string();
+    if (FILE* file = fopen(timings_file.c_str(), "w")) {
+        fprintf(file, "frame,cpu_ms,gpu_ms\n");
+        // The last two frames and the frames without a GPU measurement are not written.
+        for (uint32_t i = 0; i < headless.frame_count; i++) {
+            if (gpu_time_measured[i])
+                fprintf(file, "%u,%.4f,%.4f\n", i, cpu_times_ms[i], gpu_times_ms[i]);
+        }
+        fclose(file);
+    }
+    else {
+        error("Failed to write " + timings_file);
+    }
 
-    //auto imageInfo = VkDescriptorImageInfo{ VK_NULL_HANDLE,
-    //    castleModel.GetRenderable()->GetTexture()->view,
-    //    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
-    //auto write = VkWriteDescriptorSet{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    // The first frames include pipeline and resource warm-up.
+    const uint32_t warm_up_frames = std::min(10u, headless.frame_count / 10);
+    auto summary = [this, warm_up_frames, &gpu_time_measured](const std::vector<double>& frame_times, bool gpu) {
+        std::vector<double> times;
+        for (uint32_t i = warm_up_frames; i < headless.frame_count; i++) {
+            if (!gpu || gpu_time_measured[i])
+                times.push_back(frame_times[i]);
+        }
+        if (times.empty())
+            return std::string("no frames");
+        std::sort(times.begin(), times.end());
+        double sum = 0.0;
+        for (double t : times)
+            sum += t;
+        char text[128];
+        snprintf(text, sizeof(text), "avg %.3f ms, min %.3f ms, median %.3f ms, p95 %.3f ms, max %.3f ms",
+            sum / times.size(), times.front(), times[times.size() / 2], times[times.size() * 95 / 100], times.back());
+        return std::string(text);
+    };
+    const std::string summary_text = std::string("Headless: ") + std::to_string(headless.frame_count) + " frames " +
+        std::to_string(vk.surface_size.width) + "x" + std::to_string(vk.surface_size.height) + "\n" +
+        "CPU frame time: " + summary(cpu_times_ms, false) + "\n" +
+        "GPU frame time: " + summary(gpu_times_ms, true) + "\n";
+    printf("%s", summary_text.c_str());
+
+    const std::string summary_file = (output_directory / "headless_summary.txt").string();
+    if (FILE* file = fopen(summary_file.c_str(), "w")) {
+        fputs(summary_text.c_str(), file);
+        fclose(file);
+    }
+}
 
-    //write.descriptorCount = 1;
-    //write.dstBinding = 0;
-    //write.pImageInfo = &imageInfo;
-    //write.dstSet = VK_NULL_HANDLE;
-    //write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+void Vk_Demo::draw_frame() {
+    PROFILE_ZONE("draw_frame");
+    vk_begin_frame();
+    secondary_recorder.begin_frame();
+    // The draw list is sorted while the frame is set up below, build_render_graph waits for it.
+    draw_list_job = g_job_system.run([this] { build_scene_draw_list(); });
+    g_render_target_pool.collect();
+
+    // The fence wait in vk_begin_frame finished the copies of the frame that used the same index.
+    for (uint32_t i = 0; i < screenshot_readback_count; i++) {
+        if (screenshot_readbacks[i].copy_submitted && screenshot_readbacks[i].frame_slot == vk.frame_index)
+            submit_screenshot_readback(i);
+    }
+    frame_screenshot = nullptr;
+    if (capture.interval != 0 && (++capture_frame) % capture.interval == 0) {
+        frame_screenshot = acquire_screenshot_readback(capture.policy == Capture_Policy::wait);
+        if (frame_screenshot) {
+            frame_screenshot->format = capture.format;
+            if (capture.format == Image_File_Format::y4m) {
+                frame_screenshot->file_name = (std::filesystem::path(capture.output_directory) / "capture.y4m").string();
+            }
+            else {
+                char file_name[64];
+                snprintf(file_name, sizeof(file_name), "frame_%04u.%s", capture_frame - 1,
+                    capture.format == Image_File_Format::qoi ? "qoi" : "png");
+                frame_screenshot->file_name = (std::filesystem::path(capture.output_directory) / file_name).string();
+            }
+            capture_stats.captured++;
+        }
+        else {
+            capture_stats.dropped++;
+        }
+    }
+    // A screenshot that does not get a readback buffer is postponed.
+    if (need_screenshot && !frame_screenshot) {
+        frame_screenshot = acquire_screenshot_readback(false);
+        if (frame_screenshot) {
+            frame_screenshot->format = Image_File_Format::png;
+            frame_screenshot->file_name = screenshot_file_name.c_str();
+            need_screenshot = false;
+        }
+    }
 
-    //vkCmdPushDescriptorSetKHR(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-    //    pipeline_layout, 1, 1, &write);
+    vk_begin_gpu_marker_scope(vk.command_buffer, "draw_frame");
+    time_keeper.next_frame();
+    for (uint32_t i = 0; i < time_keeper.time_interval_count; i++) {
+        const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[i];
+        if (interval.measured)
+            profiler_record_gpu_zone(interval.name, interval.start_ns, interval.end_ns);
+    }
+    update_hot_reloaded_pipelines();
+    // The timestamps read back now were written by the frame that used the same frame slot, so the
+    // time goes to the post-process path of that frame, not the current one.
+    if (gpu_times.post_process->measured) {
+        float& time_ms = post_process_time_ms[post_process_frame_path[vk.frame_index]];
+        time_ms = 0.75f * time_ms + 0.25f * gpu_times.post_process->raw_length_ms;
+    }
+    post_process_frame_path[vk.frame_index] = compute_post_process ? 1 : (post_process_quad ? 2 : 0);
+    update_render_extent();
+    gpu_times.frame->begin();
 
-    auto renderable = castleModel.GetRenderable();
-    if (renderable)
     {
-        // renderable->DrawWithTextures(vk.command_buffer, pipeline_layout);
-        castleModel.DrawGameObject(vk.command_buffer, pipeline_layout);
+        PROFILE_ZONE("Build render graph");
+        build_render_graph();
+        compiled_render_graph = render_graph.compile(vk_get_image_memory_requirements);
+        if (render_graph.realize(compiled_render_graph)) {
+            stale_post_process_descriptor_sets = 0b11;
+        }
+        if (stale_post_process_descriptor_sets & (1u << vk.frame_index)) {
+            write_post_process_descriptors(vk.frame_index);
+            stale_post_process_descriptor_sets &= ~(1u << vk.frame_index);
+        }
+    }
+    {
+        PROFILE_ZONE("Record render graph");
+        render_graph.execute(vk.command_buffer, compiled_render_graph);
     }
 
-    balooModel.DrawGameObject(vk.command_buffer, pipeline_layout);
-
-    // tankModel.GetRenderable()->DrawWithTextures(vk.command_buffer, pipeline_layout);
-    tankModel.DrawGameObject(vk.command_buffer, pipeline_layout);
+    gpu_times.frame->end();
+    vk_end_gpu_marker_scope(vk.command_buffer);
+    vk_end_frame();
+    frameIndex++;
+}
 
+// Returns a free readback buffer for the current frame. With wait the writer threads are drained
+// when all buffers are busy, otherwise nullptr is returned.
+Vk_Demo::Screenshot_Readback* Vk_Demo::acquire_screenshot_readback(bool wait) {
+    auto find_free_readback = [this]() -> Screenshot_Readback* {
+        for (Screenshot_Readback& readback : screenshot_readbacks) {
+            if (!readback.busy)
+                return &readback;
+        }
+        return nullptr;
+    };
+    Screenshot_Readback* readback = find_free_readback();
+    if (!readback && wait) {
+        PROFILE_ZONE("Wait for readback buffer");
+        screenshot_writer.wait_idle();
+        readback = find_free_readback();
+    }
+    if (!readback)
+        return nullptr;
+
+    // Buffers are kept across resizes and only grow, by size class.
+    const VkDeviceSize required_size = VkDeviceSize(vk.surface_size.width) * vk.surface_size.height * 4;
+    if (readback->buffer_size < required_size) {
+        readback->buffer.destroy();
+        readback->buffer_size = render_target_size_class(required_size);
+        readback->buffer = vk_create_mapped_buffer(readback->buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &readback->mapped,
+            "Screenshot host");
+    }
+    readback->busy = true;
+    readback->copy_submitted = true;
+    readback->frame_slot = vk.frame_index;
+    readback->extent = vk.surface_size;
+    return readback;
+}
 
-    vkCmdEndRendering(vk.command_buffer);
-    vk_end_gpu_marker_scope(vk.command_buffer);
+// Hands the copied pixels to a writer thread. The copy must be finished on the GPU.
+void Vk_Demo::submit_screenshot_readback(uint32_t index) {
+    Screenshot_Readback& readback = screenshot_readbacks[index];
+    readback.copy_submitted = false;
+    screenshot_writer.submit(readback.file_name, readback.format, readback.extent.width, readback.extent.height,
+        static_cast<const uint8_t*>(readback.mapped), [&readback] { readback.busy = false; });
+}
 
-    vk_begin_gpu_marker_scope(vk.command_buffer, "Begin post processing");
-    simple_image_copy(vk.swapchain_info.images[vk.swapchain_image_index],
-        post_process_image.handle,
-        { vk.surface_size.width, vk.surface_size.height });
+void Vk_Demo::start_capture(const Capture_Options& options) {
+    stop_capture();
+    std::filesystem::create_directories(options.output_directory);
+    capture = options;
+    capture_frame = 0;
+    capture_stats = {};
+}
 
-    post_process_transition_for_rendering(post_process_image.handle);
-    color_attachment_transition_for_rendering();
+void Vk_Demo::stop_capture() {
+    if (capture.interval == 0)
+        return;
+    capture.interval = 0;
+    VK_CHECK(vkDeviceWaitIdle(vk.device));
+    flush_screenshots();
+    if (capture.format == Image_File_Format::y4m) {
+        screenshot_writer.close_stream();
+    }
+    printf("Frame capture: %u frames captured, %u dropped\n", capture_stats.captured, capture_stats.dropped);
+}
 
-    vk_cmd_image_barrier(vk.command_buffer, motion_vec_image.handle,
-        VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+// Writes all captured screenshots. The device must be idle.
+void Vk_Demo::flush_screenshots() {
+    for (uint32_t i = 0; i < uint32_t(screenshot_readbacks.size()); i++) {
+        if (screenshot_readbacks[i].copy_submitted)
+            submit_screenshot_readback(i);
+    }
+    screenshot_writer.wait_idle();
+}
 
-    VkDescriptorBufferBindingInfoEXT post_process_descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
-    post_process_descriptor_buffer_binding_info.address = post_process_descriptor_buffer.device_address;
-    post_process_descriptor_buffer_binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
-    vkCmdBindDescriptorBuffersEXT(vk.command_buffer, 1, &post_process_descriptor_buffer_binding_info);
+// Called at the beginning of the frame, after vk_begin_frame waited for the frame that used
+// the same command buffer, so no vkDeviceWaitIdle is needed to replace pipelines.
+void Vk_Demo::update_hot_reloaded_pipelines() {
+    // Destroy replaced pipelines that are not referenced by frames in flight.
+    std::erase_if(retired_pipelines, [this](const Retired_Pipeline& retired) {
+        if (frameIndex - retired.retire_frame < 2)
+            return false;
+        vkDestroyPipeline(vk.device, retired.pipeline, nullptr);
+        return true;
+    });
 
-	rendering_info.colorAttachmentCount = 1;
-    rendering_info.pColorAttachments = &color_attachment;
+    for (const std::string& shader : shader_reloader.take_rebuilt_shaders()) {
+        std::vector<std::pair<Vk_Pipeline_Handle*, Vk_Pipeline_Handle>> rebuilds;
+        if (shader.starts_with("mesh.")) {
+            rebuilds.emplace_back(&pipeline, submit_mesh_pipeline(false));
+            rebuilds.emplace_back(&depth_equal_pipeline, submit_mesh_pipeline(true));
+        }
+        else if (shader.starts_with("depth_prepass.")) {
+            rebuilds.emplace_back(&depth_prepass_pipeline, submit_depth_prepass_pipeline());
+        }
+        else if (shader == "postprocess.comp") {
+            for (int option = 0; option < antialiasing_option_count; option++)
+                rebuilds.emplace_back(&post_process_compute_pipelines[option], submit_post_process_compute_pipeline(option));
+        }
+        else if (shader.starts_with("postprocess.")) {
+            for (int option = 0; option < antialiasing_option_count; option++)
+                rebuilds.emplace_back(&post_process_pipelines[option], submit_post_process_pipeline(option));
+        }
+        for (auto& [target, rebuilt_pipeline] : rebuilds) {
+            for (Pending_Pipeline& pending : pending_pipelines) {
+                if (pending.target == target)
+                    pending.superseded = true;
+            }
+            pending_pipelines.push_back({ target, rebuilt_pipeline, false });
+        }
+    }
 
-	vkCmdBeginRendering(vk.command_buffer, &rendering_info);
-    vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &quad_mesh.vertex_buffer.handle, &zero_offset);
-    vkCmdBindIndexBuffer(vk.command_buffer, quad_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+    std::erase_if(pending_pipelines, [this](const Pending_Pipeline& pending) {
+        if (!pending.pipeline.is_ready())
+            return false;
+        VkPipeline new_pipeline = VK_NULL_HANDLE;
+        try {
+            new_pipeline = pending.pipeline.get();
+        }
+        catch (const std::exception& e) {
+            printf("Shader hot-reload: pipeline creation failed: %s\n", e.what());
+            return true;
+        }
+        if (pending.superseded) {
+            vkDestroyPipeline(vk.device, new_pipeline, nullptr);
+            return true;
+        }
+        retired_pipelines.push_back({ pending.target->get(), frameIndex });
+        *pending.target = pending.pipeline;
+        return true;
+    });
+}
 
-    //vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &quad_mesh.vertex_buffer.handle, &zero_offset);
-    //vkCmdBindIndexBuffer(vk.command_buffer, quad_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+// Declares this frame's passes. The swapchain image holds the scene color, the history image
+// is kept between frames, all other images are transient and may share memory.
+void Vk_Demo::build_render_graph()
+{
+    render_graph.reset();
+    const VkExtent2D size = vk.surface_size;
+    const VkPipelineStageFlags2 post_process_stage = compute_post_process
+        ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+        : VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+
+    Render_Graph_Image_Desc swapchain_desc{ "swapchain", size.width, size.height, vk.surface_format.format };
+    swapchain_desc.image = vk.swapchain_info.images[vk.swapchain_image_index];
+    swapchain_desc.view = vk.swapchain_info.image_views[vk.swapchain_image_index];
+    // Execution dependency with the acquire semaphore wait.
+    swapchain_desc.initial_usage = { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED };
+    swapchain_desc.final_usage = { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+    if (headless.enabled) {
+        // PRESENT_SRC_KHR requires the swapchain extension. Offscreen images stay ready for readback.
+        swapchain_desc.final_usage.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+    const Render_Graph_Image swapchain = render_graph.import_image(swapchain_desc);
+
+    Render_Graph_Image_Desc history_desc{ "prev_frame", size.width, size.height, VK_FORMAT_B8G8R8A8_SRGB };
+    history_desc.image = prev_frame_image.handle;
+    history_desc.view = prev_frame_image.view;
+    history_desc.initial_usage = Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    history_desc.final_usage = history_desc.initial_usage;
+    if (prev_frame_image_undefined) {
+        history_desc.initial_usage = { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED };
+        prev_frame_image_undefined = false;
+    }
+    const Render_Graph_Image history = render_graph.import_image(history_desc);
+
+    graph_images.depth = render_graph.create_image({ "depth_buffer", size.width, size.height, depth_image_format });
+    graph_images.motion_vec = render_graph.create_image({ "motion_vec", size.width, size.height, motion_vec_image_format });
+    graph_images.post_process = render_graph.create_image({ "post_process", size.width, size.height, VK_FORMAT_B8G8R8A8_SRGB });
+    graph_images.post_process_output = compute_post_process
+        ? render_graph.create_image({ "post_process_output", size.width, size.height, post_process_output_format })
+        : ~0u;
+
+    g_job_system.wait(draw_list_job);
+    if (depth_prepass) {
+        render_graph.add_pass("Depth pre-pass", [this](VkCommandBuffer command_buffer) {
+            draw_scene_depth(command_buffer);
+        })
+            .write(graph_images.depth, Render_Graph_Usage::depth_attachment())
+            .timed(gpu_times.depth_prepass);
+    }
+    Render_Graph_Pass& scene_pass = render_graph.add_pass("Draw main frame", [this, swapchain](VkCommandBuffer command_buffer) {
+        draw_scene(command_buffer, render_graph.get_view(swapchain));
+    })
+        .write(swapchain, Render_Graph_Usage::color_attachment())
+        .write(graph_images.motion_vec, Render_Graph_Usage::color_attachment())
+        .timed(gpu_times.scene);
+    if (depth_prepass)
+        scene_pass.read(graph_images.depth, Render_Graph_Usage::depth_attachment_read());
+    else
+        scene_pass.write(graph_images.depth, Render_Graph_Usage::depth_attachment());
+
+    render_graph.add_pass("Begin post processing", [this, swapchain](VkCommandBuffer) {
+        gpu_times.post_process->begin();
+        simple_image_copy(render_graph.get_image(swapchain), render_graph.get_image(graph_images.post_process), render_extent);
+    })
+        .read(swapchain, Render_Graph_Usage::transfer_src())
+        .write(graph_images.post_process, Render_Graph_Usage::transfer_dst())
+        .timed(gpu_times.copy_to_post_process);
+
+    auto post_process_push_constants = Post_Process_Push_Constatnts{ threshold, frameIndex,
+        { float(render_extent.width) / float(size.width), float(render_extent.height) / float(size.height) } };
+
+    if (compute_post_process) {
+        render_graph.add_pass("Post processing (compute)", [this, post_process_push_constants](VkCommandBuffer command_buffer) {
+            bind_post_process_descriptors(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, post_process_compute_pipelines[aliasingOption].get());
+            vkCmdPushConstants(command_buffer, post_process_pipeline_layout, post_process_shader_stages,
+                0, sizeof(Post_Process_Push_Constatnts), &post_process_push_constants);
+            vkCmdDispatch(command_buffer,
+                (vk.surface_size.width + post_process_tile_size - 1) / post_process_tile_size,
+                (vk.surface_size.height + post_process_tile_size - 1) / post_process_tile_size,
+                1);
+        })
+            .read(graph_images.post_process, Render_Graph_Usage::sampled(post_process_stage))
+            .read(graph_images.motion_vec, Render_Graph_Usage::sampled(post_process_stage))
+            .read(history, Render_Graph_Usage::sampled(post_process_stage))
+            .write(graph_images.post_process_output, Render_Graph_Usage::storage_write(post_process_stage))
+            .timed(gpu_times.antialiasing);
+
+        // Blit instead of copy since it converts linear float output to the swapchain format.
+        render_graph.add_pass("Blit post processing output", [this, swapchain](VkCommandBuffer command_buffer) {
+            VkImageBlit2 region{ VK_STRUCTURE_TYPE_IMAGE_BLIT_2 };
+            region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.srcOffsets[1] = { int32_t(vk.surface_size.width), int32_t(vk.surface_size.height), 1 };
+            region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.dstOffsets[1] = region.srcOffsets[1];
+
+            VkBlitImageInfo2 blit_info{ VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2 };
+            blit_info.srcImage = render_graph.get_image(graph_images.post_process_output);
+            blit_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            blit_info.dstImage = render_graph.get_image(swapchain);
+            blit_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            blit_info.regionCount = 1;
+            blit_info.pRegions = &region;
+            blit_info.filter = VK_FILTER_NEAREST;
+            vkCmdBlitImage2(command_buffer, &blit_info);
+            gpu_times.post_process->end();
+        })
+            .read(graph_images.post_process_output, Render_Graph_Usage::transfer_src(VK_PIPELINE_STAGE_2_BLIT_BIT))
+            .write(swapchain, Render_Graph_Usage::transfer_dst(VK_PIPELINE_STAGE_2_BLIT_BIT))
+            .timed(gpu_times.blit_post_process_output);
+    }
+    else {
+        render_graph.add_pass("Post processing", [this, swapchain, post_process_push_constants](VkCommandBuffer command_buffer) {
+            VkRenderingAttachmentInfo color_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+            color_attachment.imageView = render_graph.get_view(swapchain);
+            color_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+            color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // the triangle covers the whole surface
+            color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+            rendering_info.renderArea.extent = vk.surface_size;
+            rendering_info.layerCount = 1;
+            rendering_info.colorAttachmentCount = 1;
+            rendering_info.pColorAttachments = &color_attachment;
+
+            set_viewport_and_scissor(command_buffer, vk.surface_size);
+            vkCmdBeginRendering(command_buffer, &rendering_info);
+            bind_post_process_descriptors(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, post_process_pipelines[aliasingOption].get());
+            vkCmdPushConstants(command_buffer, post_process_pipeline_layout, post_process_shader_stages,
+                0, sizeof(Post_Process_Push_Constatnts), &post_process_push_constants);
+            if (post_process_quad)
+                vkCmdDraw(command_buffer, 6, 1, 3, 0);
+            else
+                vkCmdDraw(command_buffer, 3, 1, 0, 0);
+            vkCmdEndRendering(command_buffer);
+            gpu_times.post_process->end();
+        })
+            .read(graph_images.post_process, Render_Graph_Usage::sampled(post_process_stage))
+            .read(graph_images.motion_vec, Render_Graph_Usage::sampled(post_process_stage))
+            .read(history, Render_Graph_Usage::sampled(post_process_stage))
+            .write(swapchain, Render_Graph_Usage::color_attachment())
+            .timed(gpu_times.antialiasing);
+    }
 
-    auto pushConstants = Post_Process_Push_Constatnts{ static_cast<uint32_t>(aliasingOption), threshold, frameIndex };
+    render_graph.add_pass("Save current frame as history frame", [this, swapchain, history](VkCommandBuffer) {
+        simple_image_copy(render_graph.get_image(swapchain), render_graph.get_image(history), vk.surface_size);
+    })
+        .read(swapchain, Render_Graph_Usage::transfer_src())
+        .write(history, Render_Graph_Usage::transfer_dst())
+        .timed(gpu_times.history_copy);
+
+    if (frame_screenshot) {
+        Render_Graph_Pass& screenshot_pass = render_graph.add_pass("Screenshot", [this, swapchain](VkCommandBuffer command_buffer) {
+            VkBufferImageCopy region{};
+            region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.imageExtent = { vk.surface_size.width, vk.surface_size.height, 1 };
+            vkCmdCopyImageToBuffer(command_buffer, render_graph.get_image(swapchain), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                frame_screenshot->buffer.handle, 1, &region);
+
+            Vk_Barrier_Batch()
+                .memory(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT)
+                .flush(command_buffer);
+        });
+        screenshot_pass.read(swapchain, Render_Graph_Usage::transfer_src());
+        screenshot_pass.side_effects = true;
+        screenshot_pass.timed(gpu_times.screenshot);
+    }
 
-    vkCmdSetDescriptorBufferOffsetsEXT(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, post_process_pipeline_layout, 0, 1, &buffer_index, &set_offset);
+    if (!headless.enabled) {
+        render_graph.add_pass("Drawing GUI", [this, swapchain](VkCommandBuffer command_buffer) {
+            VkRenderingAttachmentInfo color_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+            color_attachment.imageView = render_graph.get_view(swapchain);
+            color_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+            color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+            color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+            rendering_info.renderArea.extent = vk.surface_size;
+            rendering_info.layerCount = 1;
+            rendering_info.colorAttachmentCount = 1;
+            rendering_info.pColorAttachments = &color_attachment;
+
+            vkCmdBeginRendering(command_buffer, &rendering_info);
+            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command_buffer);
+            vkCmdEndRendering(command_buffer);
+        })
+            .write(swapchain, Render_Graph_Usage::color_attachment())
+            .timed(gpu_times.gui);
+    }
+}
 
-    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, post_process_pipeline);
-    vkCmdPushConstants(vk.command_buffer, post_process_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
-        0, sizeof(Post_Process_Push_Constatnts), &pushConstants);
-    vkCmdDrawIndexed(vk.command_buffer, quad_mesh.index_count, 1, 0, 0, 0);
-    vkCmdEndRendering(vk.command_buffer);
-    vk_end_gpu_marker_scope(vk.command_buffer);
+// Opaque objects, front to back by the view depth of their origin when sort_front_to_back is set.
+void Vk_Demo::build_scene_draw_list()
+{
+    // Runs on g_job_system. Objects whose mesh or texture is still loading are culled.
+    scene_draw_list.clear();
+    for (GameObject* object : { &castleModel, &balooModel, &tankModel }) {
+        const std::shared_ptr<RenderableComponent> renderable = object->GetRenderable();
+        if (renderable && renderable->IsResident())
+            scene_draw_list.push_back(object);
+    }
 
-    vk_begin_gpu_marker_scope(vk.command_buffer, "Save current frame as history frame");
-    color_attachment_transition_for_copy_src();
-    post_process_transition_for_copy_dst(prev_frame_image.handle);
-    simple_image_copy(vk.swapchain_info.images[vk.swapchain_image_index],
-        prev_frame_image.handle,
-        { vk.surface_size.width, vk.surface_size.height });
-    post_process_transition_for_rendering(prev_frame_image.handle);
+    if (sort_front_to_back) {
+        // The camera looks at the origin.
+        const Vector3 view_direction = (-camera_pos).normalized();
+        auto view_depth = [this, &view_direction](GameObject* object) {
+            return dot(object->GetTransform()->Transform.position - camera_pos, view_direction);
+        };
+        std::stable_sort(scene_draw_list.begin(), scene_draw_list.end(),
+            [&view_depth](GameObject* a, GameObject* b) { return view_depth(a) < view_depth(b); });
+    }
+}
 
-    color_attachment_transition_for_rendering();
-    vk_end_gpu_marker_scope(vk.command_buffer);
+void Vk_Demo::draw_scene_depth(VkCommandBuffer command_buffer)
+{
+    VkRenderingAttachmentInfo depth_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    depth_attachment.imageView = render_graph.get_view(graph_images.depth);
+    depth_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.clearValue.depthStencil = { 1.f, 0 };
 
-    //vk_begin_gpu_marker_scope(vk.command_buffer, "Begin sharpening post processing");
-    //simple_image_copy(vk.swapchain_info.images[vk.swapchain_image_index],
-    //    post_process_image.handle,
-    //    { vk.surface_size.width, vk.surface_size.height });
+    VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+    rendering_info.renderArea.extent = render_extent;
+    rendering_info.layerCount = 1;
+    rendering_info.pDepthAttachment = &depth_attachment;
 
-    //post_process_transition_for_rendering(post_process_image.handle);
-    //color_attachment_transition_for_rendering();
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+    bind_scene_state(command_buffer, depth_prepass_pipeline.get());
+    for (GameObject* object : scene_draw_list)
+        object->DrawGameObjectDepth(command_buffer, pipeline_layout);
+    vkCmdEndRendering(command_buffer);
+}
 
-    //vk_cmd_image_barrier(vk.command_buffer, motion_vec_image.handle,
-    //    VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_ACCESS_2_NONE,
-    //    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-    //    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_NONE,
-    //    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+void Vk_Demo::draw_scene(VkCommandBuffer command_buffer, VkImageView color_view)
+{
+    VkRenderingAttachmentInfo color_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    color_attachment.imageView = color_view;
+    color_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.clearValue.color = { 0.32f, 0.32f, 0.4f, 0.0f };
 
-    //rendering_info.colorAttachmentCount = 1;
-    //rendering_info.pColorAttachments = &color_attachment;
+    VkRenderingAttachmentInfo motion_vec_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    motion_vec_attachment.imageView = render_graph.get_view(graph_images.motion_vec);
+    motion_vec_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+    motion_vec_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    motion_vec_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    motion_vec_attachment.clearValue.color = { 0.f, 0.f, 0.f, 0.0f };
 
-    //vkCmdBeginRendering(vk.command_buffer, &rendering_info);
-    //vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &quad_mesh.vertex_buffer.handle, &zero_offset);
-    //vkCmdBindIndexBuffer(vk.command_buffer, quad_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+    VkRenderingAttachmentInfo depth_attachment{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+    depth_attachment.imageView = render_graph.get_view(graph_images.depth);
+    depth_attachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+    depth_attachment.loadOp = depth_prepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // After the pre-pass the depth is only tested, STORE_OP_NONE keeps this a read access as declared
+    // in the graph (DONT_CARE would be a depth write).
+    depth_attachment.storeOp = depth_prepass ? VK_ATTACHMENT_STORE_OP_NONE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.clearValue.depthStencil = { 1.f, 0 };
 
-    ////vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &quad_mesh.vertex_buffer.handle, &zero_offset);
-    ////vkCmdBindIndexBuffer(vk.command_buffer, quad_mesh.index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+    std::array color_attachments{ color_attachment, motion_vec_attachment };
 
-    //auto sharpening = Post_Process_Push_Constatnts{ pushConstants.AAType == 2 ? 4u : 0u, threshold, frameIndex };
+    VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+    rendering_info.renderArea.extent = render_extent;
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = static_cast<uint32_t>(color_attachments.size());
+    rendering_info.pColorAttachments = color_attachments.data();
+    rendering_info.pDepthAttachment = &depth_attachment;
 
-    //vkCmdSetDescriptorBufferOffsetsEXT(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, post_process_pipeline_layout, 0, 1, &buffer_index, &set_offset);
+    // Resolved here, workers only see the VkPipeline.
+    const VkPipeline scene_pipeline = depth_prepass ? depth_equal_pipeline.get() : pipeline.get();
 
-    //vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, post_process_pipeline);
-    //vkCmdPushConstants(vk.command_buffer, post_process_pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
-    //    0, sizeof(Post_Process_Push_Constatnts), &sharpening);
-    //vkCmdDrawIndexed(vk.command_buffer, quad_mesh.index_count, 1, 0, 0, 0);
-    //vkCmdEndRendering(vk.command_buffer);
-    //vk_end_gpu_marker_scope(vk.command_buffer);
-    if (need_screenshot)
-    {
-        color_attachment_transition_for_copy_src();
-        simple_image_copy(vk.swapchain_info.images[vk.swapchain_image_index],
-            screenshot_image.handle,
-            { vk.surface_size.width, vk.surface_size.height });
-
-        const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        vk_cmd_image_barrier_for_subresource(vk.command_buffer, screenshot_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-        //  Bufferܴ
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0; // 0 = ʹ imageExtent.width  ܴ
-        region.bufferImageHeight = 0; // 0 = ʹ imageExtent.height  ܴ
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = { 0,0,0 };
-        region.imageExtent = { vk.surface_size.width, vk.surface_size.height, 1 };
-
-        vkCmdCopyImageToBuffer(vk.command_buffer, screenshot_image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            staging_buffer.handle, 1, &region);
-
-        vk_cmd_image_barrier_for_subresource(vk.command_buffer, screenshot_image.handle, subresource_range,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-        color_attachment_transition_for_rendering();
+    if (!multithreaded_recording) {
+        vkCmdBeginRendering(command_buffer, &rendering_info);
+        bind_scene_state(command_buffer, scene_pipeline);
+        for (GameObject* object : scene_draw_list)
+            object->DrawGameObject(command_buffer, pipeline_layout);
+        vkCmdEndRendering(command_buffer);
+        return;
     }
 
-    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    // The draw list is split into contiguous ranges, one secondary command buffer per range.
+    // Dynamic state and bindings are not inherited, each secondary command buffer sets them.
+    const std::array<VkFormat, 2> color_formats{ vk.surface_format.format, motion_vec_image_format };
+    VkCommandBufferInheritanceRenderingInfo inheritance_rendering_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+    inheritance_rendering_info.colorAttachmentCount = uint32_t(color_formats.size());
+    inheritance_rendering_info.pColorAttachmentFormats = color_formats.data();
+    inheritance_rendering_info.depthAttachmentFormat = depth_image_format;
+    inheritance_rendering_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    const uint32_t object_count = uint32_t(scene_draw_list.size());
+    const uint32_t job_count = std::min(secondary_recorder.thread_count(), object_count);
+    secondary_recorder.record(inheritance_rendering_info, job_count,
+        [this, scene_pipeline, object_count, job_count](VkCommandBuffer secondary_command_buffer, uint32_t job) {
+            bind_scene_state(secondary_command_buffer, scene_pipeline);
+            const uint32_t first = object_count * job / job_count;
+            const uint32_t last = object_count * (job + 1) / job_count;
+            for (uint32_t i = first; i < last; i++)
+                scene_draw_list[i]->DrawGameObject(secondary_command_buffer, pipeline_layout);
+        }, scene_command_buffers);
+
+    rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+    vkCmdExecuteCommands(command_buffer, uint32_t(scene_command_buffers.size()), scene_command_buffers.data());
+    vkCmdEndRendering(command_buffer);
+}
 
-    vk_begin_gpu_marker_scope(vk.command_buffer, "Drawing GUI");
-    vkCmdBeginRendering(vk.command_buffer, &rendering_info);
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vk.command_buffer);
-    vkCmdEndRendering(vk.command_buffer);
-    vk_end_gpu_marker_scope(vk.command_buffer);
+void Vk_Demo::bind_scene_state(VkCommandBuffer command_buffer, VkPipeline scene_pipeline)
+{
+    VkDescriptorBufferBindingInfoEXT descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
+    descriptor_buffer_binding_info.address = descriptor_buffer.device_address;
+    descriptor_buffer_binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+    vkCmdBindDescriptorBuffersEXT(command_buffer, 1, &descriptor_buffer_binding_info);
 
-    color_attachment_transition_for_present();
+    set_viewport_and_scissor(command_buffer, render_extent);
 
-    gpu_times.frame->end();
-    vk_end_gpu_marker_scope(vk.command_buffer);
-    vk_end_frame();
-    frameIndex++;
+    const uint32_t buffer_index = 0;
+    const VkDeviceSize set_offset = 0;
+    vkCmdSetDescriptorBufferOffsetsEXT(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &buffer_index, &set_offset);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene_pipeline);
 }
 
-void Vk_Demo::color_attachment_transition_for_copy_src()
+void Vk_Demo::set_viewport_and_scissor(VkCommandBuffer command_buffer, VkExtent2D extent)
 {
-    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_PIPELINE_STAGE_2_COPY_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    VkViewport viewport{};
+    viewport.width = float(extent.width);
+    viewport.height = float(extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.extent = extent;
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 }
 
-void Vk_Demo::post_process_transition_for_copy_dst(const VkImage& targetImg)
+void Vk_Demo::bind_post_process_descriptors(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point)
 {
-    vk_cmd_image_barrier(vk.command_buffer, targetImg,
-        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_PIPELINE_STAGE_2_COPY_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    VkDescriptorBufferBindingInfoEXT descriptor_buffer_binding_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
+    descriptor_buffer_binding_info.address = post_process_descriptor_buffer.device_address;
+    descriptor_buffer_binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+    vkCmdBindDescriptorBuffersEXT(command_buffer, 1, &descriptor_buffer_binding_info);
+
+    const uint32_t buffer_index = 0;
+    const VkDeviceSize set_offset = vk.frame_index * post_process_descriptor_set_stride;
+    vkCmdSetDescriptorBufferOffsetsEXT(command_buffer, bind_point, post_process_pipeline_layout, 0, 1, &buffer_index, &set_offset);
+}
+
+void Vk_Demo::update_render_extent()
+{
+    if (dynamic_resolution && gpu_times.frame->length_ms > 0.f) {
+        // GPU time is roughly proportional to the number of pixels, i.e. to the squared scale.
+        // The measured time lags a few frames behind, so only move part of the way to avoid oscillation.
+        float desired_scale = resolution_scale * std::sqrt(target_gpu_frame_time_ms / gpu_times.frame->length_ms);
+        resolution_scale += (desired_scale - resolution_scale) * 0.1f;
+    }
+    resolution_scale = std::clamp(resolution_scale, min_resolution_scale, 1.f);
+
+    render_extent.width = std::max(1u, uint32_t(float(vk.surface_size.width) * resolution_scale + 0.5f));
+    render_extent.height = std::max(1u, uint32_t(float(vk.surface_size.height) * resolution_scale + 0.5f));
 }
 
 void Vk_Demo::simple_image_copy(const VkImage& src, const VkImage& dst, const VkExtent2D& imgExtent)
@@ -983,32 +1526,8 @@ void Vk_Demo::simple_image_copy(const VkImage& src, const VkImage& dst, const Vk
     vkCmdCopyImage2(vk.command_buffer, &copyInfo);
 }
 
-void Vk_Demo::color_attachment_transition_for_rendering()
-{
-    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
-        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
-}
-
-void Vk_Demo::post_process_transition_for_rendering(const VkImage& targetImg)
-{
-    vk_cmd_image_barrier(vk.command_buffer, targetImg,
-        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-}
-
-void Vk_Demo::color_attachment_transition_for_present()
-{
-    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-}
-
 void Vk_Demo::do_imgui() {
+    PROFILE_ZONE("do_imgui");
     ImGui_ImplVulkan_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -1053,10 +1572,8 @@ void Vk_Demo::do_imgui() {
             //ImGui::Checkbox("Enable FXAA", &isFXAAEnabled);
             //aliasingOption = isFXAAEnabled ? 1 : 0;
 
-        	const std::array options = { "None", "FXAA", "TAA" };
-            const int32_t numOptions = static_cast<uint32_t>(options.size());
-
-            ImGui::Combo("Antialiasing", &aliasingOption, options.data(), numOptions);
+            // Switching the option selects another pre-built pipeline variant in draw_frame.
+            ImGui::Combo("Antialiasing", &aliasingOption, antialiasing_option_names, antialiasing_option_count);
             switch (aliasingOption)
             {
 				case 0: break;
@@ -1070,6 +1587,79 @@ void Vk_Demo::do_imgui() {
                 default: break;
             }
 
+            if (compute_post_process_supported) {
+                ImGui::Checkbox("Compute post-processing", &compute_post_process);
+            }
+            if (!compute_post_process) {
+                ImGui::Checkbox("Post-process with quad", &post_process_quad);
+            }
+            ImGui::Checkbox("Multithreaded scene recording", &multithreaded_recording);
+            ImGui::Checkbox("Depth pre-pass", &depth_prepass);
+            ImGui::Checkbox("Sort draws front to back", &sort_front_to_back);
+            ImGui::Text("Depth pre-pass %.3f ms, scene %.3f ms", depth_prepass ? gpu_times.depth_prepass->length_ms : 0.f,
+                gpu_times.scene->length_ms);
+            ImGui::Checkbox("Dynamic resolution", &dynamic_resolution);
+            if (dynamic_resolution) {
+                ImGui::SliderFloat("Target GPU time (ms)", &target_gpu_frame_time_ms, 1.f, 33.f);
+                ImGui::Text("Resolution scale: %.2f (%u x %u)", resolution_scale, render_extent.width, render_extent.height);
+            }
+            else {
+                ImGui::SliderFloat("Resolution scale", &resolution_scale, min_resolution_scale, 1.f);
+            }
+            ImGui::Text("Post-process: triangle %.3f ms, quad %.3f ms, compute %.3f ms",
+                post_process_time_ms[0], post_process_time_ms[2], post_process_time_ms[1]);
+            ImGui::Text("Render graph: %d passes, %u barriers", int(compiled_render_graph.passes.size()),
+                compiled_render_graph.get_barrier_count());
+            ImGui::Text("Barriers per frame: %u commands, %u image, %u buffer, %u memory",
+                vk.last_frame_barrier_stats.pipeline_barrier_commands, vk.last_frame_barrier_stats.image_barriers,
+                vk.last_frame_barrier_stats.buffer_barriers, vk.last_frame_barrier_stats.memory_barriers);
+            ImGui::Text("Transient memory: %.1f MB (%.1f MB without aliasing)",
+                compiled_render_graph.get_transient_memory_size() / (1024.0 * 1024.0),
+                compiled_render_graph.get_transient_images_size() / (1024.0 * 1024.0));
+            const Render_Target_Pool_Stats pool_stats = g_render_target_pool.get_stats();
+            ImGui::Text("Render target pool: %.1f MB used, %.1f MB free (%u), %llu reused, %llu allocated, %llu expired",
+                pool_stats.used_bytes / (1024.0 * 1024.0), pool_stats.free_bytes / (1024.0 * 1024.0), pool_stats.free_count,
+                (unsigned long long)pool_stats.hits, (unsigned long long)pool_stats.misses, (unsigned long long)pool_stats.expired);
+            if (ImGui::TreeNode("GPU passes")) {
+                for (uint32_t i = 0; i < time_keeper.time_interval_count; i++) {
+                    const Vk_GPU_Time_Interval& interval = time_keeper.time_intervals[i];
+                    if (interval.measured)
+                        ImGui::Text("%-26s %.3f ms", interval.name, interval.length_ms);
+                }
+                ImGui::TreePop();
+            }
+            if (ImGui::TreeNode("GPU memory")) {
+                const Vk_Memory_Stats memory_stats = vk_get_memory_stats();
+                for (size_t i = 0; i < memory_stats.heaps.size(); i++) {
+                    const Vk_Memory_Heap_Stats& heap = memory_stats.heaps[i];
+                    const ImVec4 color = vk.memory_budget_warnings[i] ? ImVec4(1.f, 0.4f, 0.4f, 1.f) : ImGui::GetStyleColorVec4(ImGuiCol_Text);
+                    ImGui::TextColored(color, "Heap %zu%s: %.1f / %.1f MB (ours %.1f MB)", i,
+                        (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device)" : "",
+                        heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0), heap.allocation_bytes / (1024.0 * 1024.0));
+                }
+                for (uint32_t i = 0; i < vk_memory_category_count; i++) {
+                    ImGui::Text("%-14s %.2f MB", vk_memory_category_name(Vk_Memory_Category(i)),
+                        memory_stats.category_bytes[i] / (1024.0 * 1024.0));
+                }
+                if (!vk.memory_budget_supported) {
+                    ImGui::TextDisabled("VK_EXT_memory_budget is not supported, budget is estimated");
+                }
+                if (ImGui::Button("Save memory_stats.json")) {
+                    vk_write_memory_stats_json("memory_stats.json");
+                }
+                ImGui::TreePop();
+            }
+            bool profiler_enabled = g_profiler_enabled;
+            if (ImGui::Checkbox("CPU/GPU profiler", &profiler_enabled)) {
+                g_profiler_enabled = profiler_enabled;
+            }
+            if (profiler_enabled) {
+                ImGui::SameLine();
+                if (ImGui::Button("Save trace")) {
+                    profiler_write_chrome_trace("trace.json");
+                }
+            }
+
             if (ImGui::BeginPopupContextWindow()) {
                 if (ImGui::MenuItem("Custom",       NULL, corner == -1)) corner = -1;
                 if (ImGui::MenuItem("Top-left",     NULL, corner == 0)) corner = 0;
@@ -1088,6 +1678,31 @@ void Vk_Demo::do_imgui() {
             {
                 need_screenshot = true;
             }
+
+            static Capture_Options capture_options{ 1 };
+            if (capture.interval == 0) {
+                static const char* format_names[] = { "png", "qoi", "y4m" };
+                static const char* policy_names[] = { "drop", "wait" };
+                int format = int(capture_options.format);
+                int policy = int(capture_options.policy);
+                int interval = int(capture_options.interval);
+                ImGui::SliderInt("Capture every Nth frame", &interval, 1, 60);
+                ImGui::Combo("Capture format", &format, format_names, IM_ARRAYSIZE(format_names));
+                ImGui::Combo("When buffers are busy", &policy, policy_names, IM_ARRAYSIZE(policy_names));
+                capture_options.interval = uint32_t(interval);
+                capture_options.format = Image_File_Format(format);
+                capture_options.policy = Capture_Policy(policy);
+                if (ImGui::Button("Start capture")) {
+                    start_capture(capture_options);
+                }
+            }
+            else {
+                ImGui::Text("Capturing: %u frames, %u dropped", capture_stats.captured, capture_stats.dropped);
+                ImGui::SameLine();
+                if (ImGui::Button("Stop capture")) {
+                    stop_capture();
+                }
+            }
         }
         ImGui::End();
     }
@@ -2,6 +2,11 @@
 
 #include "lib.h"
 #include "vk.h"
+#include "render_graph.h"
+#include "shader_reloader.h"
+#include "asset_manager.h"
+#include "benchmark.h"
+#include "screenshot_writer.h"
 #include "Mesh.h"
 #include <chrono>
 
@@ -10,9 +15,41 @@
 
 struct GLFWwindow;
 
+// --headless: renders into offscreen images instead of a swapchain, no window is created.
+struct Headless_Options {
+    bool enabled = false;
+    uint32_t width = 1024;
+    uint32_t height = 1024;
+    uint32_t frame_count = 300;
+    std::string output_directory = ".";
+    uint32_t save_image_interval = 0; // every Nth frame is saved as png, 0 - no images
+};
+
+// Frame capture (--capture N): every Nth frame is read back and encoded on the writer threads.
+enum class Capture_Policy {
+    drop,   // skip the frame when all readback buffers are busy, the render thread never waits
+    wait,   // wait for a readback buffer, no frames are lost
+};
+
+struct Capture_Options {
+    uint32_t interval = 0; // 0 - capture is off
+    Image_File_Format format = Image_File_Format::png;
+    Capture_Policy policy = Capture_Policy::drop;
+    std::string output_directory = ".";
+};
+
 class Vk_Demo {
 public:
-    void initialize(GLFWwindow* glfw_window);
+    void initialize(GLFWwindow* glfw_window, const Headless_Options& headless_options = {});
+    // Renders headless.frame_count frames and writes timing statistics to headless.output_directory.
+    void run_headless();
+    // Loads the benchmark script and drives the following frames by it. Results are written
+    // to output_directory when the last measured frame is finished.
+    void start_benchmark(const std::string& script_file, const std::string& output_directory);
+    bool benchmark_finished() const { return benchmark_done; }
+    // Images go to frame_NNNN.png/.qoi or to capture.y4m in the output directory.
+    void start_capture(const Capture_Options& options);
+    void stop_capture();
     void shutdown();
     void release_resolution_dependent_resources();
     void restore_resolution_dependent_resources();
@@ -24,22 +61,53 @@ private:
     void do_imgui();
     void draw_frame();
 
-    void color_attachment_transition_for_copy_src();
-    void post_process_transition_for_copy_dst(const VkImage& targetImg);
+    void build_render_graph();
+    void build_scene_draw_list();
+    void draw_scene_depth(VkCommandBuffer command_buffer);
+    void draw_scene(VkCommandBuffer command_buffer, VkImageView color_view);
+    void bind_scene_state(VkCommandBuffer command_buffer, VkPipeline scene_pipeline);
+    void set_viewport_and_scissor(VkCommandBuffer command_buffer, VkExtent2D extent);
+    void bind_post_process_descriptors(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point);
+    void write_post_process_descriptors(int frame_slot);
     void simple_image_copy(const VkImage& src, const VkImage& dst, const VkExtent2D& imgExtent);
-    void color_attachment_transition_for_rendering();
-    void post_process_transition_for_rendering(const VkImage& targetImg);
-    void color_attachment_transition_for_present();
+    void update_render_extent();
+
+    Vk_Pipeline_Handle submit_mesh_pipeline(bool after_depth_prepass);
+    Vk_Pipeline_Handle submit_depth_prepass_pipeline();
+    Vk_Pipeline_Handle submit_post_process_pipeline(int option);
+    Vk_Pipeline_Handle submit_post_process_compute_pipeline(int option);
+    void update_hot_reloaded_pipelines();
+    struct Screenshot_Readback;
+    Screenshot_Readback* acquire_screenshot_readback(bool wait);
+    void submit_screenshot_readback(uint32_t index);
+    void flush_screenshots();
+    void apply_benchmark_frame();
+    void record_benchmark_frame(double cpu_ms);
 
 private:
     using Clock = std::chrono::high_resolution_clock;
     using Time  = std::chrono::time_point<Clock>;
 
+    Headless_Options headless;
     bool show_ui = true;
     bool vsync = true;
     bool animate = false;
+    static constexpr int antialiasing_option_count = 3; // None, FXAA, TAA
     int aliasingOption = 1;
+    bool compute_post_process = false;
+    bool post_process_quad = false; // draw two triangles instead of one to compare the cost
+    bool multithreaded_recording = true; // scene draws are recorded into secondary command buffers
+    bool depth_prepass = false; // position-only depth pass, the main pass then shades only visible fragments
+    bool sort_front_to_back = true; // opaque draws ordered by view depth for early-Z rejection
+    bool compute_post_process_supported = false;
     float threshold = 0.1f;
+
+    // Dynamic resolution: the scene is rendered into the top-left render_extent part of
+    // the surface sized targets and post-processing upscales it to the full surface.
+    bool dynamic_resolution = false;
+    float target_gpu_frame_time_ms = 8.f;
+    float resolution_scale = 1.f;
+    VkExtent2D render_extent{};
     float scale = .3f;
     uint32_t frameIndex;
 
@@ -50,37 +118,117 @@ private:
     double sim_time = 0;
     Vector3 camera_pos = Vector3(0, 0.5, 3.0);
 
+    // Benchmark mode (--benchmark).
+    bool benchmark_active = false;
+    bool benchmark_done = false;
+    uint32_t benchmark_frame = 0; // frames rendered since start_benchmark, including warm-up
+    std::string benchmark_output_directory;
+    Benchmark_Script benchmark_script;
+    Benchmark_Recorder benchmark_recorder;
+
     Vk_GPU_Time_Keeper time_keeper;
     struct {
         Vk_GPU_Time_Interval* frame;
+        Vk_GPU_Time_Interval* post_process;
+        // Render graph passes.
+        Vk_GPU_Time_Interval* depth_prepass;
+        Vk_GPU_Time_Interval* scene;
+        Vk_GPU_Time_Interval* copy_to_post_process;
+        Vk_GPU_Time_Interval* antialiasing;
+        Vk_GPU_Time_Interval* blit_post_process_output;
+        Vk_GPU_Time_Interval* history_copy;
+        Vk_GPU_Time_Interval* screenshot;
+        Vk_GPU_Time_Interval* gui;
     } gpu_times{};
+    float post_process_time_ms[3]{}; // [0] - fragment path, [1] - compute path, [2] - fragment path with quad
+    uint32_t post_process_frame_path[2]{}; // post_process_time_ms index of the frame recorded in each frame slot
+
+    VkFormat depth_image_format = VK_FORMAT_UNDEFINED;
+    VkFormat motion_vec_image_format = VK_FORMAT_UNDEFINED;
 
-    Vk_Image depth_buffer_image;
-    Vk_Image post_process_image;
+    Render_Graph render_graph;
+    Render_Graph_Compiled compiled_render_graph;
+    // Transient images of the current frame's render graph.
+    struct {
+        Render_Graph_Image depth;
+        Render_Graph_Image motion_vec;
+        Render_Graph_Image post_process;
+        Render_Graph_Image post_process_output; // storage image written by the compute post-process path
+    } graph_images{};
     Vk_Image prev_frame_image;
-    Vk_Image motion_vec_image;
+    bool prev_frame_image_undefined = false; // created after the last frame, its layout is set by the next graph
 
-    Vk_Buffer staging_buffer;
-    void* screenshot_host;
     bool need_screenshot = false;
-    std::string screenshot_file_name;
-
-    Vk_Image screenshot_image;
+    std::string screenshot_file_name; // edited in place by ImGui, use c_str()
+
+    // Bounded pool of readback buffers for screenshots and frame capture, created on first use.
+    // A buffer is busy from the frame that copies into it until a writer thread has converted its pixels.
+    struct Screenshot_Readback {
+        Vk_Buffer buffer;
+        void* mapped = nullptr;
+        VkDeviceSize buffer_size = 0;
+        std::string file_name;
+        Image_File_Format format = Image_File_Format::png;
+        VkExtent2D extent{};
+        int frame_slot = 0; // vk.frame_index of the frame that copies into the buffer
+        bool copy_submitted = false; // waits for the frame fence
+        std::atomic<bool> busy = false;
+    };
+    static constexpr uint32_t screenshot_readback_count = 4;
+    std::array<Screenshot_Readback, screenshot_readback_count> screenshot_readbacks;
+    Screenshot_Readback* frame_screenshot = nullptr; // readback of the current frame, if any
+    Screenshot_Writer screenshot_writer;
+
+    Capture_Options capture;
+    uint32_t capture_frame = 0; // frames since start_capture
+    struct {
+        uint32_t captured;
+        uint32_t dropped;
+    } capture_stats{};
 
     VkDescriptorSetLayout descriptor_set_layout;
     VkDescriptorSetLayout main_texture_descriptor_set_layout;
     VkDescriptorSetLayout post_process_descriptor_set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipelineLayout post_process_pipeline_layout;
-    VkPipeline pipeline;
-    VkPipeline post_process_pipeline;
+    Vk_Pipeline_Compiler pipeline_compiler;
+    Vk_Secondary_Recorder secondary_recorder;
+    Asset_Manager asset_manager; // background loading, see Asset_Manager::update
+    std::vector<GameObject*> scene_draw_list;
+    Job_Handle draw_list_job; // build_scene_draw_list, started in draw_frame
+    std::vector<VkCommandBuffer> scene_command_buffers;
+    Vk_Pipeline_Handle pipeline;
+    Vk_Pipeline_Handle depth_prepass_pipeline;
+    Vk_Pipeline_Handle depth_equal_pipeline; // pipeline with EQUAL depth test and no depth writes, after the pre-pass
+    // One pipeline per antialiasing option (specialization constant), indexed by aliasingOption.
+    std::array<Vk_Pipeline_Handle, antialiasing_option_count> post_process_pipelines;
+    std::array<Vk_Pipeline_Handle, antialiasing_option_count> post_process_compute_pipelines;
+
+    // Shader hot-reload (--shader-hot-reload). Rebuilt pipelines replace the current ones at
+    // a frame boundary, replaced pipelines are destroyed when the frames that use them are finished.
+    Shader_Reloader shader_reloader;
+    struct Pending_Pipeline {
+        Vk_Pipeline_Handle* target;
+        Vk_Pipeline_Handle pipeline;
+        bool superseded; // a newer rebuild of the same target was requested
+    };
+    std::vector<Pending_Pipeline> pending_pipelines;
+    struct Retired_Pipeline {
+        VkPipeline pipeline;
+        uint32_t retire_frame; // frameIndex when the pipeline was replaced
+    };
+    std::vector<Retired_Pipeline> retired_pipelines;
+    // One post-process descriptor set per frame in flight, so the set of a frame can be rewritten when
+    // the render graph recreates its images while the other frame is still executing.
     Vk_Buffer post_process_descriptor_buffer;
+    VkDeviceSize post_process_descriptor_set_stride = 0;
+    uint32_t stale_post_process_descriptor_sets = 0; // bit per frame_index
     Vk_Buffer descriptor_buffer;
     void* post_process_mapped_descriptor_buffer_ptr = nullptr;
     void* mapped_descriptor_buffer_ptr = nullptr;
     Vk_Buffer uniform_buffer;
     void* mapped_uniform_buffer = nullptr;
-    Vk_Image texture;
+    Asset_Handle texture; // owned by asset_manager
     // Vk_Image secondaryTexture;
     VkSampler linear_sampler;
     VkSampler nearest_sampler;
@@ -89,7 +237,6 @@ private:
     GameObject castleModel;
     GameObject tankModel;
     GameObject balooModel;
-    GPU_MESH quad_mesh;
 
     TAATransform main_frame_uniform;
 };
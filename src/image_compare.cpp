@@ -0,0 +1,201 @@
+#include "image_compare.h"
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_COMPARE_SSE2
+#endif
+
+constexpr uint32_t ssim_window_size = 8;
+constexpr uint32_t ssim_window_step = 4;
+
+static std::vector<float> compute_luma(const uint8_t* rgba, uint32_t width, uint32_t height) {
+    std::vector<float> luma(size_t(width) * height);
+    for (size_t i = 0; i < luma.size(); i++)
+        luma[i] = 0.299f * rgba[i * 4 + 0] + 0.587f * rgba[i * 4 + 1] + 0.114f * rgba[i * 4 + 2];
+    return luma;
+}
+
+namespace {
+struct Window_Sums {
+    float a, b, aa, bb, ab;
+};
+}
+
+// Sums over one 8x8 window, a row of the window is two SSE registers.
+static Window_Sums sum_window(const float* a, const float* b, uint32_t stride) {
+#ifdef IMAGE_COMPARE_SSE2
+    __m128 sum_a = _mm_setzero_ps(), sum_b = _mm_setzero_ps();
+    __m128 sum_aa = _mm_setzero_ps(), sum_bb = _mm_setzero_ps(), sum_ab = _mm_setzero_ps();
+    for (uint32_t y = 0; y < ssim_window_size; y++) {
+        for (uint32_t x = 0; x < ssim_window_size; x += 4) {
+            const __m128 va = _mm_loadu_ps(a + size_t(y) * stride + x);
+            const __m128 vb = _mm_loadu_ps(b + size_t(y) * stride + x);
+            sum_a = _mm_add_ps(sum_a, va);
+            sum_b = _mm_add_ps(sum_b, vb);
+            sum_aa = _mm_add_ps(sum_aa, _mm_mul_ps(va, va));
+            sum_bb = _mm_add_ps(sum_bb, _mm_mul_ps(vb, vb));
+            sum_ab = _mm_add_ps(sum_ab, _mm_mul_ps(va, vb));
+        }
+    }
+    auto horizontal_sum = [](__m128 v) {
+        alignas(16) float f[4];
+        _mm_store_ps(f, v);
+        return (f[0] + f[1]) + (f[2] + f[3]);
+    };
+    return { horizontal_sum(sum_a), horizontal_sum(sum_b), horizontal_sum(sum_aa), horizontal_sum(sum_bb), horizontal_sum(sum_ab) };
+#else
+    Window_Sums sums{};
+    for (uint32_t y = 0; y < ssim_window_size; y++) {
+        for (uint32_t x = 0; x < ssim_window_size; x++) {
+            const float va = a[size_t(y) * stride + x];
+            const float vb = b[size_t(y) * stride + x];
+            sums.a += va;
+            sums.b += vb;
+            sums.aa += va * va;
+            sums.bb += vb * vb;
+            sums.ab += va * vb;
+        }
+    }
+    return sums;
+#endif
+}
+
+static double compute_ssim(const std::vector<float>& a, const std::vector<float>& b, uint32_t width, uint32_t height) {
+    if (width < ssim_window_size || height < ssim_window_size)
+        return (a == b) ? 1.0 : 0.0;
+
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const double n = ssim_window_size * ssim_window_size;
+    double ssim_sum = 0.0;
+    uint64_t window_count = 0;
+    for (uint32_t y = 0; y + ssim_window_size <= height; y += ssim_window_step) {
+        for (uint32_t x = 0; x + ssim_window_size <= width; x += ssim_window_step) {
+            const size_t offset = size_t(y) * width + x;
+            const Window_Sums s = sum_window(a.data() + offset, b.data() + offset, width);
+            const double mean_a = s.a / n;
+            const double mean_b = s.b / n;
+            const double var_a = std::max(0.0, s.aa / n - mean_a * mean_a);
+            const double var_b = std::max(0.0, s.bb / n - mean_b * mean_b);
+            const double covariance = s.ab / n - mean_a * mean_b;
+            ssim_sum += ((2 * mean_a * mean_b + c1) * (2 * covariance + c2)) /
+                ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+            window_count++;
+        }
+    }
+    return ssim_sum / double(window_count);
+}
+
+Image_Compare_Result compare_images(const uint8_t* a, const uint8_t* b, uint32_t width, uint32_t height,
+    uint32_t tolerance, uint8_t* diff_rgba)
+{
+    Image_Compare_Result result{};
+    const size_t pixel_count = size_t(width) * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        uint32_t difference = 0;
+        for (int c = 0; c < 4; c++)
+            difference = std::max(difference, uint32_t(std::abs(int(a[i * 4 + c]) - int(b[i * 4 + c]))));
+        result.max_difference = std::max(result.max_difference, difference);
+        const bool differs = difference > tolerance;
+        result.differing_pixels += differs;
+
+        if (diff_rgba) {
+            const uint8_t gray = uint8_t((a[i * 4 + 0] * 77 + a[i * 4 + 1] * 150 + a[i * 4 + 2] * 29) >> 10); // dimmed
+            diff_rgba[i * 4 + 0] = differs ? 255 : gray;
+            diff_rgba[i * 4 + 1] = differs ? 0 : gray;
+            diff_rgba[i * 4 + 2] = differs ? 0 : gray;
+            diff_rgba[i * 4 + 3] = 255;
+        }
+    }
+    result.ssim = compute_ssim(compute_luma(a, width, height), compute_luma(b, width, height), width, height);
+    return result;
+}
+
+static std::vector<std::filesystem::path> list_images(const std::string& directory) {
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        if (entry.path().extension() == ".png" && !entry.path().filename().string().starts_with("diff_"))
+            files.push_back(entry.path().filename());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool has_golden_images(const std::string& golden_directory) {
+    return !list_images(golden_directory).empty();
+}
+
+int check_golden_images(const Golden_Options& options) {
+    namespace fs = std::filesystem;
+
+    const std::vector<fs::path> golden_files = list_images(options.update ? options.output_directory : options.golden_directory);
+
+    if (options.update) {
+        fs::create_directories(options.golden_directory);
+        for (const fs::path& file : golden_files)
+            fs::copy_file(fs::path(options.output_directory) / file, fs::path(options.golden_directory) / file, fs::copy_options::overwrite_existing);
+        printf("Golden images: %zu images written to %s\n", golden_files.size(), options.golden_directory.c_str());
+        return 0;
+    }
+    if (golden_files.empty()) {
+        printf("Golden images: no png images in %s, --golden-update (golden-update target) creates them\n",
+            options.golden_directory.c_str());
+        return 1;
+    }
+
+    const std::string report_file_name = (fs::path(options.output_directory) / "golden_report.txt").string();
+    FILE* report = fopen(report_file_name.c_str(), "w");
+    auto log = [report](const char* format, auto... args) {
+        printf(format, args...);
+        if (report)
+            fprintf(report, format, args...);
+    };
+
+    int failed_count = 0;
+    for (const fs::path& file : golden_files) {
+        const std::string golden_file = (fs::path(options.golden_directory) / file).string();
+        const std::string output_file = (fs::path(options.output_directory) / file).string();
+
+        int golden_width, golden_height, output_width, output_height, components;
+        stbi_uc* golden = stbi_load(golden_file.c_str(), &golden_width, &golden_height, &components, STBI_rgb_alpha);
+        stbi_uc* output = stbi_load(output_file.c_str(), &output_width, &output_height, &components, STBI_rgb_alpha);
+
+        if (!golden || !output) {
+            log("FAIL %s: %s is missing or not readable\n", file.string().c_str(), golden ? output_file.c_str() : golden_file.c_str());
+            failed_count++;
+        }
+        else if (golden_width != output_width || golden_height != output_height) {
+            log("FAIL %s: size %dx%d, golden %dx%d\n", file.string().c_str(), output_width, output_height, golden_width, golden_height);
+            failed_count++;
+        }
+        else {
+            std::vector<uint8_t> diff(size_t(golden_width) * golden_height * 4);
+            const Image_Compare_Result result = compare_images(golden, output, golden_width, golden_height, options.tolerance, diff.data());
+            const double differing_fraction = double(result.differing_pixels) / (double(golden_width) * golden_height);
+            const bool passed = differing_fraction <= options.max_differing_fraction && result.ssim >= options.min_ssim;
+            log("%s %s: %.4f%% pixels above tolerance %u, max difference %u, SSIM %.5f\n", passed ? "PASS" : "FAIL",
+                file.string().c_str(), differing_fraction * 100.0, options.tolerance, result.max_difference, result.ssim);
+            if (!passed) {
+                const std::string diff_file = (fs::path(options.output_directory) / ("diff_" + file.string())).string();
+                stbi_write_png(diff_file.c_str(), golden_width, golden_height, 4, diff.data(), golden_width * 4);
+                failed_count++;
+            }
+        }
+        stbi_image_free(golden);
+        stbi_image_free(output);
+    }
+    log("Golden images: %d of %zu failed\n", failed_count, golden_files.size());
+    if (report)
+        fclose(report);
+    return failed_count;
+}
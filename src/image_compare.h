@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Image comparison for golden image checks (--golden <dir>).
+struct Image_Compare_Result {
+    uint64_t differing_pixels;  // pixels with a channel difference above the tolerance
+    uint32_t max_difference;    // largest channel difference
+    double ssim;                // mean SSIM of the luma over 8x8 windows, 1 - identical
+};
+
+// a, b are RGBA8 images of the same size. If diff_rgba is not null it receives a visualization:
+// grayscale of a, pixels above the tolerance are red.
+Image_Compare_Result compare_images(const uint8_t* a, const uint8_t* b, uint32_t width, uint32_t height,
+    uint32_t tolerance, uint8_t* diff_rgba = nullptr);
+
+struct Golden_Options {
+    std::string golden_directory;
+    std::string output_directory;       // rendered images with the same names as the golden ones
+    bool update = false;                // copy rendered images into the golden directory instead of comparing
+    uint32_t tolerance = 2;             // per channel
+    double max_differing_fraction = 0.001;
+    double min_ssim = 0.99;
+};
+
+// Exit code of --golden when the golden directory has no images, ctest reports the test as skipped.
+constexpr int golden_images_missing_exit_code = 77;
+
+bool has_golden_images(const std::string& golden_directory);
+
+// Compares every png in the golden directory with the image of the same name in the output
+// directory. Writes golden_report.txt and diff_<name>.png for failed images into the output
+// directory. Returns the number of failed images.
+int check_golden_images(const Golden_Options& options);
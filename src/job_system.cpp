@@ -0,0 +1,217 @@
+#include "job_system.h"
+#include "profiler.h"
+
+#include <algorithm>
+
+Job_System g_job_system;
+
+struct Job {
+    std::function<void()> function;
+    std::atomic<uint32_t> unfinished_dependencies = 1; // 1 is released by run() after dependencies are registered
+    std::atomic<bool> finished = false;
+    std::exception_ptr exception;
+
+    std::mutex continuation_mutex;
+    std::vector<Job_Handle> continuations; // jobs that depend on this one
+};
+
+// Index of the worker that runs on this thread, per Job_System instance.
+static thread_local const Job_System* current_job_system = nullptr;
+static thread_local uint32_t current_worker_index = 0;
+
+void Job_System::initialize(uint32_t thread_count) {
+    stop = false;
+    for (uint32_t i = 0; i <= thread_count; i++)
+        queues.push_back(std::make_unique<Worker_Queue>());
+    for (uint32_t i = 0; i < thread_count; i++)
+        workers.emplace_back(&Job_System::worker_loop, this, i);
+}
+
+void Job_System::shutdown() {
+    while (queued_jobs.load() != 0) {
+        if (Job_Handle job = pop_or_steal(current_thread_index()))
+            execute(job);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    job_available.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+    queues.clear();
+}
+
+uint32_t Job_System::current_thread_index() const {
+    return current_job_system == this ? current_worker_index : uint32_t(workers.size());
+}
+
+Job_Handle Job_System::run(std::function<void()> function, std::initializer_list<Job_Handle> dependencies) {
+    Job_Handle job = std::make_shared<Job>();
+    job->function = std::move(function);
+    for (const Job_Handle& dependency : dependencies) {
+        if (!dependency)
+            continue;
+        std::lock_guard<std::mutex> lock(dependency->continuation_mutex);
+        if (!dependency->finished) {
+            job->unfinished_dependencies++;
+            dependency->continuations.push_back(job);
+        }
+    }
+    if (--job->unfinished_dependencies == 0)
+        push(job);
+    return job;
+}
+
+void Job_System::push(Job_Handle job) {
+    // Counted before it is visible, so the count never goes below the number of queued jobs.
+    queued_jobs++;
+    Worker_Queue& queue = *queues[current_thread_index()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    if (sleeping_workers > 0)
+        job_available.notify_one();
+}
+
+Job_Handle Job_System::pop_or_steal(uint32_t queue_index) {
+    if (queued_jobs.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+    {
+        Worker_Queue& own = *queues[queue_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            Job_Handle job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued_jobs--;
+            return job;
+        }
+    }
+    // Steal the oldest job, starting from the next queue so thieves spread over the victims.
+    const uint32_t queue_count = uint32_t(queues.size());
+    for (uint32_t i = 1; i < queue_count; i++) {
+        Worker_Queue& victim = *queues[(queue_index + i) % queue_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            Job_Handle job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued_jobs--;
+            stolen_jobs.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void Job_System::execute(const Job_Handle& job) {
+    try {
+        job->function();
+    }
+    catch (...) {
+        job->exception = std::current_exception();
+    }
+    job->function = nullptr;
+    executed_jobs.fetch_add(1, std::memory_order_relaxed);
+
+    std::vector<Job_Handle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job->continuation_mutex);
+        job->finished.store(true, std::memory_order_release);
+        continuations.swap(job->continuations);
+    }
+    for (Job_Handle& continuation : continuations) {
+        if (--continuation->unfinished_dependencies == 0)
+            push(std::move(continuation));
+    }
+}
+
+void Job_System::wait(const Job_Handle& job) {
+    const uint32_t queue_index = current_thread_index();
+    while (!job->finished.load(std::memory_order_acquire)) {
+        if (Job_Handle other = pop_or_steal(queue_index))
+            execute(other);
+        else
+            std::this_thread::yield();
+    }
+    if (job->exception)
+        std::rethrow_exception(job->exception);
+}
+
+bool Job_System::is_finished(const Job_Handle& job) const {
+    return job->finished.load(std::memory_order_acquire);
+}
+
+void Job_System::parallel_for(uint32_t count, uint32_t batch_size, const std::function<void(uint32_t, uint32_t)>& body) {
+    if (count == 0)
+        return;
+    batch_size = std::max(batch_size, 1u);
+    const uint32_t batch_count = (count + batch_size - 1) / batch_size;
+    if (batch_count == 1 || workers.empty()) {
+        body(0, count);
+        return;
+    }
+    // The calling thread takes the first batch.
+    std::vector<Job_Handle> jobs;
+    jobs.reserve(batch_count - 1);
+    for (uint32_t batch = 1; batch < batch_count; batch++) {
+        const uint32_t begin = batch * batch_size;
+        const uint32_t end = std::min(begin + batch_size, count);
+        jobs.push_back(run([&body, begin, end] { body(begin, end); }));
+    }
+    // The jobs reference body, so they are waited for before an exception leaves this function.
+    std::exception_ptr exception;
+    try {
+        body(0, std::min(batch_size, count));
+    }
+    catch (...) {
+        exception = std::current_exception();
+    }
+    for (const Job_Handle& job : jobs) {
+        try {
+            wait(job);
+        }
+        catch (...) {
+            if (!exception)
+                exception = std::current_exception();
+        }
+    }
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+Job_System_Stats Job_System::get_stats() const {
+    return { executed_jobs.load(), stolen_jobs.load() };
+}
+
+void Job_System::worker_loop(uint32_t worker_index) {
+    current_job_system = this;
+    current_worker_index = worker_index;
+    profiler_set_thread_name("Job worker");
+
+    while (true) {
+        if (Job_Handle job = pop_or_steal(worker_index)) {
+            PROFILE_ZONE("Job");
+            execute(job);
+            continue;
+        }
+        // Spin briefly before sleeping, jobs often come in bursts.
+        bool found = false;
+        for (int i = 0; i < 64 && !found; i++) {
+            std::this_thread::yield();
+            found = queued_jobs.load(std::memory_order_relaxed) != 0;
+        }
+        if (found)
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleeping_workers++;
+        job_available.wait(lock, [this] { return stop || queued_jobs.load() != 0; });
+        sleeping_workers--;
+        if (stop && queued_jobs.load() == 0)
+            return;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job scheduler. Every worker has its own deque: the owner pushes and pops
+// at the back (the most recently spawned job is still in cache), idle workers steal from
+// the front of the other deques. Threads that are not workers (the main thread) push into
+// a shared queue. wait() runs other jobs while the awaited job is not finished, so jobs
+// can spawn and wait for sub-jobs without blocking a worker.
+struct Job;
+using Job_Handle = std::shared_ptr<Job>;
+
+struct Job_System_Stats {
+    uint64_t executed_jobs;
+    uint64_t stolen_jobs;
+};
+
+struct Job_System {
+    void initialize(uint32_t thread_count);
+    // Finishes the queued jobs.
+    void shutdown();
+    uint32_t thread_count() const { return uint32_t(workers.size()); }
+    // Index of the calling worker thread, thread_count() for all other threads.
+    uint32_t current_thread_index() const;
+
+    // The job starts after all dependencies are finished. A dependency may be null.
+    Job_Handle run(std::function<void()> job, std::initializer_list<Job_Handle> dependencies = {});
+    // Rethrows the job's exception.
+    void wait(const Job_Handle& job);
+    bool is_finished(const Job_Handle& job) const;
+
+    // Splits [0, count) into ranges of at most batch_size and calls body(begin, end) for each range
+    // on the workers and the calling thread. Returns when all ranges are done, then rethrows
+    // the first exception.
+    void parallel_for(uint32_t count, uint32_t batch_size, const std::function<void(uint32_t, uint32_t)>& body);
+
+    Job_System_Stats get_stats() const;
+
+private:
+    struct Worker_Queue {
+        std::mutex mutex;
+        std::deque<Job_Handle> jobs;
+    };
+
+    void worker_loop(uint32_t worker_index);
+    void push(Job_Handle job);
+    Job_Handle pop_or_steal(uint32_t queue_index);
+    void execute(const Job_Handle& job);
+
+    // workers.size() queues of the workers followed by the queue of the non-worker threads.
+    std::vector<std::unique_ptr<Worker_Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> queued_jobs = 0;
+    std::atomic<uint64_t> executed_jobs = 0;
+    std::atomic<uint64_t> stolen_jobs = 0;
+
+    std::mutex sleep_mutex;
+    std::condition_variable job_available;
+    uint32_t sleeping_workers = 0;
+    bool stop = false;
+};
+
+// Shared scheduler for all background and parallel work: asset loading, pipeline creation,
+// secondary command buffer recording, draw list building and screenshot encoding.
+extern Job_System g_job_system;
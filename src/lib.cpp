@@ -1,4 +1,5 @@
 #include "lib.h"
+#include "asset_archive.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -427,7 +428,19 @@ Triangle_Mesh load_obj_model(const std::string& path, float additional_scale) {
     std::vector<tinyobj::material_t> materials;
     std::string err;
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
+    // Parsed from the archive mapping or from the file contents, without a second buffered copy.
+    struct Memory_Buffer : std::streambuf {
+        Memory_Buffer(std::span<const uint8_t> bytes) {
+            char* begin = const_cast<char*>(reinterpret_cast<const char*>(bytes.data()));
+            setg(begin, begin, begin + bytes.size());
+        }
+    };
+    Asset_File file;
+    if (!read_asset_file(path, file))
+        error("failed to load obj model: " + path);
+    Memory_Buffer buffer(file.bytes);
+    std::istream stream(&buffer);
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &stream))
         error("failed to load obj model: " + path);
 
     assert(shapes.size() == 1);
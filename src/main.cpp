@@ -1,8 +1,30 @@
 #include "demo.h"
+#include "asset_archive.h"
+#include "image_compare.h"
+#include "profiler.h"
 #include "glfw/glfw3.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+static Headless_Options headless_options;
+static std::string benchmark_script;
+static std::string trace_file;
+static Capture_Options capture_options;
+static Golden_Options golden_options;
+static std::string archive_file;
+
+static bool parse_uint(const char* text, uint32_t* value) {
+    char* end = nullptr;
+    unsigned long result = strtoul(text, &end, 10);
+    if (end == text || *end != 0)
+        return false;
+    *value = uint32_t(result);
+    return true;
+}
+
 static bool parse_command_line(int argc, char** argv) {
     bool found_unknown_option = false;
     for (int i = 1; i < argc; i++) {
@@ -16,8 +38,166 @@ static bool parse_command_line(int argc, char** argv) {
                 i++;
             }
         }
+        else if (strcmp(argv[i], "--archive") == 0) {
+            if (i == argc - 1) {
+                printf("--archive value is missing\n");
+            }
+            else {
+                archive_file = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--shader-hot-reload") == 0) {
+            extern bool g_shader_hot_reload;
+            g_shader_hot_reload = true;
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless_options.enabled = true;
+            // Optional WIDTHxHEIGHT.
+            unsigned width, height;
+            if (i < argc - 1 && sscanf(argv[i + 1], "%ux%u", &width, &height) == 2 && width > 0 && height > 0) {
+                headless_options.width = width;
+                headless_options.height = height;
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0) {
+            if (i == argc - 1 || !parse_uint(argv[i + 1], &headless_options.frame_count)) {
+                printf("--frames value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--output-dir") == 0) {
+            if (i == argc - 1) {
+                printf("--output-dir value is missing\n");
+            }
+            else {
+                headless_options.output_directory = argv[i + 1];
+                capture_options.output_directory = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            if (i == argc - 1) {
+                printf("--benchmark value is missing\n");
+            }
+            else {
+                benchmark_script = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--capture") == 0) {
+            if (i == argc - 1 || !parse_uint(argv[i + 1], &capture_options.interval)) {
+                printf("--capture value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--capture-format") == 0) {
+            const char* value = (i < argc - 1) ? argv[i + 1] : "";
+            if (strcmp(value, "png") == 0)
+                capture_options.format = Image_File_Format::png;
+            else if (strcmp(value, "qoi") == 0)
+                capture_options.format = Image_File_Format::qoi;
+            else if (strcmp(value, "y4m") == 0)
+                capture_options.format = Image_File_Format::y4m;
+            else {
+                printf("--capture-format value should be png, qoi or y4m\n");
+                continue;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--capture-policy") == 0) {
+            const char* value = (i < argc - 1) ? argv[i + 1] : "";
+            if (strcmp(value, "drop") == 0)
+                capture_options.policy = Capture_Policy::drop;
+            else if (strcmp(value, "wait") == 0)
+                capture_options.policy = Capture_Policy::wait;
+            else {
+                printf("--capture-policy value should be drop or wait\n");
+                continue;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace") == 0) {
+            if (i == argc - 1) {
+                printf("--trace value is missing\n");
+            }
+            else {
+                trace_file = argv[i + 1];
+                g_profiler_enabled = true;
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--golden") == 0) {
+            if (i == argc - 1) {
+                printf("--golden value is missing\n");
+            }
+            else {
+                golden_options.golden_directory = argv[i + 1];
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--golden-update") == 0) {
+            golden_options.update = true;
+        }
+        else if (strcmp(argv[i], "--golden-tolerance") == 0) {
+            if (i == argc - 1 || !parse_uint(argv[i + 1], &golden_options.tolerance)) {
+                printf("--golden-tolerance value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--golden-max-pixels") == 0) {
+            if (i == argc - 1 || sscanf(argv[i + 1], "%lf", &golden_options.max_differing_fraction) != 1) {
+                printf("--golden-max-pixels value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--golden-min-ssim") == 0) {
+            if (i == argc - 1 || sscanf(argv[i + 1], "%lf", &golden_options.min_ssim) != 1) {
+                printf("--golden-min-ssim value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--save-images") == 0) {
+            if (i == argc - 1 || !parse_uint(argv[i + 1], &headless_options.save_image_interval)) {
+                printf("--save-images value is missing or invalid\n");
+            }
+            else {
+                i++;
+            }
+        }
         else if (strcmp(argv[i], "--help") == 0) {
             printf("%-25s Path to the data directory. Default is ./data.\n", "--data-dir");
+            printf("%-25s Reads assets from the packed archive (built by the asset-archive target), loose files otherwise.\n", "--archive <file>");
+            printf("%-25s Rebuilds changed shaders from src/shaders and reloads pipelines at runtime.\n", "--shader-hot-reload");
+            printf("%-25s Renders offscreen without a window. Default size is 1024x1024.\n", "--headless [WxH]");
+            printf("%-25s Number of frames to render in headless mode. Default is 300.\n", "--frames N");
+            printf("%-25s Where headless, benchmark and capture modes write results. Default is current directory.\n", "--output-dir");
+            printf("%-25s Runs the benchmark script and writes benchmark.csv and benchmark.json.\n", "--benchmark <script>");
+            printf("%-25s Saves every Nth frame as png in headless mode.\n", "--save-images N");
+            printf("%-25s Captures every Nth frame into --output-dir.\n", "--capture N");
+            printf("%-25s png (default), qoi or y4m (one video stream).\n", "--capture-format F");
+            printf("%-25s drop (default) skips frames when readback buffers are busy, wait never skips.\n", "--capture-policy P");
+            printf("%-25s Enables the profiler and writes Chrome trace of the last frames on exit.\n", "--trace <file>");
+            printf("%-25s Renders the benchmark script headless (default benchmark/orbit.txt), captures every\n", "--golden <dir>");
+            printf("%-25s Nth frame as png (--capture, default 100) and compares the frames with the images\n", "");
+            printf("%-25s in <dir>. Writes golden_report.txt and diff images, exit code is 1 if an image differs,\n", "");
+            printf("%-25s 77 if <dir> has no images.\n", "");
+            printf("%-25s Without a GPU set VK_ICD_FILENAMES to the lavapipe (software) driver manifest.\n", "");
+            printf("%-25s Replaces the images in the --golden directory with the rendered frames.\n", "--golden-update");
+            printf("%-25s Per channel difference that is not counted as different. Default is 2.\n", "--golden-tolerance T");
+            printf("%-25s Allowed fraction of different pixels. Default is 0.001.\n", "--golden-max-pixels F");
+            printf("%-25s Minimum SSIM of the luma. Default is 0.99.\n", "--golden-min-ssim S");
             printf("%-25s Shows this information.\n", "--help");
             return false;
         }
@@ -26,6 +206,29 @@ static bool parse_command_line(int argc, char** argv) {
     }
     if (found_unknown_option)
         printf("Use --help to list all options.\n");
+
+    // Opened after all options are parsed, entries are relative to the data directory.
+    if (!archive_file.empty()) {
+        extern std::string g_data_dir;
+        extern bool g_shader_hot_reload;
+        if (g_asset_archive.open(archive_file, g_data_dir) && g_shader_hot_reload) {
+            // Rebuilt shaders are written as loose files.
+            g_asset_archive.ignore_directory("spirv");
+        }
+    }
+
+    // Golden images need a scene that does not depend on wall clock time.
+    if (!golden_options.golden_directory.empty()) {
+        headless_options.enabled = true;
+        if (benchmark_script.empty())
+            benchmark_script = get_resource_path("benchmark/orbit.txt");
+        if (capture_options.interval == 0)
+            capture_options.interval = 100;
+        capture_options.format = Image_File_Format::png;
+        capture_options.policy = Capture_Policy::wait;
+        capture_options.output_directory = headless_options.output_directory;
+        golden_options.output_directory = headless_options.output_directory;
+    }
     return true;
 }
 
@@ -40,7 +243,6 @@ static void glfw_key_callback(GLFWwindow* window, int key, int scancode, int act
             static int last_window_xpos, last_window_ypos;
             static int last_window_width, last_window_height;
 
-            VK_CHECK(vkDeviceWaitIdle(vk.device));
             GLFWmonitor* monitor = glfwGetWindowMonitor(window);
             if (monitor == nullptr) {
                 glfwGetWindowPos(window, &last_window_xpos, &last_window_ypos);
@@ -75,6 +277,28 @@ int main(int argc, char** argv) {
     if (!parse_command_line(argc, argv)) {
         return 0;
     }
+    profiler_set_thread_name("Main");
+    // Checked before rendering, the benchmark takes minutes on a software driver.
+    if (!golden_options.golden_directory.empty() && !golden_options.update && !has_golden_images(golden_options.golden_directory)) {
+        printf("Golden images: SKIPPED, no png images in %s. The golden-update target (--golden-update) renders them.\n",
+            golden_options.golden_directory.c_str());
+        return golden_images_missing_exit_code;
+    }
+    if (headless_options.enabled) {
+        Vk_Demo demo{};
+        demo.initialize(nullptr, headless_options);
+        if (capture_options.interval != 0)
+            demo.start_capture(capture_options);
+        if (!benchmark_script.empty())
+            demo.start_benchmark(benchmark_script, headless_options.output_directory);
+        demo.run_headless();
+        if (!trace_file.empty())
+            profiler_write_chrome_trace(trace_file);
+        demo.shutdown();
+        if (!golden_options.golden_directory.empty())
+            return check_golden_images(golden_options) == 0 ? 0 : 1;
+        return 0;
+    }
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) {
         error("glfwInit failed");
@@ -93,12 +317,22 @@ int main(int argc, char** argv) {
 
     bool prev_vsync = demo.vsync_enabled();
 
+    // Started after prev_vsync is read, so the main loop recreates the swapchain without vsync.
+    if (!benchmark_script.empty())
+        demo.start_benchmark(benchmark_script, headless_options.output_directory);
+
+    if (capture_options.interval != 0)
+        demo.start_capture(capture_options);
+
     bool window_active = true;
 
     while (!glfwWindowShouldClose(glfw_window)) {
         if (window_active)
             demo.run_frame();
 
+        if (demo.benchmark_finished())
+            glfwSetWindowShouldClose(glfw_window, GLFW_TRUE);
+
         glfwPollEvents();
 
         int width, height;
@@ -120,15 +354,15 @@ int main(int argc, char** argv) {
             continue; 
 
         if (recreate_swapchain) {
-            VK_CHECK(vkDeviceWaitIdle(vk.device));
             demo.release_resolution_dependent_resources();
-            vk_destroy_swapchain();
-            vk_create_swapchain(demo.vsync_enabled());
+            vk_recreate_swapchain(demo.vsync_enabled());
             demo.restore_resolution_dependent_resources();
             recreate_swapchain = false;
         }
     }
 
+    if (!trace_file.empty())
+        profiler_write_chrome_trace(trace_file);
     demo.shutdown();
     glfwTerminate();
     return 0;
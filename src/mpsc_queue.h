@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Multi-producer single-consumer queue (D. Vyukov's node based queue). push is wait-free and
+// can be called from any thread, pop must be called from one thread only.
+template <typename T>
+struct Mpsc_Queue {
+    Mpsc_Queue() {
+        Node* stub = new Node;
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+    ~Mpsc_Queue() {
+        T value;
+        while (pop(value)) {}
+        delete tail;
+    }
+    Mpsc_Queue(const Mpsc_Queue&) = delete;
+    Mpsc_Queue& operator=(const Mpsc_Queue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node;
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        // Until this store the consumer sees the queue as ending at prev.
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return false;
+        value = std::move(next->value);
+        delete tail;
+        tail = next; // the popped node becomes the new stub
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next = nullptr;
+        T value{};
+    };
+    std::atomic<Node*> head;
+    Node* tail; // consumer only
+};
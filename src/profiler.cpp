@@ -0,0 +1,175 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> g_profiler_enabled = false;
+
+namespace {
+struct Profiler_Event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// Single producer ring buffer. The owning thread is the only writer, the trace writer
+// copies the events and drops the ones that were overwritten while it was copying.
+struct Event_Ring {
+    static constexpr uint64_t capacity = 1 << 15;
+
+    std::atomic<uint64_t> write_count = 0;
+    Profiler_Event events[capacity];
+
+    void push(const char* event_name, uint64_t start_ns, uint64_t end_ns) {
+        const uint64_t index = write_count.load(std::memory_order_relaxed);
+        events[index % capacity] = Profiler_Event{ event_name, start_ns, end_ns };
+        write_count.store(index + 1, std::memory_order_release);
+    }
+
+    std::vector<Profiler_Event> copy_events() const {
+        const uint64_t end = write_count.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity ? end - capacity : 0;
+        std::vector<Profiler_Event> result;
+        result.reserve(size_t(end - begin));
+        for (uint64_t i = begin; i < end; i++)
+            result.push_back(events[i % capacity]);
+
+        // Events that the writer could have overwritten during the copy.
+        const uint64_t new_end = write_count.load(std::memory_order_acquire);
+        const uint64_t first_valid = new_end > capacity ? new_end - capacity : 0;
+        if (first_valid > begin)
+            result.erase(result.begin(), result.begin() + size_t(std::min(first_valid, end) - begin));
+        return result;
+    }
+};
+
+// Registered by the first profiler call on a thread. The ring (~768 KB) is allocated by the
+// first event recorded while the profiler is enabled, a named thread that never records
+// costs only the slot.
+struct Thread_Slot {
+    uint32_t thread_id = 0;
+    std::string name;
+    std::atomic<Event_Ring*> ring = nullptr;
+    std::unique_ptr<Event_Ring> ring_storage; // guarded by the registry mutex
+
+    void push(const char* event_name, uint64_t start_ns, uint64_t end_ns);
+};
+
+struct Profiler_Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Thread_Slot>> thread_slots; // slots of finished threads are kept
+    Thread_Slot gpu_slot;
+
+    Profiler_Registry() {
+        gpu_slot.name = "GPU";
+    }
+};
+}
+
+// Allocated once and never destroyed, so threads that outlive main can still record.
+static Profiler_Registry& get_registry() {
+    static Profiler_Registry* registry = new Profiler_Registry;
+    return *registry;
+}
+
+// Called only by the thread that owns the slot (the render thread for the GPU slot).
+void Thread_Slot::push(const char* event_name, uint64_t start_ns, uint64_t end_ns) {
+    Event_Ring* events = ring.load(std::memory_order_relaxed);
+    if (events == nullptr) {
+        if (!g_profiler_enabled.load(std::memory_order_relaxed))
+            return;
+        Profiler_Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        ring_storage = std::make_unique<Event_Ring>();
+        events = ring_storage.get();
+        ring.store(events, std::memory_order_release);
+    }
+    events->push(event_name, start_ns, end_ns);
+}
+
+static thread_local Thread_Slot* current_thread_slot = nullptr;
+
+static Thread_Slot* get_thread_slot() {
+    if (current_thread_slot == nullptr) {
+        Profiler_Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.thread_slots.push_back(std::make_unique<Thread_Slot>());
+        current_thread_slot = registry.thread_slots.back().get();
+        current_thread_slot->thread_id = uint32_t(registry.thread_slots.size()); // 0 is the GPU
+        current_thread_slot->name = "Thread " + std::to_string(current_thread_slot->thread_id);
+    }
+    return current_thread_slot;
+}
+
+uint64_t profiler_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profiler_record_zone(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    get_thread_slot()->push(name, start_ns, end_ns);
+}
+
+void profiler_record_gpu_zone(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    if (g_profiler_enabled.load(std::memory_order_relaxed))
+        get_registry().gpu_slot.push(name, start_ns, end_ns);
+}
+
+void profiler_set_thread_name(const char* name) {
+    Thread_Slot* slot = get_thread_slot();
+    std::lock_guard<std::mutex> lock(get_registry().mutex);
+    slot->name = name;
+}
+
+bool profiler_write_chrome_trace(const std::string& file_name) {
+    struct Thread_Events {
+        uint32_t thread_id;
+        std::string name;
+        std::vector<Profiler_Event> events;
+    };
+    std::vector<Thread_Events> threads;
+    {
+        Profiler_Registry& registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto add_thread = [&threads](const Thread_Slot& slot) {
+            // Threads that never recorded an event are left out.
+            if (const Event_Ring* ring = slot.ring.load(std::memory_order_acquire))
+                threads.push_back({ slot.thread_id, slot.name, ring->copy_events() });
+        };
+        add_thread(registry.gpu_slot);
+        for (const auto& slot : registry.thread_slots)
+            add_thread(*slot);
+    }
+
+    uint64_t base_ns = UINT64_MAX;
+    for (const Thread_Events& thread : threads) {
+        for (const Profiler_Event& event : thread.events)
+            base_ns = std::min(base_ns, event.start_ns);
+    }
+
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file) {
+        printf("Profiler: failed to write %s\n", file_name.c_str());
+        return false;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    size_t event_count = 0;
+    for (const Thread_Events& thread : threads) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", thread.thread_id, thread.name.c_str());
+        first = false;
+        for (const Profiler_Event& event : thread.events) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, thread.thread_id, (event.start_ns - base_ns) / 1e3, (event.end_ns - event.start_ns) / 1e3);
+        }
+        event_count += thread.events.size();
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("Profiler: %zu events written to %s\n", event_count, file_name.c_str());
+    return true;
+}
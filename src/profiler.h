@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// CPU profiler. PROFILE_ZONE marks a scope, the zone is recorded when the scope ends.
+// Every thread writes into its own ring buffer without locks, the buffers keep the most
+// recent events. When the profiler is disabled a zone costs one relaxed atomic load.
+// A thread's ring buffer is allocated by its first event while the profiler is enabled.
+//
+// GPU intervals are added by the renderer with profiler_record_gpu_zone after they are
+// read back, with timestamps already converted to the CPU clock (see Vk_GPU_Time_Keeper).
+// profiler_write_chrome_trace writes all buffered events in Chrome trace format
+// (chrome://tracing, ui.perfetto.dev).
+extern std::atomic<bool> g_profiler_enabled;
+
+// Time in nanoseconds of std::chrono::steady_clock.
+uint64_t profiler_now_ns();
+
+void profiler_record_zone(const char* name, uint64_t start_ns, uint64_t end_ns);
+void profiler_record_gpu_zone(const char* name, uint64_t start_ns, uint64_t end_ns);
+// Shown as the thread name in the trace. The name is copied.
+void profiler_set_thread_name(const char* name);
+bool profiler_write_chrome_trace(const std::string& file_name);
+
+// name must be a string literal or outlive the profiler.
+struct Profiler_Zone {
+    explicit Profiler_Zone(const char* name)
+        : name(name)
+        , start_ns(g_profiler_enabled.load(std::memory_order_relaxed) ? profiler_now_ns() : 0)
+    {}
+    ~Profiler_Zone() {
+        if (start_ns != 0)
+            profiler_record_zone(name, start_ns, profiler_now_ns());
+    }
+
+private:
+    const char* name;
+    uint64_t start_ns;
+};
+
+#define PROFILE_ZONE_CONCAT_(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) Profiler_Zone PROFILE_ZONE_CONCAT(profiler_zone, __LINE__)(name)
@@ -0,0 +1,127 @@
+#include "render_graph.h"
+#include "lib.h"
+#include "render_target_pool.h"
+
+static bool is_depth_format(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool same_layout(const std::vector<Render_Graph_Transient_Image>& a, const std::vector<Render_Graph_Transient_Image>& b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].image != b[i].image ||
+            a[i].create_info.format != b[i].create_info.format ||
+            a[i].create_info.extent.width != b[i].create_info.extent.width ||
+            a[i].create_info.extent.height != b[i].create_info.extent.height ||
+            a[i].create_info.usage != b[i].create_info.usage ||
+            a[i].memory_block != b[i].memory_block ||
+            a[i].offset != b[i].offset)
+            return false;
+    }
+    return true;
+}
+
+bool Render_Graph::realize(const Render_Graph_Compiled& compiled) {
+    if (!realized_memory.empty() && same_layout(realized_layout, compiled.transient_images))
+        return false;
+    if (compiled.transient_images.empty() && realized_memory.empty())
+        return false;
+
+    release();
+
+    for (const Render_Graph_Memory_Block& block : compiled.memory_blocks) {
+        VkMemoryRequirements requirements{ block.size, block.alignment, block.memory_type_bits };
+        realized_memory.push_back(g_render_target_pool.acquire(requirements, Vk_Memory_Category::render_graph, "render graph memory block"));
+    }
+
+    realized_images.resize(images.size());
+    for (const Render_Graph_Transient_Image& transient_image : compiled.transient_images) {
+        Vk_Image& image = realized_images[transient_image.image];
+        VK_CHECK(vmaCreateAliasingImage2(vk.allocator, realized_memory[transient_image.memory_block],
+            transient_image.offset, &transient_image.create_info, &image.handle));
+        vk_set_debug_name(image.handle, images[transient_image.image].name);
+
+        VkImageViewCreateInfo create_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        create_info.image = image.handle;
+        create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        create_info.format = transient_image.create_info.format;
+        create_info.subresourceRange.aspectMask = is_depth_format(create_info.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        create_info.subresourceRange.levelCount = 1;
+        create_info.subresourceRange.layerCount = 1;
+        VK_CHECK(vkCreateImageView(vk.device, &create_info, nullptr, &image.view));
+        vk_set_debug_name(image.view, images[transient_image.image].name);
+    }
+    realized_layout = compiled.transient_images;
+    return true;
+}
+
+void Render_Graph::execute(VkCommandBuffer command_buffer, const Render_Graph_Compiled& compiled) {
+    Vk_Barrier_Batch batch;
+    auto cmd_barriers = [this, command_buffer, &batch](const std::vector<Render_Graph_Barrier>& barriers) {
+        for (const Render_Graph_Barrier& b : barriers) {
+            VkImageSubresourceRange subresource_range{};
+            subresource_range.aspectMask = is_depth_format(images[b.image].format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+            subresource_range.levelCount = VK_REMAINING_MIP_LEVELS;
+            subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
+            batch.image_subresource(get_image(b.image), subresource_range,
+                b.src_stage, b.src_access, b.old_layout, b.dst_stage, b.dst_access, b.new_layout);
+        }
+        batch.flush(command_buffer);
+    };
+
+    for (size_t i = 0; i < compiled.passes.size(); i++) {
+        const Render_Graph_Pass& pass = passes[compiled.passes[i]];
+        vk_begin_gpu_marker_scope(command_buffer, pass.name);
+        if (pass.time_interval)
+            pass.time_interval->begin(command_buffer);
+        cmd_barriers(compiled.barriers[i]);
+        if (pass.execute)
+            pass.execute(command_buffer);
+        if (pass.time_interval)
+            pass.time_interval->end(command_buffer);
+        vk_end_gpu_marker_scope(command_buffer);
+    }
+    cmd_barriers(compiled.final_barriers);
+}
+
+void Render_Graph::reset() {
+    images.clear();
+    passes.clear();
+}
+
+void Render_Graph::release() {
+    for (Vk_Image& image : realized_images)
+        vk_retire(image);
+    realized_images.clear();
+    for (VmaAllocation allocation : realized_memory)
+        g_render_target_pool.release(allocation);
+    realized_memory.clear();
+    realized_layout.clear();
+}
+
+VkImage Render_Graph::get_image(Render_Graph_Image image) const {
+    return images[image].imported ? images[image].image : realized_images[image].handle;
+}
+
+VkImageView Render_Graph::get_view(Render_Graph_Image image) const {
+    return images[image].imported ? images[image].view : realized_images[image].view;
+}
+
+VkMemoryRequirements vk_get_image_memory_requirements(const VkImageCreateInfo& create_info) {
+    VkDeviceImageMemoryRequirements info{ VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS };
+    info.pCreateInfo = &create_info;
+    VkMemoryRequirements2 requirements{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+    vkGetDeviceImageMemoryRequirements(vk.device, &info, &requirements);
+    return requirements.memoryRequirements;
+}
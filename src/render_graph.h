@@ -0,0 +1,168 @@
+#pragma once
+
+#include "vk.h"
+
+// Frame graph. Passes declare which images they read and write, compile() orders the surviving
+// passes, derives the layout transitions and memory dependencies between them and places transient
+// images with non-overlapping lifetimes into shared memory. compile() does not call Vulkan, so the
+// result can be checked on the CPU. realize() creates the transient images, execute() records barriers
+// and passes into the command buffer.
+//
+// The graph is declared from scratch every frame. Realized transient images are kept while the
+// compiled memory layout does not change.
+
+using Render_Graph_Image = uint32_t;
+
+// How a pass accesses an image.
+struct Render_Graph_Usage {
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+
+    static Render_Graph_Usage color_attachment() {
+        return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL };
+    }
+    static Render_Graph_Usage depth_attachment() {
+        return { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL };
+    }
+    // Depth test without depth writes.
+    static Render_Graph_Usage depth_attachment_read() {
+        return { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL };
+    }
+    static Render_Graph_Usage sampled(VkPipelineStageFlags2 stages) {
+        return { stages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    }
+    static Render_Graph_Usage storage_write(VkPipelineStageFlags2 stages) {
+        return { stages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+    }
+    static Render_Graph_Usage transfer_src(VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_COPY_BIT) {
+        return { stage, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+    }
+    static Render_Graph_Usage transfer_dst(VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_COPY_BIT) {
+        return { stage, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+    }
+};
+
+struct Render_Graph_Image_Desc {
+    const char* name = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+
+    // Imported images are owned outside of the graph (swapchain image, history).
+    // For them the graph starts from initial_usage and, if final_layout is set, ends with
+    // a transition to final_layout/final_usage.
+    bool imported = false;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Render_Graph_Usage initial_usage{};
+    Render_Graph_Usage final_usage{};
+};
+
+struct Render_Graph_Access {
+    Render_Graph_Image image;
+    Render_Graph_Usage usage;
+    bool write;
+};
+
+struct Render_Graph_Pass {
+    const char* name = nullptr;
+    std::vector<Render_Graph_Access> accesses;
+    // Passes with side effects (e.g. readback to host memory) are never culled.
+    bool side_effects = false;
+    std::function<void(VkCommandBuffer)> execute;
+    // Optional GPU time of the pass, measured inside its marker scope and including its barriers.
+    Vk_GPU_Time_Interval* time_interval = nullptr;
+
+    Render_Graph_Pass& timed(Vk_GPU_Time_Interval* interval) {
+        time_interval = interval;
+        return *this;
+    }
+
+    Render_Graph_Pass& read(Render_Graph_Image image, const Render_Graph_Usage& usage) {
+        accesses.push_back({ image, usage, false });
+        return *this;
+    }
+    Render_Graph_Pass& write(Render_Graph_Image image, const Render_Graph_Usage& usage) {
+        accesses.push_back({ image, usage, true });
+        return *this;
+    }
+};
+
+struct Render_Graph_Barrier {
+    Render_Graph_Image image;
+    VkPipelineStageFlags2 src_stage;
+    VkAccessFlags2 src_access;
+    VkImageLayout old_layout;
+    VkPipelineStageFlags2 dst_stage;
+    VkAccessFlags2 dst_access;
+    VkImageLayout new_layout;
+};
+
+struct Render_Graph_Transient_Image {
+    Render_Graph_Image image;
+    VkImageCreateInfo create_info;  // usage is collected from all accesses
+    uint32_t memory_block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t first_pass;            // lifetime, in indices of Render_Graph_Compiled::passes
+    uint32_t last_pass;
+};
+
+struct Render_Graph_Memory_Block {
+    uint32_t memory_type_bits;
+    VkDeviceSize alignment;
+    VkDeviceSize size;
+};
+
+struct Render_Graph_Compiled {
+    std::vector<uint32_t> passes;                               // surviving passes in execution order
+    std::vector<std::vector<Render_Graph_Barrier>> barriers;    // barriers[i] is issued before passes[i]
+    std::vector<Render_Graph_Barrier> final_barriers;           // imported images to their final layouts
+    std::vector<Render_Graph_Transient_Image> transient_images;
+    std::vector<Render_Graph_Memory_Block> memory_blocks;
+
+    uint32_t get_barrier_count() const;
+    VkDeviceSize get_transient_memory_size() const;             // with aliasing
+    VkDeviceSize get_transient_images_size() const;             // sum of all transient image sizes
+};
+
+using Render_Graph_Memory_Requirements_Func = std::function<VkMemoryRequirements(const VkImageCreateInfo&)>;
+
+struct Render_Graph {
+    Render_Graph_Image create_image(const Render_Graph_Image_Desc& desc);
+    Render_Graph_Image import_image(const Render_Graph_Image_Desc& desc);
+    Render_Graph_Pass& add_pass(const char* name, std::function<void(VkCommandBuffer)> execute);
+
+    // Pure CPU step. get_memory_requirements is called for every transient image that survives culling.
+    Render_Graph_Compiled compile(const Render_Graph_Memory_Requirements_Func& get_memory_requirements) const;
+
+    // Creates transient images for the compiled graph. Returns true if the images were (re)created,
+    // in this case descriptors that reference them have to be updated. Images from the previous layout
+    // are released.
+    bool realize(const Render_Graph_Compiled& compiled);
+    void execute(VkCommandBuffer command_buffer, const Render_Graph_Compiled& compiled);
+
+    // Clears declared images and passes, keeps realized images.
+    void reset();
+    // Retires realized images and returns their memory to g_render_target_pool, the frames in flight
+    // may still use them.
+    void release();
+
+    VkImage get_image(Render_Graph_Image image) const;
+    VkImageView get_view(Render_Graph_Image image) const;
+
+    std::vector<Render_Graph_Image_Desc> images;
+    std::vector<Render_Graph_Pass> passes;
+
+private:
+    std::vector<Vk_Image> realized_images;      // indexed by Render_Graph_Image, null for imported images
+    std::vector<VmaAllocation> realized_memory; // one allocation per memory block, from g_render_target_pool
+    std::vector<Render_Graph_Transient_Image> realized_layout;
+};
+
+// Memory requirements of transient images as reported by the device (vkGetDeviceImageMemoryRequirements).
+VkMemoryRequirements vk_get_image_memory_requirements(const VkImageCreateInfo& create_info);
@@ -0,0 +1,325 @@
+#include "render_graph.h"
+#include "lib.h"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+
+// Graph declaration and compile(). Nothing here calls Vulkan, the render graph test links this
+// file without a device.
+
+struct Render_Graph_Image_State {
+    VkImageLayout layout;
+    VkPipelineStageFlags2 write_stage;  // last write (or layout transition) that later accesses depend on
+    VkAccessFlags2 write_access;
+    VkPipelineStageFlags2 read_stages;  // reads since the last write, for write-after-read dependencies
+    VkPipelineStageFlags2 visible_stages; // stages/accesses that already see the last write
+    VkAccessFlags2 visible_access;
+};
+
+constexpr VkAccessFlags2 write_access_mask =
+    VK_ACCESS_2_SHADER_WRITE_BIT |
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT |
+    VK_ACCESS_2_HOST_WRITE_BIT |
+    VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+static VkImageUsageFlags get_image_usage(VkAccessFlags2 access) {
+    VkImageUsageFlags usage = 0;
+    if (access & VK_ACCESS_2_SHADER_SAMPLED_READ_BIT)
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (access & (VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT))
+        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    if (access & (VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT))
+        usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (access & (VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT))
+        usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (access & VK_ACCESS_2_TRANSFER_READ_BIT)
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    if (access & VK_ACCESS_2_TRANSFER_WRITE_BIT)
+        usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    return usage;
+}
+
+// Accesses of a pass with several accesses to the same image merged into one.
+static std::vector<Render_Graph_Access> merge_accesses(const Render_Graph_Pass& pass) {
+    std::vector<Render_Graph_Access> merged;
+    for (const Render_Graph_Access& access : pass.accesses) {
+        auto it = std::find_if(merged.begin(), merged.end(),
+            [&access](const Render_Graph_Access& a) { return a.image == access.image; });
+        if (it == merged.end()) {
+            merged.push_back(access);
+            continue;
+        }
+        if (it->usage.layout != access.usage.layout)
+            error(std::string("Render graph: pass ") + pass.name + " uses an image in two different layouts");
+        it->usage.stage |= access.usage.stage;
+        it->usage.access |= access.usage.access;
+        it->write |= access.write;
+    }
+    return merged;
+}
+
+uint32_t Render_Graph_Compiled::get_barrier_count() const {
+    uint32_t count = uint32_t(final_barriers.size());
+    for (const std::vector<Render_Graph_Barrier>& pass_barriers : barriers)
+        count += uint32_t(pass_barriers.size());
+    return count;
+}
+
+VkDeviceSize Render_Graph_Compiled::get_transient_memory_size() const {
+    VkDeviceSize size = 0;
+    for (const Render_Graph_Memory_Block& block : memory_blocks)
+        size += block.size;
+    return size;
+}
+
+VkDeviceSize Render_Graph_Compiled::get_transient_images_size() const {
+    VkDeviceSize size = 0;
+    for (const Render_Graph_Transient_Image& transient_image : transient_images)
+        size += transient_image.size;
+    return size;
+}
+
+Render_Graph_Image Render_Graph::create_image(const Render_Graph_Image_Desc& desc) {
+    images.push_back(desc);
+    images.back().imported = false;
+    return Render_Graph_Image(images.size() - 1);
+}
+
+Render_Graph_Image Render_Graph::import_image(const Render_Graph_Image_Desc& desc) {
+    images.push_back(desc);
+    images.back().imported = true;
+    return Render_Graph_Image(images.size() - 1);
+}
+
+Render_Graph_Pass& Render_Graph::add_pass(const char* name, std::function<void(VkCommandBuffer)> execute) {
+    Render_Graph_Pass& pass = passes.emplace_back();
+    pass.name = name;
+    pass.execute = std::move(execute);
+    return pass;
+}
+
+Render_Graph_Compiled Render_Graph::compile(const Render_Graph_Memory_Requirements_Func& get_memory_requirements) const {
+    Render_Graph_Compiled compiled;
+
+    std::vector<std::vector<Render_Graph_Access>> pass_accesses(passes.size());
+    for (size_t i = 0; i < passes.size(); i++)
+        pass_accesses[i] = merge_accesses(passes[i]);
+
+    // Cull passes that contribute neither to imported images nor to side effects. Writes do not end
+    // the liveness of an image, so all earlier writers of a partially overwritten image are kept.
+    {
+        std::vector<bool> live_images(images.size());
+        std::vector<bool> live_passes(passes.size());
+        for (size_t i = passes.size(); i-- > 0;) {
+            bool live = passes[i].side_effects;
+            for (const Render_Graph_Access& access : pass_accesses[i]) {
+                if (access.write && (images[access.image].imported || live_images[access.image]))
+                    live = true;
+            }
+            if (!live)
+                continue;
+            live_passes[i] = true;
+            for (const Render_Graph_Access& access : pass_accesses[i])
+                live_images[access.image] = true;
+        }
+        for (uint32_t i = 0; i < uint32_t(passes.size()); i++) {
+            if (live_passes[i])
+                compiled.passes.push_back(i);
+        }
+    }
+
+    // Lifetimes of transient images and their last usage, which the next occupant of the memory waits for.
+    const uint32_t no_pass = ~0u;
+    std::vector<uint32_t> first_pass(images.size(), no_pass);
+    std::vector<uint32_t> last_pass(images.size(), no_pass);
+    std::vector<VkImageUsageFlags> image_usage(images.size());
+    std::vector<Render_Graph_Usage> last_usage(images.size());
+    for (uint32_t i = 0; i < uint32_t(compiled.passes.size()); i++) {
+        for (const Render_Graph_Access& access : pass_accesses[compiled.passes[i]]) {
+            if (first_pass[access.image] == no_pass)
+                first_pass[access.image] = i;
+            if (last_pass[access.image] != i)
+                last_usage[access.image] = Render_Graph_Usage{};
+            last_pass[access.image] = i;
+            last_usage[access.image].stage |= access.usage.stage;
+            last_usage[access.image].access |= access.usage.access;
+            image_usage[access.image] |= get_image_usage(access.usage.access);
+        }
+    }
+
+    // Place transient images into memory blocks. Larger images go first, each one at the lowest
+    // offset that does not overlap an image whose lifetime intersects with its own.
+    std::vector<uint32_t> transient_index(images.size(), no_pass);
+    {
+        std::vector<Render_Graph_Transient_Image> transient_images;
+        std::vector<uint32_t> memory_type_bits;
+        for (Render_Graph_Image image = 0; image < uint32_t(images.size()); image++) {
+            if (images[image].imported || first_pass[image] == no_pass)
+                continue;
+
+            Render_Graph_Transient_Image transient_image{};
+            transient_image.image = image;
+            VkImageCreateInfo& create_info = transient_image.create_info;
+            create_info = VkImageCreateInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+            create_info.imageType = VK_IMAGE_TYPE_2D;
+            create_info.format = images[image].format;
+            create_info.extent = { images[image].width, images[image].height, 1 };
+            create_info.mipLevels = 1;
+            create_info.arrayLayers = 1;
+            create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+            create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            create_info.usage = image_usage[image];
+            create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            transient_image.first_pass = first_pass[image];
+            transient_image.last_pass = last_pass[image];
+
+            VkMemoryRequirements requirements = get_memory_requirements(create_info);
+            transient_image.size = requirements.size;
+            transient_image.offset = requirements.alignment; // temporarily holds alignment
+            transient_images.push_back(transient_image);
+            memory_type_bits.push_back(requirements.memoryTypeBits);
+        }
+
+        std::vector<uint32_t> order(transient_images.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&transient_images](uint32_t a, uint32_t b) {
+            return transient_images[a].size > transient_images[b].size;
+        });
+
+        std::vector<uint32_t> placed;
+        for (uint32_t index : order) {
+            Render_Graph_Transient_Image& transient_image = transient_images[index];
+            const VkDeviceSize alignment = transient_image.offset;
+
+            uint32_t block = 0;
+            while (block < compiled.memory_blocks.size() && !(compiled.memory_blocks[block].memory_type_bits & memory_type_bits[index]))
+                block++;
+            if (block == compiled.memory_blocks.size())
+                compiled.memory_blocks.push_back({ memory_type_bits[index], 1, 0 });
+
+            // Candidate offsets are the start of the block and the ends of conflicting images.
+            std::vector<const Render_Graph_Transient_Image*> conflicts;
+            for (uint32_t other_index : placed) {
+                const Render_Graph_Transient_Image& other = transient_images[other_index];
+                if (other.memory_block == block &&
+                    other.first_pass <= transient_image.last_pass && transient_image.first_pass <= other.last_pass)
+                    conflicts.push_back(&other);
+            }
+            VkDeviceSize offset = 0;
+            for (bool moved = true; moved;) {
+                moved = false;
+                offset = round_up(offset, alignment);
+                for (const Render_Graph_Transient_Image* other : conflicts) {
+                    if (offset < other->offset + other->size && other->offset < offset + transient_image.size) {
+                        offset = other->offset + other->size;
+                        moved = true;
+                        break;
+                    }
+                }
+            }
+
+            Render_Graph_Memory_Block& memory_block = compiled.memory_blocks[block];
+            memory_block.memory_type_bits &= memory_type_bits[index];
+            memory_block.alignment = std::max(memory_block.alignment, alignment);
+            memory_block.size = std::max(memory_block.size, offset + transient_image.size);
+            transient_image.memory_block = block;
+            transient_image.offset = offset;
+            placed.push_back(index);
+        }
+
+        compiled.transient_images = std::move(transient_images);
+        for (uint32_t i = 0; i < uint32_t(compiled.transient_images.size()); i++)
+            transient_index[compiled.transient_images[i].image] = i;
+    }
+
+    // Initial states. A transient image starts undefined and waits for every image that shares its
+    // memory: those used earlier in this frame and itself and later ones from the previous frame.
+    std::vector<Render_Graph_Image_State> states(images.size());
+    for (Render_Graph_Image image = 0; image < uint32_t(images.size()); image++) {
+        Render_Graph_Image_State& state = states[image];
+        if (images[image].imported) {
+            const Render_Graph_Usage& initial = images[image].initial_usage;
+            state = Render_Graph_Image_State{ initial.layout, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, initial.stage, initial.stage, initial.access };
+            continue;
+        }
+        if (transient_index[image] == no_pass)
+            continue;
+
+        const Render_Graph_Transient_Image& transient_image = compiled.transient_images[transient_index[image]];
+        state = Render_Graph_Image_State{ VK_IMAGE_LAYOUT_UNDEFINED };
+        for (const Render_Graph_Transient_Image& other : compiled.transient_images) {
+            if (other.memory_block == transient_image.memory_block &&
+                other.offset < transient_image.offset + transient_image.size &&
+                transient_image.offset < other.offset + other.size)
+            {
+                state.write_stage |= last_usage[other.image].stage;
+                state.write_access |= last_usage[other.image].access & write_access_mask;
+            }
+        }
+    }
+
+    auto transition = [&states](Render_Graph_Image image, const Render_Graph_Usage& usage, bool write) {
+        Render_Graph_Image_State& state = states[image];
+        Render_Graph_Barrier barrier{ image };
+        barrier.old_layout = state.layout;
+        barrier.new_layout = usage.layout;
+        barrier.dst_stage = usage.stage;
+        barrier.dst_access = usage.access;
+
+        if (state.layout != usage.layout || write) {
+            barrier.src_stage = state.write_stage | state.read_stages;
+            barrier.src_access = state.write_access;
+            // The layout transition counts as a write that later accesses have to wait for.
+            state = Render_Graph_Image_State{ usage.layout, usage.stage, usage.access & write_access_mask,
+                VK_PIPELINE_STAGE_2_NONE, usage.stage, usage.access };
+            if (!write)
+                state.read_stages = usage.stage;
+            return std::optional<Render_Graph_Barrier>(barrier);
+        }
+
+        // Read in the current layout: only wait if the last write is not yet visible to this access.
+        std::optional<Render_Graph_Barrier> result;
+        if (state.write_stage != VK_PIPELINE_STAGE_2_NONE &&
+            ((usage.stage & ~state.visible_stages) || (usage.access & ~state.visible_access)))
+        {
+            barrier.src_stage = state.write_stage;
+            barrier.src_access = state.write_access;
+            state.visible_stages |= usage.stage;
+            state.visible_access |= usage.access;
+            result = barrier;
+        }
+        state.read_stages |= usage.stage;
+        return result;
+    };
+
+    compiled.barriers.resize(compiled.passes.size());
+    for (size_t i = 0; i < compiled.passes.size(); i++) {
+        for (const Render_Graph_Access& access : pass_accesses[compiled.passes[i]]) {
+            if (auto barrier = transition(access.image, access.usage, access.write))
+                compiled.barriers[i].push_back(*barrier);
+        }
+    }
+
+    for (Render_Graph_Image image = 0; image < uint32_t(images.size()); image++) {
+        const Render_Graph_Image_Desc& desc = images[image];
+        if (!desc.imported || desc.final_usage.layout == VK_IMAGE_LAYOUT_UNDEFINED)
+            continue;
+        const Render_Graph_Image_State& state = states[image];
+        if (state.layout == desc.final_usage.layout && state.write_stage == VK_PIPELINE_STAGE_2_NONE)
+            continue;
+        Render_Graph_Barrier barrier{ image };
+        barrier.src_stage = state.write_stage | state.read_stages;
+        barrier.src_access = state.write_access;
+        barrier.old_layout = state.layout;
+        barrier.dst_stage = desc.final_usage.stage;
+        barrier.dst_access = desc.final_usage.access;
+        barrier.new_layout = desc.final_usage.layout;
+        compiled.final_barriers.push_back(barrier);
+    }
+    return compiled;
+}
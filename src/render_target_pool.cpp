@@ -0,0 +1,134 @@
+#include "render_target_pool.h"
+#include "render_graph.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+Render_Target_Pool g_render_target_pool;
+
+// Released memory may be accessed by the frame that was recorded when it was released
+// and by the frame before it.
+constexpr uint32_t frames_in_flight = 2;
+
+VkDeviceSize render_target_size_class(VkDeviceSize size) {
+    const VkDeviceSize min_size = 64 * 1024;
+    if (size <= min_size)
+        return min_size;
+    const VkDeviceSize step = std::bit_floor(size) / 4;
+    return (size + step - 1) / step * step;
+}
+
+void Render_Target_Pool::shutdown() {
+    assert(used_allocations.empty());
+    for (const Free_Allocation& free_allocation : free_allocations) {
+        vk_untrack_allocation(free_allocation.allocation);
+        vmaFreeMemory(vk.allocator, free_allocation.allocation);
+    }
+    free_allocations.clear();
+}
+
+void Render_Target_Pool::collect() {
+    auto expired = std::stable_partition(free_allocations.begin(), free_allocations.end(),
+        [this](const Free_Allocation& free_allocation) { return vk.frame_number - free_allocation.release_frame <= grace_frames; });
+    for (auto it = expired; it != free_allocations.end(); ++it) {
+        vk_untrack_allocation(it->allocation);
+        vmaFreeMemory(vk.allocator, it->allocation);
+        expired_count++;
+    }
+    free_allocations.erase(expired, free_allocations.end());
+}
+
+VmaAllocation Render_Target_Pool::acquire(const VkMemoryRequirements& requirements, Vk_Memory_Category category, const char* name) {
+    const Key key{ requirements.memoryTypeBits, requirements.alignment, render_target_size_class(requirements.size) };
+
+    auto it = std::find_if(free_allocations.begin(), free_allocations.end(), [&key](const Free_Allocation& free_allocation) {
+        return free_allocation.key == key && vk.frame_number - free_allocation.release_frame >= frames_in_flight;
+    });
+    VmaAllocation allocation;
+    if (it != free_allocations.end()) {
+        allocation = it->allocation;
+        free_allocations.erase(it);
+        vk_untrack_allocation(allocation);
+        hit_count++;
+    }
+    else {
+        VkMemoryRequirements class_requirements = requirements;
+        class_requirements.size = key.size;
+        VmaAllocationCreateInfo alloc_create_info{};
+        alloc_create_info.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        VK_CHECK(vmaAllocateMemory(vk.allocator, &class_requirements, &alloc_create_info, &allocation, nullptr));
+        miss_count++;
+    }
+    vk_track_allocation(allocation, category, name);
+    used_allocations.emplace(allocation, key);
+    return allocation;
+}
+
+void Render_Target_Pool::release(VmaAllocation allocation) {
+    auto it = used_allocations.find(allocation);
+    assert(it != used_allocations.end());
+    vk_untrack_allocation(allocation);
+    vk_track_allocation(allocation, Vk_Memory_Category::render_target_pool, "render target pool");
+    free_allocations.push_back({ it->second, allocation, vk.frame_number });
+    used_allocations.erase(it);
+}
+
+Vk_Image Render_Target_Pool::create_image(int width, int height, VkFormat format, VkImageUsageFlags usage_flags, const char* name) {
+    VkImageCreateInfo create_info{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    create_info.imageType = VK_IMAGE_TYPE_2D;
+    create_info.format = format;
+    create_info.extent.width = width;
+    create_info.extent.height = height;
+    create_info.extent.depth = 1;
+    create_info.mipLevels = 1;
+    create_info.arrayLayers = 1;
+    create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    create_info.usage = usage_flags;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    Vk_Image image;
+    image.allocation = acquire(vk_get_image_memory_requirements(create_info), Vk_Memory_Category::image, name);
+    VK_CHECK(vmaCreateAliasingImage2(vk.allocator, image.allocation, 0, &create_info, &image.handle));
+    vk_set_debug_name(image.handle, name);
+
+    VkImageViewCreateInfo view_create_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    view_create_info.image = image.handle;
+    view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_create_info.format = format;
+    view_create_info.subresourceRange.aspectMask = (usage_flags & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        ? VK_IMAGE_ASPECT_DEPTH_BIT
+        : VK_IMAGE_ASPECT_COLOR_BIT;
+    view_create_info.subresourceRange.levelCount = 1;
+    view_create_info.subresourceRange.layerCount = 1;
+    VK_CHECK(vkCreateImageView(vk.device, &view_create_info, nullptr, &image.view));
+    vk_set_debug_name(image.view, name);
+    return image;
+}
+
+void Render_Target_Pool::destroy_image(Vk_Image& image) {
+    if (image.handle == VK_NULL_HANDLE)
+        return;
+    const VmaAllocation allocation = image.allocation;
+    vk_retire([handle = image.handle, view = image.view]() {
+        vkDestroyImageView(vk.device, view, nullptr);
+        vkDestroyImage(vk.device, handle, nullptr);
+    });
+    release(allocation);
+    image = Vk_Image{};
+}
+
+Render_Target_Pool_Stats Render_Target_Pool::get_stats() const {
+    Render_Target_Pool_Stats stats{};
+    stats.hits = hit_count;
+    stats.misses = miss_count;
+    stats.expired = expired_count;
+    stats.free_count = uint32_t(free_allocations.size());
+    for (const Free_Allocation& free_allocation : free_allocations)
+        stats.free_bytes += free_allocation.key.size;
+    for (const auto& [allocation, key] : used_allocations)
+        stats.used_bytes += key.size;
+    return stats;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "vk.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Device local memory for resolution dependent images: the render graph's memory blocks and the
+// history image. Released memory is kept in a free list and handed out again for requests with
+// the same memory type bits, alignment and size class (which is what format, usage and extent
+// come down to), so resizes reuse memory instead of going through VMA every time.
+//
+// Released memory is reused only after the frames in flight that could access it have finished.
+// Free memory that is not reused for grace_frames frames is returned to VMA by collect().
+struct Render_Target_Pool_Stats {
+    uint64_t hits;              // requests served from the free list
+    uint64_t misses;            // new VMA allocations
+    uint64_t expired;           // free allocations returned to VMA after the grace period
+    uint32_t free_count;
+    VkDeviceSize free_bytes;
+    VkDeviceSize used_bytes;
+};
+
+struct Render_Target_Pool {
+    uint32_t grace_frames = 300;
+
+    // Frees all memory. The device must be idle and all images must be destroyed.
+    void shutdown();
+    // Called once per frame after vk_begin_frame.
+    void collect();
+
+    // The allocation is at least requirements.size bytes (rounded up to the size class).
+    VmaAllocation acquire(const VkMemoryRequirements& requirements, Vk_Memory_Category category, const char* name);
+    // The memory may still be used by the frames in flight.
+    void release(VmaAllocation allocation);
+
+    // Same as vk_create_image but the memory comes from the pool. Destroy with destroy_image,
+    // not with Vk_Image::destroy.
+    Vk_Image create_image(int width, int height, VkFormat format, VkImageUsageFlags usage_flags, const char* name);
+    // The image and the view are retired with vk_retire, the memory is released to the pool.
+    void destroy_image(Vk_Image& image);
+
+    Render_Target_Pool_Stats get_stats() const;
+
+private:
+    struct Key {
+        uint32_t memory_type_bits;
+        VkDeviceSize alignment;
+        VkDeviceSize size; // size class
+        bool operator==(const Key&) const = default;
+    };
+    struct Free_Allocation {
+        Key key;
+        VmaAllocation allocation;
+        uint32_t release_frame; // vk.frame_number
+    };
+
+    std::vector<Free_Allocation> free_allocations;
+    std::unordered_map<VmaAllocation, Key> used_allocations;
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+    uint64_t expired_count = 0;
+};
+
+// Pool shared by the render graph and the demo.
+extern Render_Target_Pool g_render_target_pool;
+
+// Rounds size up to the next of 1, 1.25, 1.5 and 1.75 times a power of two (at least 64 KB),
+// so at most 25% of an allocation is unused.
+VkDeviceSize render_target_size_class(VkDeviceSize size);
@@ -0,0 +1,225 @@
+#include "screenshot_writer.h"
+#include "profiler.h"
+
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCREENSHOT_WRITER_SSE2
+#endif
+
+void convert_bgra_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixel_count) {
+    size_t i = 0;
+#ifdef SCREENSHOT_WRITER_SSE2
+    const __m128i green_alpha_mask = _mm_set1_epi32(0xff00ff00);
+    const __m128i low_byte_mask = _mm_set1_epi32(0x000000ff);
+    for (; i + 4 <= pixel_count; i += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i green_alpha = _mm_and_si128(p, green_alpha_mask);
+        __m128i red = _mm_and_si128(_mm_srli_epi32(p, 16), low_byte_mask);
+        __m128i blue = _mm_slli_epi32(_mm_and_si128(p, low_byte_mask), 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(green_alpha, _mm_or_si128(red, blue)));
+    }
+#endif
+    for (; i < pixel_count; i++) {
+        uint32_t p;
+        memcpy(&p, src + i * 4, 4);
+        p = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+        memcpy(dst + i * 4, &p, 4);
+    }
+}
+
+// Fixed point with 8 fractional bits.
+void convert_bgra_to_yuv420(const uint8_t* src, uint32_t src_width, uint32_t width, uint32_t height, uint8_t* dst) {
+    uint8_t* y_plane = dst;
+    uint8_t* u_plane = dst + size_t(width) * height;
+    uint8_t* v_plane = u_plane + size_t(width / 2) * (height / 2);
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        for (uint32_t x = 0; x < width; x += 2) {
+            int sum_r = 0, sum_g = 0, sum_b = 0;
+            for (uint32_t k = 0; k < 4; k++) {
+                const uint32_t px = x + (k & 1);
+                const uint32_t py = y + (k >> 1);
+                const uint8_t* p = src + (size_t(py) * src_width + px) * 4;
+                const int b = p[0], g = p[1], r = p[2];
+                y_plane[size_t(py) * width + px] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+                sum_r += r;
+                sum_g += g;
+                sum_b += b;
+            }
+            const int r = sum_r / 4, g = sum_g / 4, b = sum_b / 4;
+            const size_t chroma_index = size_t(y / 2) * (width / 2) + x / 2;
+            u_plane[chroma_index] = uint8_t(std::clamp((-43 * r - 85 * g + 128 * b + 128) / 256 + 128, 0, 255));
+            v_plane[chroma_index] = uint8_t(std::clamp((128 * r - 107 * g - 21 * b + 128) / 256 + 128, 0, 255));
+        }
+    }
+}
+
+std::vector<uint8_t> encode_qoi(const uint8_t* rgba, uint32_t width, uint32_t height) {
+    std::vector<uint8_t> out;
+    out.reserve(14 + size_t(width) * height * 2 + 8);
+    auto put_u32 = [&out](uint32_t v) {
+        out.push_back(uint8_t(v >> 24));
+        out.push_back(uint8_t(v >> 16));
+        out.push_back(uint8_t(v >> 8));
+        out.push_back(uint8_t(v));
+    };
+    out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+    put_u32(width);
+    put_u32(height);
+    out.push_back(4); // channels
+    out.push_back(0); // sRGB with linear alpha
+
+    uint8_t index[64][4]{};
+    uint8_t prev[4] = { 0, 0, 0, 255 };
+    uint32_t run = 0;
+    const size_t pixel_count = size_t(width) * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* px = rgba + i * 4;
+        if (memcmp(px, prev, 4) == 0) {
+            run++;
+            if (run == 62 || i == pixel_count - 1) {
+                out.push_back(uint8_t(0xc0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(uint8_t(0xc0 | (run - 1)));
+            run = 0;
+        }
+        const uint32_t hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (memcmp(index[hash], px, 4) == 0) {
+            out.push_back(uint8_t(hash));
+        }
+        else {
+            memcpy(index[hash], px, 4);
+            if (px[3] == prev[3]) {
+                const int8_t vr = int8_t(px[0] - prev[0]);
+                const int8_t vg = int8_t(px[1] - prev[1]);
+                const int8_t vb = int8_t(px[2] - prev[2]);
+                const int8_t vg_r = int8_t(vr - vg);
+                const int8_t vg_b = int8_t(vb - vg);
+                if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                    out.push_back(uint8_t(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                }
+                else if (vg >= -32 && vg <= 31 && vg_r >= -8 && vg_r <= 7 && vg_b >= -8 && vg_b <= 7) {
+                    out.push_back(uint8_t(0x80 | (vg + 32)));
+                    out.push_back(uint8_t((vg_r + 8) << 4 | (vg_b + 8)));
+                }
+                else {
+                    out.insert(out.end(), { uint8_t(0xfe), px[0], px[1], px[2] });
+                }
+            }
+            else {
+                out.insert(out.end(), { uint8_t(0xff), px[0], px[1], px[2], px[3] });
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return out;
+}
+
+void Screenshot_Writer::shutdown() {
+    close_stream();
+}
+
+void Screenshot_Writer::submit(const std::string& file_name, Image_File_Format format, uint32_t width, uint32_t height,
+    const uint8_t* bgra_pixels, std::function<void()> pixels_released)
+{
+    auto job = std::make_shared<Job>(Job{ file_name, format, width, height, bgra_pixels, std::move(pixels_released), {} });
+    Job_Handle convert = g_job_system.run([job] { write_image(*job); });
+    std::erase_if(jobs, [](const Job_Handle& handle) { return g_job_system.is_finished(handle); });
+    jobs.push_back(convert);
+    // Frames are converted in parallel and appended in submission order.
+    if (format == Image_File_Format::y4m) {
+        last_stream_frame = g_job_system.run([this, job] { write_stream_frame(*job); }, { convert, last_stream_frame });
+        jobs.push_back(last_stream_frame);
+    }
+}
+
+void Screenshot_Writer::wait_idle() {
+    for (const Job_Handle& job : jobs)
+        g_job_system.wait(job);
+    jobs.clear();
+}
+
+void Screenshot_Writer::close_stream() {
+    wait_idle();
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    if (stream_file) {
+        fclose(stream_file);
+        printf("Frame capture: %llu frames written to %s\n", (unsigned long long)stream_written, stream_file_name.c_str());
+    }
+    last_stream_frame = nullptr;
+    stream_file = nullptr;
+    stream_file_name.clear();
+    stream_written = 0;
+}
+
+void Screenshot_Writer::write_stream_frame(const Job& job) {
+    PROFILE_ZONE("Write y4m frame");
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    const uint32_t width = job.width & ~1u;
+    const uint32_t height = job.height & ~1u;
+    if (stream_file && stream_file_name != job.file_name) {
+        fclose(stream_file);
+        stream_file = nullptr;
+    }
+    if (!stream_file) {
+        stream_file = fopen(job.file_name.c_str(), "wb");
+        if (!stream_file) {
+            printf("Frame capture: failed to open %s\n", job.file_name.c_str());
+            return;
+        }
+        stream_file_name = job.file_name;
+        stream_width = width;
+        stream_height = height;
+        fprintf(stream_file, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C420jpeg\n", width, height);
+    }
+    if (width != stream_width || height != stream_height) {
+        printf("Frame capture: %ux%u frame does not match the %ux%u stream, skipped\n", width, height, stream_width, stream_height);
+        return;
+    }
+    fputs("FRAME\n", stream_file);
+    fwrite(job.pixels.data(), 1, job.pixels.size(), stream_file);
+    stream_written++;
+}
+
+// Converts the pixels and writes png and qoi files. y4m frames keep the converted pixels for write_stream_frame.
+void Screenshot_Writer::write_image(Job& job) {
+    if (job.format == Image_File_Format::y4m) {
+        PROFILE_ZONE("Convert frame to YUV");
+        const uint32_t width = job.width & ~1u;
+        const uint32_t height = job.height & ~1u;
+        job.pixels.resize(size_t(width) * height * 3 / 2);
+        convert_bgra_to_yuv420(job.bgra_pixels, job.width, width, height, job.pixels.data());
+    }
+    else {
+        PROFILE_ZONE("Convert frame to RGBA");
+        job.pixels.resize(size_t(job.width) * job.height * 4);
+        convert_bgra_to_rgba(job.bgra_pixels, job.pixels.data(), size_t(job.width) * job.height);
+    }
+    if (job.pixels_released)
+        job.pixels_released();
+
+    if (job.format == Image_File_Format::png) {
+        PROFILE_ZONE("Encode png");
+        if (!stbi_write_png(job.file_name.c_str(), job.width, job.height, 4, job.pixels.data(), int(job.width * 4)))
+            printf("Failed to write %s\n", job.file_name.c_str());
+    }
+    else if (job.format == Image_File_Format::qoi) {
+        PROFILE_ZONE("Encode qoi");
+        const std::vector<uint8_t> qoi = encode_qoi(job.pixels.data(), job.width, job.height);
+        FILE* file = fopen(job.file_name.c_str(), "wb");
+        if (!file || fwrite(qoi.data(), 1, qoi.size(), file) != qoi.size())
+            printf("Failed to write %s\n", job.file_name.c_str());
+        if (file)
+            fclose(file);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "job_system.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class Image_File_Format {
+    png,
+    qoi,    // fast lossless, https://qoiformat.org
+    y4m,    // uncompressed YUV 4:2:0 video stream, all frames go into one file
+};
+
+// Converts BGRA8 images and writes them to disk on g_job_system. submit, wait_idle and
+// close_stream are called from one thread.
+struct Screenshot_Writer {
+    // Writes all submitted images before it returns.
+    void shutdown();
+
+    // bgra_pixels must stay valid until pixels_released is called on a job system thread, which
+    // happens after the pixels are converted and before the image is compressed.
+    // y4m frames are appended to file_name in submission order, the frame size has to stay
+    // the same while the stream is open.
+    void submit(const std::string& file_name, Image_File_Format format, uint32_t width, uint32_t height,
+        const uint8_t* bgra_pixels, std::function<void()> pixels_released);
+    // Waits until all submitted images are written.
+    void wait_idle();
+    // Closes the y4m stream, the next y4m frame starts a new file.
+    void close_stream();
+
+private:
+    struct Job {
+        std::string file_name;
+        Image_File_Format format;
+        uint32_t width;
+        uint32_t height;
+        const uint8_t* bgra_pixels;
+        std::function<void()> pixels_released;
+        std::vector<uint8_t> pixels; // converted, RGBA or YUV for y4m
+    };
+
+    static void write_image(Job& job);
+    void write_stream_frame(const Job& job);
+
+    std::vector<Job_Handle> jobs; // not waited for yet
+
+    // y4m stream. Each frame is written by a job that depends on the job of the previous frame.
+    std::mutex stream_mutex;
+    Job_Handle last_stream_frame;
+    FILE* stream_file = nullptr;
+    std::string stream_file_name;
+    uint32_t stream_width = 0;
+    uint32_t stream_height = 0;
+    uint64_t stream_written = 0;
+};
+
+// Swaps red and blue channels of 8-bit 4-channel pixels.
+void convert_bgra_to_rgba(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+// Full range BT.601 Y plane followed by U and V planes subsampled 2x2. width and height must be even,
+// src_width is the row length of the source image in pixels.
+void convert_bgra_to_yuv420(const uint8_t* src, uint32_t src_width, uint32_t width, uint32_t height, uint8_t* dst);
+std::vector<uint8_t> encode_qoi(const uint8_t* rgba, uint32_t width, uint32_t height);
@@ -0,0 +1,111 @@
+#include "shader_reloader.h"
+#include "profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef SHADER_COMPILER
+#define SHADER_COMPILER "glslangValidator"
+#endif
+#ifndef SHADER_OPTIMIZER
+#define SHADER_OPTIMIZER "spirv-opt"
+#endif
+
+constexpr std::chrono::milliseconds poll_interval{ 250 };
+
+void Shader_Reloader::initialize(const std::string& source_directory, const std::string& spirv_directory) {
+    this->source_directory = source_directory;
+    this->spirv_directory = spirv_directory;
+
+    // Sources that are unchanged since the start are expected to match the SPIR-V built by CMake.
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(this->source_directory, ec)) {
+        if (entry.path().extension() == ".glsl")
+            write_times[entry.path().string()] = entry.last_write_time(ec);
+    }
+    if (ec)
+        printf("Shader hot-reload: failed to read %s\n", source_directory.c_str());
+    else
+        printf("Shader hot-reload: watching %s\n", source_directory.c_str());
+
+    thread = std::thread(&Shader_Reloader::watch_loop, this);
+}
+
+void Shader_Reloader::shutdown() {
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    stop_requested.notify_one();
+    thread.join();
+}
+
+std::vector<std::string> Shader_Reloader::take_rebuilt_shaders() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::move(rebuilt_shaders);
+}
+
+void Shader_Reloader::watch_loop() {
+    profiler_set_thread_name("Shader reloader");
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stop_requested.wait_for(lock, poll_interval, [this] { return stop; }))
+                return;
+        }
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(source_directory, ec)) {
+            if (entry.path().extension() != ".glsl")
+                continue;
+            std::filesystem::file_time_type write_time = entry.last_write_time(ec);
+            if (ec)
+                continue;
+            auto& known_write_time = write_times[entry.path().string()];
+            if (known_write_time == write_time)
+                continue;
+            known_write_time = write_time;
+
+            if (compile(entry.path())) {
+                std::lock_guard<std::mutex> lock(mutex);
+                rebuilt_shaders.push_back(entry.path().stem().string());
+            }
+        }
+    }
+}
+
+// The compiler writes into a temporary file, so a failed build does not replace working SPIR-V
+// and the renderer never sees a partially written file.
+bool Shader_Reloader::compile(const std::filesystem::path& source_file) {
+    const std::filesystem::path spirv_file = spirv_directory / (source_file.stem().string() + ".spv");
+    const std::filesystem::path unoptimized_file = spirv_directory / (source_file.stem().string() + ".spv.unoptimized");
+    const std::filesystem::path temp_file = spirv_directory / (source_file.stem().string() + ".spv.tmp");
+
+    std::string compile_command = "\"" SHADER_COMPILER "\" \"" + source_file.string() +
+        "\" -V --target-env vulkan1.2 -o \"" + unoptimized_file.string() + "\"";
+    std::string optimize_command = "\"" SHADER_OPTIMIZER "\" \"" + unoptimized_file.string() +
+        "\" -O --strip-debug -o \"" + temp_file.string() + "\"";
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes of the command line.
+    compile_command = "\"" + compile_command + "\"";
+    optimize_command = "\"" + optimize_command + "\"";
+#endif
+
+    PROFILE_ZONE("Compile shader");
+    printf("Shader hot-reload: compiling %s\n", source_file.filename().string().c_str());
+    bool success = std::system(compile_command.c_str()) == 0 && std::system(optimize_command.c_str()) == 0;
+
+    std::error_code ec;
+    if (success) {
+        std::filesystem::rename(temp_file, spirv_file, ec);
+        success = !ec;
+    }
+    std::filesystem::remove(unoptimized_file, ec);
+    std::filesystem::remove(temp_file, ec);
+    if (!success)
+        printf("Shader hot-reload: failed to build %s, keeping the previous version\n", source_file.filename().string().c_str());
+    return success;
+}
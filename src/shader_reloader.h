@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Development mode helper. Watches GLSL sources and rebuilds SPIR-V of the changed files on
+// a background thread with the same tools as the add_shader CMake function (glslangValidator
+// and spirv-opt from the Vulkan SDK). The renderer polls for rebuilt shaders once per frame.
+struct Shader_Reloader {
+    void initialize(const std::string& source_directory, const std::string& spirv_directory);
+    void shutdown();
+
+    // Names of the shaders without extension (e.g. "postprocess.frag") whose SPIR-V was
+    // successfully rebuilt since the previous call.
+    std::vector<std::string> take_rebuilt_shaders();
+
+private:
+    void watch_loop();
+    bool compile(const std::filesystem::path& source_file);
+
+    std::filesystem::path source_directory;
+    std::filesystem::path spirv_directory;
+    std::unordered_map<std::string, std::filesystem::file_time_type> write_times;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stop_requested;
+    bool stop = false;
+    std::vector<std::string> rebuilt_shaders;
+};
@@ -0,0 +1,22 @@
+#version 460
+layout(row_major) uniform;
+
+// Same position transform as mesh.vert, the main pass after the pre-pass tests with EQUAL.
+layout(location=0) in vec4 in_position;
+
+invariant gl_Position;
+
+layout(std140, binding=0) uniform Uniform_Block {
+    mat4x4 view_proj;
+    mat4x4 history_view_proj;
+};
+
+layout(std140, set=1,binding=1) uniform ModelMatrices
+{
+    mat4x4 currentModelMat;
+    mat4x4 previousModelMat;
+};
+
+void main() {
+    gl_Position = view_proj * currentModelMat * in_position;
+}
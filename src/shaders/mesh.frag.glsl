@@ -6,7 +6,7 @@ layout(location = 1) in vec4 clipPos;
 layout(location = 2) in vec4 history_clipPos;
 
 layout(location = 0) out vec4 color_attachment0;
-layout(location = 1) out vec4 motion_vec_attachment;
+layout(location = 1) out vec2 motion_vec_attachment;
 
 layout(binding=1) uniform texture2D image;
 layout(binding=2) uniform sampler image_sampler;
@@ -19,7 +19,6 @@ void main() {
     vec4 convertedClipPos = (clipPos / clipPos.w + 1.) * 0.5;
     vec4 convertedHistoryPos = (history_clipPos  / history_clipPos.w + 1.) * 0.5;
 
-    vec2 offset = convertedClipPos.xy - convertedHistoryPos.xy;
-        
-    motion_vec_attachment = vec4(offset, vec2(1.));
+    // Signed uv offset from the previous frame position, written as is to the RG16F target.
+    motion_vec_attachment = convertedClipPos.xy - convertedHistoryPos.xy;
 }
@@ -7,6 +7,9 @@ layout(location = 0) out vec2 frag_uv;
 layout(location = 1) out vec4 clipPos;
 layout(location = 2) out vec4 history_clipPos;
 
+// Matches depth_prepass.vert for the EQUAL depth test after the pre-pass.
+invariant gl_Position;
+
 layout(std140, binding=0) uniform Uniform_Block {
     mat4x4 view_proj;
     mat4x4 history_view_proj;
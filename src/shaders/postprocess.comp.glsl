@@ -0,0 +1,153 @@
+#version 460
+layout(row_major) uniform;
+
+// Compute version of postprocess.frag.glsl. Each workgroup loads its tile plus a one pixel
+// apron into shared memory once, so the neighbourhood filters do not refetch the input image.
+#define TILE_SIZE 16
+#define CACHE_SIZE (TILE_SIZE + 2)
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(binding=1) uniform texture2D input_image;
+layout(binding=2) uniform sampler linear_input_image_sampler;
+layout(binding=3) uniform texture2D prev_frame_image;
+layout(binding=4) uniform sampler nearest_input_image_sampler;
+layout(binding=5) uniform texture2D motion_vec_image;
+layout(binding=6, rgba16f) uniform writeonly image2D output_image;
+
+#define texSamplerLinear sampler2D(input_image, linear_input_image_sampler)
+#define texSamplerPrev sampler2D(prev_frame_image, linear_input_image_sampler)
+#define texSamplerMotion sampler2D(motion_vec_image, nearest_input_image_sampler)
+
+// Same specialization constant as in postprocess.frag.glsl.
+layout(constant_id = 0) const int aliasingOption = 1;
+
+layout( push_constant ) uniform constants
+{
+    float threshold;
+    uint frameIndex;
+    vec2 renderScale;
+} PushConstants;
+
+shared vec3 tile[CACHE_SIZE][CACHE_SIZE];
+
+float halton(int index, int base) {
+    float result = 0.0;
+    float f = 1.0 / float(base);
+    int i = index;
+    while (i > 0) {
+        result += f * float(i % base);
+        i = int(i / base);
+        f /= float(base);
+    }
+    return result;
+}
+vec2 jitterOffset(int frameIndex) {
+    return fract(vec2(halton(frameIndex, 2), halton(frameIndex, 3)) * 5.);
+}
+
+// t is a position in the tile cache, offset is in pixels (-1..1).
+vec3 cached(ivec2 t, ivec2 offset) {
+    ivec2 p = t + offset;
+    return tile[p.y][p.x];
+}
+
+vec3 sharpen(ivec2 t)
+{
+    vec3 sampleTL = cached(t, ivec2(-1,  1));
+    vec3 sampleT  = cached(t, ivec2( 0,  1));
+    vec3 sampleTR = cached(t, ivec2( 1,  1));
+    vec3 sampleL  = cached(t, ivec2(-1,  0));
+    vec3 sampleC  = cached(t, ivec2( 0,  0));
+    vec3 sampleR  = cached(t, ivec2( 1,  0));
+    vec3 sampleBL = cached(t, ivec2(-1, -1));
+    vec3 sampleB  = cached(t, ivec2( 0, -1));
+    vec3 sampleBR = cached(t, ivec2( 1, -1));
+
+    // Sobel kernels, same weights as in postprocess.frag.glsl.
+    vec3 gradX = -sampleTL + sampleTR - 2.0 * sampleL + 2.0 * sampleR - sampleBL + sampleBR;
+    vec3 gradY = -sampleTL - 2.0 * sampleT - sampleTR + sampleBL + 2.0 * sampleB + sampleBR;
+
+    float edgeStrength = length(gradX) + length(gradY);
+    float sharpenFactor = 0.05;
+    return sampleC + edgeStrength * sharpenFactor;
+}
+
+vec3 fxaa(ivec2 t)
+{
+    vec3 colorCenter = cached(t, ivec2( 0,  0));
+    vec3 colorLeft   = cached(t, ivec2(-1,  0));
+    vec3 colorRight  = cached(t, ivec2( 1,  0));
+    vec3 colorUp     = cached(t, ivec2( 0,  1));
+    vec3 colorDown   = cached(t, ivec2( 0, -1));
+
+    const vec3 luma = vec3(0.299, 0.587, 0.114);
+    float edgeHorizontal = abs(dot(colorLeft, luma) - dot(colorRight, luma));
+    float edgeVertical   = abs(dot(colorUp, luma) - dot(colorDown, luma));
+    float edgeStrength = max(edgeHorizontal, edgeVertical);
+
+    if (edgeStrength > PushConstants.threshold) {
+        vec3 averageColor = (colorLeft + colorRight + colorUp + colorDown) / 4.0;
+        return mix(colorCenter, averageColor, 0.75);
+    }
+    return colorCenter;
+}
+
+vec3 taa(ivec2 t, ivec2 pixel, vec2 outputSize)
+{
+    // The fragment path samples the current frame with a nearest sampler at a sub-pixel
+    // jitter of up to one pixel, which selects one of the cached neighbours.
+    vec2 jitter = (jitterOffset(int(PushConstants.frameIndex)) - 0.5) * 2.;
+    vec3 curColor = cached(t, ivec2(floor(jitter + 0.5)));
+
+    vec2 uv = (vec2(pixel) + 0.5) / outputSize;
+    vec2 prevOffset = textureLod(texSamplerMotion, uv * PushConstants.renderScale, 0).rg;
+    vec3 prevColor = textureLod(texSamplerPrev, uv - prevOffset, 0).rgb;
+
+    vec3 NearColor0 = cached(t, ivec2( 1,  0));
+    vec3 NearColor1 = cached(t, ivec2( 0,  1));
+    vec3 NearColor2 = cached(t, ivec2(-1,  0));
+    vec3 NearColor3 = cached(t, ivec2( 0, -1));
+
+    vec3 BoxMin = min(curColor, min(NearColor0, min(NearColor1, min(NearColor2, NearColor3))));
+    vec3 BoxMax = max(curColor, max(NearColor0, max(NearColor1, max(NearColor2, NearColor3))));
+    prevColor = clamp(prevColor, BoxMin, BoxMax);
+
+    const float blendFactor = 0.9;
+    return mix(curColor, prevColor, blendFactor);
+}
+
+void main()
+{
+    ivec2 outputSize = imageSize(output_image);
+    vec2 inputPixelSize = 1.0 / vec2(textureSize(texSamplerLinear, 0));
+
+    // Cooperative load of the tile and its apron. The tile is in output pixels: the scene occupies
+    // renderScale part of the input image (dynamic resolution) and is upscaled bilinearly here.
+    ivec2 cacheOrigin = ivec2(gl_WorkGroupID.xy) * TILE_SIZE - 1;
+    for (uint i = gl_LocalInvocationIndex; i < CACHE_SIZE * CACHE_SIZE; i += TILE_SIZE * TILE_SIZE) {
+        ivec2 p = ivec2(i % CACHE_SIZE, i / CACHE_SIZE);
+        ivec2 coord = clamp(cacheOrigin + p, ivec2(0), outputSize - 1);
+        vec2 uv = (vec2(coord) + 0.5) / vec2(outputSize) * PushConstants.renderScale;
+        uv = clamp(uv, inputPixelSize * 0.5, PushConstants.renderScale - inputPixelSize * 0.5);
+        tile[p.y][p.x] = textureLod(texSamplerLinear, uv, 0).rgb;
+    }
+    barrier();
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, outputSize)))
+        return;
+
+    ivec2 t = ivec2(gl_LocalInvocationID.xy) + 1;
+    vec3 color;
+    if (aliasingOption == 0)
+        color = cached(t, ivec2(0));
+    else if (aliasingOption == 2)
+        color = taa(t, pixel, vec2(outputSize));
+    else if (aliasingOption == 4)
+        color = sharpen(t);
+    else
+        color = fxaa(t);
+
+    imageStore(output_image, pixel, vec4(color, 1.0));
+}
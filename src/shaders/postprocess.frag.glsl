@@ -11,14 +11,18 @@ layout(binding=4) uniform sampler nearest_input_image_sampler;
 layout(binding=5) uniform texture2D motion_vec_image;
 
 #define texSampler sampler2D(input_image, nearest_input_image_sampler)
+#define texSamplerLinear sampler2D(input_image, linear_input_image_sampler)
 #define texSamplerPrev sampler2D(prev_frame_image, linear_input_image_sampler)
 #define texSamplerMotion sampler2D(motion_vec_image, nearest_input_image_sampler)
 
+// Every antialiasing option is a separate pipeline, so the other filters are compiled out.
+layout(constant_id = 0) const int aliasingOption = 1;
+
 layout( push_constant ) uniform constants
 {
-    int aliasingOption;
     float threshold;
     uint frameIndex;
+    vec2 renderScale;
 } PushConstants;
 
 const vec2 haltonPoints[16] = vec2[16](
@@ -118,36 +122,47 @@ vec4 sharpenImage(texture2D image, sampler textureSampler, vec2 fragTexCoord)
     return vec4(sharpenedColor, 1.0);
 }
 
+// The scene is rendered into the top-left renderScale part of the input images (dynamic resolution).
+// Keeps neighbourhood samples inside the rendered area.
+vec2 clampToRenderArea(vec2 uv, vec2 pixelSize)
+{
+    return clamp(uv, pixelSize * 0.5, PushConstants.renderScale - pixelSize * 0.5);
+}
+
 void main() 
 {
-    if (PushConstants.aliasingOption == 0)
+    vec2 texSize = textureSize(texSampler, 0);
+    vec2 pixelSize = 1. / texSize;
+    // Bilinear filtering upscales the rendered area, with renderScale == 1 it samples texel centers.
+    vec2 uv = clampToRenderArea(frag_uv * PushConstants.renderScale, pixelSize);
+
+    if (aliasingOption == 0)
     {
-        color_attachment0 = texture(texSampler, frag_uv);
+        color_attachment0 = texture(texSamplerLinear, uv);
         return;
     }
 
-    vec2 texSize = textureSize(texSampler, 0);
-    vec2 pixelSize = 1. / texSize;
-    if (PushConstants.aliasingOption == 2)
+    if (aliasingOption == 2)
     {
         // vec2 offset = haltonPoints[PushConstants.frameIndex % 16];
         vec2 offset = jitterOffset(int(PushConstants.frameIndex));
         offset = ((offset - 0.5) / texSize) * 2.;
 
-        vec2 prevOffset = texture(texSamplerMotion, frag_uv).rg * 2. - 1.;
+        // Motion vectors are in uv units, the history is kept at output resolution.
+        vec2 prevOffset = texture(texSamplerMotion, uv).rg;
         vec4 prevColor = texture(texSamplerPrev, frag_uv - prevOffset);
 
         float pixelSpeed = clamp(length(prevOffset), 0., 1.);
         
         float adaptiveBlend = clamp(1.0 - pixelSpeed * 0.1, 0.1, .9);
 
-        vec4 curColor = texture(texSampler, frag_uv + offset);
+        vec4 curColor = texture(texSampler, clampToRenderArea(uv + offset, pixelSize));
 
         // Apply clamping on the history color.
-        vec3 NearColor0 = texture(texSampler, frag_uv + vec2(1, 0) * pixelSize).rgb;
-        vec3 NearColor1 = texture(texSampler, frag_uv + vec2(0, 1) * pixelSize).rgb;
-        vec3 NearColor2 = texture(texSampler, frag_uv + vec2(-1, 0) * pixelSize).rgb;
-        vec3 NearColor3 = texture(texSampler, frag_uv + vec2(0, -1) * pixelSize).rgb;
+        vec3 NearColor0 = texture(texSamplerLinear, clampToRenderArea(uv + vec2(1, 0) * pixelSize, pixelSize)).rgb;
+        vec3 NearColor1 = texture(texSamplerLinear, clampToRenderArea(uv + vec2(0, 1) * pixelSize, pixelSize)).rgb;
+        vec3 NearColor2 = texture(texSamplerLinear, clampToRenderArea(uv + vec2(-1, 0) * pixelSize, pixelSize)).rgb;
+        vec3 NearColor3 = texture(texSamplerLinear, clampToRenderArea(uv + vec2(0, -1) * pixelSize, pixelSize)).rgb;
 
         vec3 BoxMin = min(curColor.rgb, min(NearColor0, min(NearColor1, min(NearColor2, NearColor3))));
         vec3 BoxMax = max(curColor.rgb, max(NearColor0, max(NearColor1, max(NearColor2, NearColor3))));;
@@ -160,17 +175,17 @@ void main()
         return;
     }
 
-    if (PushConstants.aliasingOption == 4)
+    if (aliasingOption == 4)
     {
-        color_attachment0 = sharpenImage(input_image, nearest_input_image_sampler, frag_uv);
+        color_attachment0 = sharpenImage(input_image, linear_input_image_sampler, uv);
         return;
     }
     // Sample the four neighboring pixels
-    vec3 colorCenter = texture(texSampler, frag_uv).rgb;
-    vec3 colorLeft   = texture(texSampler, frag_uv + vec2(-pixelSize.x, 0.0)).rgb;
-    vec3 colorRight  = texture(texSampler, frag_uv + vec2(pixelSize.x, 0.0)).rgb;
-    vec3 colorUp     = texture(texSampler, frag_uv + vec2(0.0, pixelSize.y)).rgb;
-    vec3 colorDown   = texture(texSampler, frag_uv + vec2(0.0, -pixelSize.y)).rgb;
+    vec3 colorCenter = texture(texSamplerLinear, uv).rgb;
+    vec3 colorLeft   = texture(texSamplerLinear, clampToRenderArea(uv + vec2(-pixelSize.x, 0.0), pixelSize)).rgb;
+    vec3 colorRight  = texture(texSamplerLinear, clampToRenderArea(uv + vec2(pixelSize.x, 0.0), pixelSize)).rgb;
+    vec3 colorUp     = texture(texSamplerLinear, clampToRenderArea(uv + vec2(0.0, pixelSize.y), pixelSize)).rgb;
+    vec3 colorDown   = texture(texSamplerLinear, clampToRenderArea(uv + vec2(0.0, -pixelSize.y), pixelSize)).rgb;
 
         // Compute luminance (perceived brightness)
     float lumCenter = dot(colorCenter, vec3(0.299, 0.587, 0.114));
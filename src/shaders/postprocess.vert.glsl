@@ -1,11 +1,18 @@
 #version 460
 layout(row_major) uniform;
 
-layout(location=0) in vec4 in_position;
-layout(location=1) in vec2 in_uv;
 layout(location = 0) out vec2 frag_uv;
 
+// No vertex input: vertices 0..2 form a single triangle that covers the whole screen,
+// vertices 3..8 form the old two-triangle quad which is drawn only for timing comparison.
+const vec2 positions[9] = vec2[](
+    vec2(-1, -1), vec2(3, -1), vec2(-1, 3),
+    vec2(-1, -1), vec2(-1, 1), vec2(1, -1),
+    vec2(1, -1), vec2(-1, 1), vec2(1, 1)
+);
+
 void main() {
-    frag_uv = in_uv;
-    gl_Position = vec4(in_position.xy, 0.0, 1.);
+    vec2 position = positions[gl_VertexIndex];
+    frag_uv = position * 0.5 + 0.5;
+    gl_Position = vec4(position, 0.0, 1.);
 }
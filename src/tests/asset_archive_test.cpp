@@ -0,0 +1,148 @@
+#include "../asset_archive.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+// Asset archive round trip: packs generated files into an archive with LZ4 compression, reads
+// them back through the memory mapping and compares the bytes. Covers random (stored
+// uncompressed), compressible, empty and SPIR-V entries, and lz4_compress/lz4_decompress alone.
+// The exit code is the number of failed checks.
+
+static int failure_count = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failure_count++;
+    }
+}
+
+static std::vector<uint8_t> random_bytes(size_t size, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::vector<uint8_t> bytes(size);
+    for (uint8_t& byte : bytes)
+        byte = uint8_t(random());
+    return bytes;
+}
+
+// Text-like data with repeats at short and long distances.
+static std::vector<uint8_t> compressible_bytes(size_t size) {
+    const std::vector<uint8_t> block = random_bytes(100'000, 7);
+    const char* line = "v 0.125 1.500 -2.250\nvt 0.5 0.25\nf 1/1/1 2/2/2 3/3/3\n";
+    std::vector<uint8_t> bytes;
+    std::mt19937 random(3);
+    while (bytes.size() < size) {
+        if (random() % 4 == 0) {
+            const size_t offset = random() % (block.size() - 1000);
+            bytes.insert(bytes.end(), block.begin() + offset, block.begin() + offset + 200 + random() % 800);
+        }
+        else {
+            bytes.insert(bytes.end(), line, line + strlen(line));
+        }
+    }
+    bytes.resize(size);
+    return bytes;
+}
+
+static void test_lz4() {
+    std::vector<std::vector<uint8_t>> inputs = {
+        {},
+        { 42 },
+        std::vector<uint8_t>(13, 'a'),
+        std::vector<uint8_t>(1'000'000, 0), // match lengths above 255
+        random_bytes(70'000, 1),            // literal runs above 255
+        compressible_bytes(300'000),
+    };
+    // The last literals rule of the block format matters for short inputs.
+    for (size_t size = 1; size < 40; size++)
+        inputs.emplace_back(inputs[5].begin(), inputs[5].begin() + size);
+
+    for (const std::vector<uint8_t>& input : inputs) {
+        const std::vector<uint8_t> compressed = lz4_compress(input.data(), input.size());
+        std::vector<uint8_t> output(input.size());
+        check(lz4_decompress(compressed.data(), compressed.size(), output.data(), output.size()) && output == input,
+            "lz4 round trip");
+    }
+
+    // Malformed input is rejected instead of reading or writing out of bounds.
+    const std::vector<uint8_t>& input = inputs[5];
+    const std::vector<uint8_t> compressed = lz4_compress(input.data(), input.size());
+    std::vector<uint8_t> output(input.size());
+    check(!lz4_decompress(compressed.data(), compressed.size() / 2, output.data(), output.size()), "truncated lz4 data is rejected");
+    check(!lz4_decompress(compressed.data(), compressed.size(), output.data(), output.size() - 1), "wrong uncompressed size is rejected");
+}
+
+static void test_archive_round_trip() {
+    namespace fs = std::filesystem;
+    const fs::path directory = fs::temp_directory_path() / "asset_archive_test";
+    const fs::path data_directory = directory / "data";
+    const std::string archive_file = (directory / "data.pak").string();
+    fs::remove_all(directory);
+    fs::create_directories(data_directory / "model" / "nested");
+    fs::create_directories(data_directory / "spirv");
+
+    struct Test_File {
+        const char* path;
+        std::vector<uint8_t> bytes;
+        Archive_Compression compression;
+    };
+    const std::vector<Test_File> test_files = {
+        { "random.bin", random_bytes(200'000, 11), Archive_Compression::none }, // lz4 does not save 1/8
+        { "small.txt", { 'a', 'b', 'c' }, Archive_Compression::none },
+        { "empty.txt", {}, Archive_Compression::none },
+        { "zeros.bin", std::vector<uint8_t>(500'000, 0), Archive_Compression::lz4 },
+        { "model/mesh.obj", compressible_bytes(1'000'000), Archive_Compression::lz4 },
+        { "model/nested/mesh.obj", compressible_bytes(4'000), Archive_Compression::lz4 },
+        { "spirv/shader.spv", std::vector<uint8_t>(4096, 3), Archive_Compression::none }, // used in place
+    };
+    for (const Test_File& file : test_files) {
+        FILE* out = fopen((data_directory / file.path).string().c_str(), "wb");
+        fwrite(file.bytes.data(), 1, file.bytes.size(), out);
+        fclose(out);
+    }
+
+    check(write_asset_archive(data_directory.string(), archive_file, true), "archive is written");
+    check(g_asset_archive.open(archive_file, data_directory.string()), "archive opens");
+    check(g_asset_archive.entry_count() == test_files.size(), "archive has an entry per file");
+
+    // Read from the archive only, the loose files are gone.
+    fs::remove_all(data_directory);
+    for (const Test_File& file : test_files) {
+        const std::string path = (data_directory / file.path).string();
+        const Asset_Archive_Entry* entry = g_asset_archive.find(path);
+        Asset_File contents;
+        const bool found = entry && read_asset_file(path, contents);
+        const bool equal = found && contents.bytes.size() == file.bytes.size() &&
+            std::equal(contents.bytes.begin(), contents.bytes.end(), file.bytes.begin());
+        printf("%-25s %8zu -> %8llu %s %s\n", file.path, file.bytes.size(), entry ? (unsigned long long)entry->size : 0ull,
+            entry && entry->compression == Archive_Compression::lz4 ? "lz4 " : "none", equal ? "ok" : "FAILED");
+        check(equal, "archive entry has the bytes of the file");
+        if (!entry)
+            continue;
+        check(entry->compression == file.compression, "entry compression");
+        check(entry->uncompressed_size == file.bytes.size(), "entry uncompressed size");
+        // Uncompressed entries are used in place from the mapping.
+        const std::span<const uint8_t> stored = g_asset_archive.get_stored_bytes(*entry);
+        if (entry->compression == Archive_Compression::none && !stored.empty())
+            check(contents.bytes.data() == stored.data() && contents.storage.empty(), "uncompressed entry is read in place");
+        check(entry->offset % 64 == 0, "payload is aligned");
+    }
+
+    Asset_File contents;
+    check(g_asset_archive.find((data_directory / "missing.bin").string()) == nullptr, "unknown path is not in the archive");
+    check(!read_asset_file((data_directory / "missing.bin").string(), contents), "unknown path can not be read");
+
+    g_asset_archive.close();
+    fs::remove_all(directory);
+}
+
+int main() {
+    test_lz4();
+    test_archive_round_trip();
+
+    printf("%s\n", failure_count == 0 ? "All checks passed" : "Some checks failed");
+    return failure_count;
+}
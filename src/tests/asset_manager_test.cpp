@@ -0,0 +1,180 @@
+#include "../asset_manager.h"
+
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Asset manager tests with a backend that loads nothing and creates no GPU resources:
+// priority order, coalescing of requests for the same asset, cancellation and failed loads.
+// The exit code is the number of failed checks.
+
+static int failure_count = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failure_count++;
+    }
+}
+
+// Records the load order. Loads wait while loads_blocked is set, paths that start with
+// "missing" fail.
+struct Fake_Backend {
+    std::mutex mutex;
+    std::vector<std::string> loaded_paths;
+    std::atomic<bool> loads_blocked = false;
+    uint32_t created_count = 0;
+    uint32_t destroyed_count = 0;
+
+    Asset_Backend get() {
+        Asset_Backend backend;
+        backend.load = [this](Asset_Kind, const std::string& path, float, Asset_Data& data) {
+            while (loads_blocked.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                loaded_paths.push_back(path);
+            }
+            if (path.rfind("missing", 0) == 0)
+                throw std::runtime_error("missing file: " + path);
+            data.width = data.height = 1;
+            data.pixels.assign(4, 255);
+        };
+        backend.create_mesh = [this](const std::string&, const Asset_Data&) {
+            created_count++;
+            return std::make_shared<GPU_MESH>();
+        };
+        backend.create_texture = [this](const std::string&, const Asset_Data&) {
+            created_count++;
+            return std::make_shared<Vk_Image>();
+        };
+        backend.destroy_mesh = [this](GPU_MESH&) { destroyed_count++; };
+        backend.destroy_texture = [this](Vk_Image&) { destroyed_count++; };
+        return backend;
+    }
+};
+
+static void test_priority_order() {
+    Fake_Backend backend;
+    Asset_Manager assets;
+    assets.initialize(backend.get());
+    assets.max_loads_in_flight = 1;
+
+    // All requests are in the queues before the first update, one load at a time.
+    Asset_Handle low = assets.request_mesh("low.obj", Asset_Priority::low);
+    Asset_Handle normal = assets.request_mesh("normal.obj", Asset_Priority::normal);
+    Asset_Handle high = assets.request_mesh("high.obj", Asset_Priority::high);
+    assets.finish_requests();
+
+    check(low.is_resident() && normal.is_resident() && high.is_resident(), "prioritized requests are resident");
+    check(backend.loaded_paths == std::vector<std::string>{ "high.obj", "normal.obj", "low.obj" },
+        "requests load in priority order");
+    assets.shutdown();
+}
+
+static void test_coalescing() {
+    Fake_Backend backend;
+    Asset_Manager assets;
+    assets.initialize(backend.get());
+
+    backend.loads_blocked = true;
+    Asset_Handle first = assets.request_mesh("model.obj", Asset_Priority::normal);
+    Asset_Handle second = assets.request_mesh("model.obj", Asset_Priority::low);
+    Asset_Handle texture = assets.request_texture("model.obj", Asset_Priority::normal);
+    Asset_Handle scaled = assets.request_mesh("model.obj", Asset_Priority::normal, 2.f);
+    assets.update(); // starts the blocked load
+    check(assets.get_stats().loads_in_flight == 3, "duplicate path joins the load in flight");
+    backend.loads_blocked = false;
+    assets.finish_requests();
+
+    check(first.is_resident() && second.is_resident(), "coalesced requests are resident");
+    check(first.mesh() != nullptr && first.mesh() == second.mesh(), "coalesced requests share the mesh");
+    check(scaled.mesh() != nullptr && scaled.mesh() != first.mesh(), "mesh with another scale is a separate asset");
+    check(texture.texture() != nullptr, "texture with the same path is a separate asset");
+
+    // The asset is resident already, no new load.
+    Asset_Handle third = assets.request_mesh("model.obj", Asset_Priority::high);
+    assets.finish_requests();
+    check(third.mesh() == first.mesh(), "request for a resident asset shares the mesh");
+
+    const Asset_Manager_Stats stats = assets.get_stats();
+    check(stats.requests == 5 && stats.loads == 3 && stats.coalesced == 2, "coalescing stats");
+    check(backend.created_count == 3 && stats.resident_count == 3, "one GPU resource per asset");
+
+    assets.shutdown();
+    check(backend.destroyed_count == backend.created_count, "shutdown destroys the resident assets");
+}
+
+static void test_cancellation() {
+    Fake_Backend backend;
+    Asset_Manager assets;
+    assets.initialize(backend.get());
+
+    // Cancelled before its load started.
+    Asset_Handle unstarted = assets.request_mesh("unstarted.obj", Asset_Priority::normal);
+    unstarted.cancel();
+    assets.finish_requests();
+    check(unstarted.state() == Asset_State::cancelled, "request cancelled before the load");
+    check(assets.get_stats().loads == 0, "cancelled request starts no load");
+
+    // One of two requests for the same asset is cancelled during the load.
+    backend.loads_blocked = true;
+    Asset_Handle kept = assets.request_mesh("shared.obj", Asset_Priority::normal);
+    Asset_Handle dropped = assets.request_mesh("shared.obj", Asset_Priority::normal);
+    assets.update(); // starts the blocked load
+    dropped.cancel();
+    backend.loads_blocked = false;
+    assets.finish_requests();
+    check(kept.is_resident() && kept.mesh() != nullptr, "partially cancelled load is resident");
+    check(dropped.state() == Asset_State::cancelled, "cancelled request of a shared load is cancelled");
+    check(dropped.request->mesh == nullptr, "cancelled request holds no reference to the asset");
+    check(assets.get_stats().cancelled == 2, "partial cancellation is counted");
+
+    // All requests are cancelled during the load, nothing is uploaded.
+    backend.loads_blocked = true;
+    const uint32_t created_count = backend.created_count;
+    Asset_Handle texture = assets.request_texture("dropped.png", Asset_Priority::high);
+    Asset_Handle texture_copy = assets.request_texture("dropped.png", Asset_Priority::low);
+    assets.update(); // starts the blocked load
+    texture.cancel();
+    texture_copy.cancel();
+    backend.loads_blocked = false;
+    assets.finish_requests();
+    check(texture.state() == Asset_State::cancelled && texture_copy.state() == Asset_State::cancelled,
+        "fully cancelled load resolves all requests as cancelled");
+    check(backend.created_count == created_count, "fully cancelled load is not uploaded");
+
+    const Asset_Manager_Stats stats = assets.get_stats();
+    check(stats.cancelled == 4 && stats.resident_count == 1, "full cancellation stats");
+
+    assets.shutdown();
+    check(backend.destroyed_count == backend.created_count, "shutdown destroys the resident assets");
+}
+
+static void test_failure() {
+    Fake_Backend backend;
+    Asset_Manager assets;
+    assets.initialize(backend.get());
+
+    Asset_Handle missing = assets.request_texture("missing.png", Asset_Priority::normal);
+    Asset_Handle missing_copy = assets.request_texture("missing.png", Asset_Priority::normal);
+    assets.finish_requests();
+    check(missing.state() == Asset_State::failed && missing_copy.state() == Asset_State::failed, "failed load resolves all requests as failed");
+    check(missing.texture() == nullptr, "failed request has no texture");
+    check(assets.get_stats().failed == 1 && backend.created_count == 0, "failed load stats");
+    assets.shutdown();
+}
+
+int main() {
+    g_job_system.initialize(2);
+
+    test_priority_order();
+    test_coalescing();
+    test_cancellation();
+    test_failure();
+
+    g_job_system.shutdown();
+    printf("%s\n", failure_count == 0 ? "All checks passed" : "Some checks failed");
+    return failure_count;
+}
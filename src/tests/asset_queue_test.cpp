@@ -0,0 +1,92 @@
+#include "../mpsc_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Stress test of the asset request queue: asset_queue_test [requests per thread]
+// Pushes requests from 1, 2, 4, ... producer threads while one consumer pops them, checks that
+// every item arrives exactly once and in order per producer, and prints the throughput.
+// The exit code is the number of failed runs.
+
+struct Item {
+    uint32_t producer;
+    uint32_t sequence;
+};
+
+static bool run_stress_test(uint32_t producer_count, uint32_t requests_per_thread) {
+    Mpsc_Queue<Item> queue;
+    std::atomic<bool> start = false;
+    std::atomic<uint32_t> finished_producers = 0;
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < producer_count; p++) {
+        producers.emplace_back([&queue, &start, &finished_producers, p, requests_per_thread] {
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (uint32_t i = 0; i < requests_per_thread; i++)
+                queue.push(Item{ p, i });
+            finished_producers.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+
+    std::vector<uint32_t> next_sequence(producer_count, 0);
+    const uint64_t total = uint64_t(producer_count) * requests_per_thread;
+    uint64_t received = 0;
+    uint64_t order_errors = 0;
+    // Pops until the producers are done and the queue is empty, so lost items end the loop
+    // instead of waiting for them forever.
+    for (;;) {
+        const bool producers_done = finished_producers.load(std::memory_order_acquire) == producer_count;
+        Item item;
+        if (!queue.pop(item)) {
+            if (producers_done)
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        if (item.producer >= producer_count) {
+            order_errors++;
+            continue;
+        }
+        order_errors += item.sequence != next_sequence[item.producer];
+        next_sequence[item.producer] = item.sequence + 1;
+        received++;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    for (std::thread& producer : producers)
+        producer.join();
+
+    const uint32_t incomplete_producers = uint32_t(std::count_if(next_sequence.begin(), next_sequence.end(),
+        [requests_per_thread](uint32_t next) { return next != requests_per_thread; }));
+    printf("Asset queue: %u producers, %llu of %llu requests in %.2f ms, %.2f M requests/s, %llu ordering errors\n",
+        producer_count, (unsigned long long)received, (unsigned long long)total, seconds * 1e3, received / seconds / 1e6,
+        (unsigned long long)order_errors);
+
+    const bool passed = received == total && order_errors == 0 && incomplete_producers == 0;
+    if (!passed)
+        printf("FAILED: %llu items lost or duplicated, %u producers incomplete\n",
+            (unsigned long long)(total > received ? total - received : received - total), incomplete_producers);
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    uint32_t requests_per_thread = 1'000'000;
+    if (argc > 1)
+        requests_per_thread = uint32_t(strtoul(argv[1], nullptr, 10));
+
+    const uint32_t thread_count = std::max(std::thread::hardware_concurrency(), 2u);
+    int failure_count = 0;
+    for (uint32_t producer_count = 1; producer_count < thread_count; producer_count *= 2)
+        failure_count += !run_stress_test(producer_count, requests_per_thread);
+    failure_count += !run_stress_test(thread_count, requests_per_thread);
+
+    printf("%s\n", failure_count == 0 ? "All runs passed" : "Some runs failed");
+    return failure_count;
+}
@@ -0,0 +1,131 @@
+#include "../image_compare.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+// Golden image comparison on generated images: pixel tolerance, SSIM of identical and perturbed
+// images against the default thresholds, and check_golden_images on a temporary directory.
+// The exit code is the number of failed checks.
+
+static int failure_count = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failure_count++;
+    }
+}
+
+constexpr uint32_t image_size = 128;
+
+// Smooth gradients with some texture, similar to a rendered frame.
+static std::vector<uint8_t> create_image() {
+    std::vector<uint8_t> image(size_t(image_size) * image_size * 4);
+    for (uint32_t y = 0; y < image_size; y++) {
+        for (uint32_t x = 0; x < image_size; x++) {
+            uint8_t* pixel = &image[(size_t(y) * image_size + x) * 4];
+            pixel[0] = uint8_t(x * 2);
+            pixel[1] = uint8_t(y * 2);
+            pixel[2] = uint8_t(128 + 100 * std::sin(x * 0.2f) * std::cos(y * 0.15f));
+            pixel[3] = 255;
+        }
+    }
+    return image;
+}
+
+// Adds noise in [-amplitude, amplitude] to the color channels. mt19937 gives the same sequence
+// with every standard library, the distributions do not.
+static std::vector<uint8_t> add_noise(const std::vector<uint8_t>& image, int amplitude) {
+    std::mt19937 random(42);
+    std::vector<uint8_t> result = image;
+    for (size_t i = 0; i < result.size(); i++) {
+        const int noise = int(random() % uint32_t(2 * amplitude + 1)) - amplitude;
+        if (i % 4 != 3)
+            result[i] = uint8_t(std::clamp(int(result[i]) + noise, 0, 255));
+    }
+    return result;
+}
+
+static void test_compare_images() {
+    const Golden_Options thresholds;
+    const std::vector<uint8_t> image = create_image();
+    const double pixel_count = double(image_size) * image_size;
+
+    Image_Compare_Result result = compare_images(image.data(), image.data(), image_size, image_size, thresholds.tolerance);
+    printf("Identical: %llu differing pixels, SSIM %.6f\n", (unsigned long long)result.differing_pixels, result.ssim);
+    check(result.differing_pixels == 0 && result.max_difference == 0, "identical images have no differing pixels");
+    check(std::abs(result.ssim - 1.0) < 1e-9, "identical images have SSIM 1");
+
+    // Noise within the tolerance passes.
+    const std::vector<uint8_t> within_tolerance = add_noise(image, 1);
+    result = compare_images(image.data(), within_tolerance.data(), image_size, image_size, thresholds.tolerance);
+    printf("Noise 1: %llu differing pixels, SSIM %.6f\n", (unsigned long long)result.differing_pixels, result.ssim);
+    check(result.differing_pixels == 0 && result.max_difference <= thresholds.tolerance, "noise within the tolerance is not counted");
+    check(result.ssim >= thresholds.min_ssim, "noise within the tolerance keeps SSIM above the threshold");
+
+    // Visible noise fails both checks.
+    const std::vector<uint8_t> perturbed = add_noise(image, 40);
+    result = compare_images(image.data(), perturbed.data(), image_size, image_size, thresholds.tolerance);
+    printf("Noise 40: %llu differing pixels, SSIM %.6f\n", (unsigned long long)result.differing_pixels, result.ssim);
+    check(result.ssim < thresholds.min_ssim, "perturbed image has SSIM below the threshold");
+    check(result.differing_pixels / pixel_count > thresholds.max_differing_fraction, "perturbed image has differing pixels above the limit");
+
+    // One changed pixel is counted and marked red in the diff image.
+    std::vector<uint8_t> one_pixel = image;
+    const size_t changed_pixel = size_t(37) * image_size + 91;
+    one_pixel[changed_pixel * 4 + 1] = uint8_t(one_pixel[changed_pixel * 4 + 1] + 50);
+    std::vector<uint8_t> diff(image.size());
+    result = compare_images(image.data(), one_pixel.data(), image_size, image_size, thresholds.tolerance, diff.data());
+    check(result.differing_pixels == 1 && result.max_difference == 50, "one changed pixel");
+    check(diff[changed_pixel * 4 + 0] == 255 && diff[changed_pixel * 4 + 1] == 0 && diff[0] == diff[1],
+        "diff image marks the changed pixel");
+}
+
+static void test_check_golden_images() {
+    namespace fs = std::filesystem;
+    const fs::path directory = fs::temp_directory_path() / "image_compare_test";
+    fs::remove_all(directory);
+    fs::create_directories(directory / "output");
+
+    Golden_Options options;
+    options.golden_directory = (directory / "golden").string();
+    options.output_directory = (directory / "output").string();
+    check(!has_golden_images(options.golden_directory), "missing golden directory has no images");
+
+    const std::vector<uint8_t> image = create_image();
+    const std::vector<uint8_t> perturbed = add_noise(image, 40);
+    auto write_png = [](const fs::path& path, const std::vector<uint8_t>& pixels) {
+        stbi_write_png(path.string().c_str(), image_size, image_size, 4, pixels.data(), image_size * 4);
+    };
+    write_png(directory / "output" / "same.png", image);
+    write_png(directory / "output" / "changed.png", image);
+
+    options.update = true;
+    check(check_golden_images(options) == 0 && has_golden_images(options.golden_directory), "update writes the golden images");
+
+    options.update = false;
+    check(check_golden_images(options) == 0, "unchanged frames pass");
+    write_png(directory / "output" / "changed.png", perturbed);
+    check(check_golden_images(options) == 1, "changed frame fails");
+    check(fs::exists(directory / "output" / "diff_changed.png") && !fs::exists(directory / "output" / "diff_same.png"),
+        "diff image is written for the failed frame only");
+
+    fs::remove_all(directory);
+}
+
+int main() {
+    test_compare_images();
+    test_check_golden_images();
+
+    printf("%s\n", failure_count == 0 ? "All checks passed" : "Some checks failed");
+    return failure_count;
+}
@@ -0,0 +1,203 @@
+#include "../job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+// Job system tests and benchmarks: job_system_test [max threads]
+// Checks dependencies, exceptions, stealing and parallel_for results, and measures spawn/wait
+// overhead and parallel_for scaling. The exit code is the number of failed checks.
+
+using Clock = std::chrono::steady_clock;
+
+static int failure_count = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failure_count++;
+    }
+}
+
+static double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void test_dependencies(uint32_t thread_count) {
+    Job_System jobs;
+    jobs.initialize(thread_count);
+
+    // Diamond: a -> (b, c) -> d.
+    std::atomic<uint32_t> step = 0;
+    uint32_t a_step = 0, b_step = 0, c_step = 0, d_step = 0;
+    Job_Handle a = jobs.run([&] { a_step = ++step; });
+    Job_Handle b = jobs.run([&] { b_step = ++step; }, { a });
+    Job_Handle c = jobs.run([&] { c_step = ++step; }, { a, nullptr });
+    Job_Handle d = jobs.run([&] { d_step = ++step; }, { b, c });
+    jobs.wait(d);
+    check(jobs.is_finished(a) && jobs.is_finished(b) && jobs.is_finished(c), "dependencies finished before the dependent job");
+    check(a_step == 1 && b_step > a_step && c_step > a_step && d_step == 4, "diamond dependency order");
+
+    // Dependency chain, each job is started by the previous one.
+    constexpr uint32_t chain_length = 10'000;
+    uint32_t next = 0;
+    bool in_order = true;
+    const Clock::time_point start = Clock::now();
+    Job_Handle previous;
+    for (uint32_t i = 0; i < chain_length; i++) {
+        previous = jobs.run([&next, &in_order, i] {
+            in_order &= next == i;
+            next++;
+        }, { previous });
+    }
+    jobs.wait(previous);
+    printf("Dependency chain: %.0f ns per job\n", elapsed_ms(start) * 1e6 / chain_length);
+    check(in_order && next == chain_length, "dependency chain order");
+
+    jobs.shutdown();
+}
+
+static void test_exceptions(uint32_t thread_count) {
+    Job_System jobs;
+    jobs.initialize(thread_count);
+
+    Job_Handle job = jobs.run([] { throw std::runtime_error("job"); });
+    bool rethrown = false;
+    try {
+        jobs.wait(job);
+    }
+    catch (const std::runtime_error&) {
+        rethrown = true;
+    }
+    check(rethrown, "wait rethrows the job's exception");
+
+    std::atomic<uint32_t> finished_ranges = 0;
+    rethrown = false;
+    try {
+        jobs.parallel_for(64, 1, [&finished_ranges](uint32_t begin, uint32_t) {
+            if (begin == 7)
+                throw std::runtime_error("range");
+            finished_ranges++;
+        });
+    }
+    catch (const std::runtime_error&) {
+        rethrown = true;
+    }
+    check(rethrown, "parallel_for rethrows the exception of a range");
+    check(finished_ranges == 63, "parallel_for finishes the other ranges");
+
+    jobs.shutdown();
+}
+
+static void test_spawn(uint32_t thread_count) {
+    Job_System jobs;
+    jobs.initialize(thread_count);
+
+    constexpr uint32_t job_count = 100'000;
+    std::atomic<uint32_t> done = 0;
+    std::vector<Job_Handle> handles(job_count);
+    const Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < job_count; i++)
+        handles[i] = jobs.run([&done] { done++; });
+    const double spawn_ms = elapsed_ms(start);
+    for (const Job_Handle& handle : handles)
+        jobs.wait(handle);
+    const double total_ms = elapsed_ms(start);
+    const Job_System_Stats stats = jobs.get_stats();
+    printf("Spawn: %.0f ns per job, spawn and finish: %.0f ns per job, %.1f%% stolen\n",
+        spawn_ms * 1e6 / job_count, total_ms * 1e6 / job_count, 100.0 * stats.stolen_jobs / stats.executed_jobs);
+    check(done == job_count, "all spawned jobs executed");
+    check(stats.executed_jobs == job_count, "executed job count");
+
+    jobs.shutdown();
+}
+
+// One job spawns all the work from a worker thread, the other workers have to steal it.
+static void test_stealing(uint32_t thread_count) {
+    Job_System jobs;
+    jobs.initialize(thread_count);
+
+    constexpr uint32_t job_count = 10'000;
+    std::atomic<uint32_t> done = 0;
+    const Clock::time_point start = Clock::now();
+    Job_Handle root = jobs.run([&jobs, &done] {
+        std::vector<Job_Handle> children(job_count);
+        for (uint32_t i = 0; i < job_count; i++) {
+            children[i] = jobs.run([&done] {
+                volatile double x = 1.0;
+                for (int k = 0; k < 2000; k++)
+                    x = std::sqrt(x + k);
+                done++;
+            });
+        }
+        for (const Job_Handle& child : children)
+            jobs.wait(child);
+    });
+    jobs.wait(root);
+    const Job_System_Stats stats = jobs.get_stats();
+    printf("Steal: %u jobs in %.2f ms, %llu stolen\n", done.load(), elapsed_ms(start), (unsigned long long)stats.stolen_jobs);
+    check(done == job_count, "nested jobs executed");
+
+    jobs.shutdown();
+}
+
+// The calling thread participates in parallel_for, so N - 1 workers means N threads.
+static void test_parallel_for_scaling(uint32_t max_threads) {
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t thread_count = 1; thread_count < max_threads; thread_count *= 2)
+        thread_counts.push_back(thread_count);
+    thread_counts.push_back(max_threads);
+
+    constexpr uint32_t item_count = 1 << 20;
+    auto expected = [](uint32_t i) {
+        float x = float(i);
+        for (int k = 0; k < 32; k++)
+            x = std::sqrt(x + float(k));
+        return x;
+    };
+
+    double single_thread_ms = 0.0;
+    for (uint32_t thread_count : thread_counts) {
+        Job_System jobs;
+        jobs.initialize(thread_count - 1);
+        std::vector<float> values(item_count);
+        double best_ms = 1e30;
+        for (int run = 0; run < 5; run++) {
+            std::fill(values.begin(), values.end(), -1.f);
+            const Clock::time_point start = Clock::now();
+            jobs.parallel_for(item_count, 4096, [&values, &expected](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; i++)
+                    values[i] = expected(i);
+            });
+            best_ms = std::min(best_ms, elapsed_ms(start));
+        }
+        if (thread_count == 1)
+            single_thread_ms = best_ms;
+        printf("parallel_for, %2u threads: %.2f ms, speedup %.2fx\n", thread_count, best_ms, single_thread_ms / best_ms);
+
+        bool correct = true;
+        for (uint32_t i = 0; i < item_count && correct; i++)
+            correct = values[i] == expected(i);
+        check(correct, "parallel_for covers every item once");
+        jobs.shutdown();
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc > 1)
+        max_threads = std::max(uint32_t(strtoul(argv[1], nullptr, 10)), 1u);
+    printf("Job system test, %u hardware threads, up to %u threads\n", std::thread::hardware_concurrency(), max_threads);
+
+    test_dependencies(max_threads);
+    test_exceptions(max_threads);
+    test_spawn(max_threads);
+    test_stealing(max_threads);
+    test_parallel_for_scaling(max_threads);
+
+    printf("%s\n", failure_count == 0 ? "All checks passed" : "Some checks failed");
+    return failure_count;
+}
@@ -0,0 +1,259 @@
+#include "../lib.h"
+#include "../render_graph.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+// Render graph compile() tests. Runs on the CPU without a device, the memory requirements come
+// from fake_memory_requirements. The exit code is the number of failed checks.
+
+static int failure_count = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        failure_count++;
+    }
+}
+
+constexpr uint32_t width = 256;
+constexpr uint32_t height = 128;
+constexpr VkDeviceSize fake_alignment = 4096;
+constexpr VkDeviceSize color_image_size = width * height * 4;
+constexpr VkFormat color_format = VK_FORMAT_R8G8B8A8_UNORM;
+
+static uint32_t memory_requirements_calls = 0;
+
+static VkMemoryRequirements fake_memory_requirements(const VkImageCreateInfo& create_info) {
+    memory_requirements_calls++;
+    const VkDeviceSize texel_size = create_info.format == VK_FORMAT_R16G16B16A16_SFLOAT ? 8 : 4;
+    VkMemoryRequirements requirements{};
+    requirements.size = round_up(VkDeviceSize(create_info.extent.width) * create_info.extent.height * texel_size, fake_alignment);
+    requirements.alignment = fake_alignment;
+    requirements.memoryTypeBits = 0x3;
+    return requirements;
+}
+
+static Render_Graph_Image create_color_image(Render_Graph& graph, const char* name) {
+    Render_Graph_Image_Desc desc;
+    desc.name = name;
+    desc.width = width;
+    desc.height = height;
+    desc.format = color_format;
+    return graph.create_image(desc);
+}
+
+// Swapchain-like image: starts undefined and ends in the present layout.
+static Render_Graph_Image import_output_image(Render_Graph& graph) {
+    Render_Graph_Image_Desc desc;
+    desc.name = "output";
+    desc.width = width;
+    desc.height = height;
+    desc.format = VK_FORMAT_B8G8R8A8_SRGB;
+    desc.initial_usage = { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED };
+    desc.final_usage = { VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+    return graph.import_image(desc);
+}
+
+static const Render_Graph_Transient_Image* find_transient_image(const Render_Graph_Compiled& compiled, Render_Graph_Image image) {
+    for (const Render_Graph_Transient_Image& transient_image : compiled.transient_images) {
+        if (transient_image.image == image)
+            return &transient_image;
+    }
+    return nullptr;
+}
+
+static const Render_Graph_Barrier* find_barrier(const std::vector<Render_Graph_Barrier>& barriers, Render_Graph_Image image) {
+    for (const Render_Graph_Barrier& barrier : barriers) {
+        if (barrier.image == image)
+            return &barrier;
+    }
+    return nullptr;
+}
+
+// Passes that write neither imported images nor images read by live passes are removed,
+// together with the images that only they use.
+static void test_pass_culling() {
+    Render_Graph graph;
+    const Render_Graph_Image unused = create_color_image(graph, "unused");
+    const Render_Graph_Image scene = create_color_image(graph, "scene");
+    const Render_Graph_Image debug = create_color_image(graph, "debug");
+    const Render_Graph_Image output = import_output_image(graph);
+    const auto fragment_sampled = Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    graph.add_pass("unused", nullptr).write(unused, Render_Graph_Usage::color_attachment());
+    graph.add_pass("scene", nullptr).write(scene, Render_Graph_Usage::color_attachment());
+    graph.add_pass("debug", nullptr).read(scene, fragment_sampled).write(debug, Render_Graph_Usage::color_attachment());
+    graph.add_pass("composite", nullptr).read(scene, fragment_sampled).write(output, Render_Graph_Usage::color_attachment());
+    graph.add_pass("readback", nullptr).read(output, Render_Graph_Usage::transfer_src()).side_effects = true;
+
+    memory_requirements_calls = 0;
+    const Render_Graph_Compiled compiled = graph.compile(fake_memory_requirements);
+    check(compiled.passes == std::vector<uint32_t>{ 1, 3, 4 }, "culling keeps the passes that reach the output or have side effects");
+    check(compiled.barriers.size() == compiled.passes.size(), "one barrier batch per surviving pass");
+    check(compiled.transient_images.size() == 1 && compiled.transient_images[0].image == scene,
+        "images of culled passes are not allocated");
+    check(memory_requirements_calls == 1, "memory requirements are queried only for surviving images");
+    (void)debug;
+
+    // Nothing reaches an output: everything is culled.
+    Render_Graph empty_graph;
+    const Render_Graph_Image image = create_color_image(empty_graph, "image");
+    empty_graph.add_pass("write", nullptr).write(image, Render_Graph_Usage::color_attachment());
+    const Render_Graph_Compiled empty = empty_graph.compile(fake_memory_requirements);
+    check(empty.passes.empty() && empty.transient_images.empty() && empty.memory_blocks.empty(), "graph without outputs is culled");
+}
+
+static void test_layout_transitions() {
+    Render_Graph graph;
+    const Render_Graph_Image scene = create_color_image(graph, "scene");
+    const Render_Graph_Image output = import_output_image(graph);
+
+    graph.add_pass("scene", nullptr).write(scene, Render_Graph_Usage::color_attachment());
+    graph.add_pass("composite", nullptr)
+        .read(scene, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT))
+        .write(output, Render_Graph_Usage::color_attachment());
+
+    const Render_Graph_Compiled compiled = graph.compile(fake_memory_requirements);
+    check(compiled.passes.size() == 2, "both passes survive");
+
+    const Render_Graph_Barrier* scene_write = find_barrier(compiled.barriers[0], scene);
+    check(scene_write && scene_write->old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
+        scene_write->new_layout == VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, "transient image starts undefined");
+
+    const Render_Graph_Barrier* scene_read = find_barrier(compiled.barriers[1], scene);
+    check(scene_read && scene_read->old_layout == VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL &&
+        scene_read->new_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, "attachment to shader read transition");
+    check(scene_read && scene_read->src_stage == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT &&
+        (scene_read->src_access & VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT) &&
+        scene_read->dst_stage == VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT &&
+        scene_read->dst_access == VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, "shader read waits for the attachment write");
+
+    const Render_Graph_Barrier* output_write = find_barrier(compiled.barriers[1], output);
+    check(output_write && output_write->old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
+        output_write->new_layout == VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL, "imported image starts from its initial layout");
+
+    check(compiled.final_barriers.size() == 1, "one final barrier");
+    const Render_Graph_Barrier* present = find_barrier(compiled.final_barriers, output);
+    check(present && present->old_layout == VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL &&
+        present->new_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR &&
+        present->src_stage == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, "imported image ends in its final layout");
+
+    // Using an image in two layouts within one pass is an error.
+    Render_Graph invalid_graph;
+    const Render_Graph_Image image = create_color_image(invalid_graph, "image");
+    const Render_Graph_Image invalid_output = import_output_image(invalid_graph);
+    invalid_graph.add_pass("write", nullptr).write(image, Render_Graph_Usage::color_attachment());
+    invalid_graph.add_pass("invalid", nullptr)
+        .read(image, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT))
+        .read(image, Render_Graph_Usage::transfer_src())
+        .write(invalid_output, Render_Graph_Usage::color_attachment());
+    bool thrown = false;
+    try {
+        invalid_graph.compile(fake_memory_requirements);
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    check(thrown, "two layouts of one image in a pass are rejected");
+}
+
+// Accesses of a pass are merged per image, reads that already see the last write need no barrier.
+static void test_barrier_batching() {
+    Render_Graph graph;
+    const Render_Graph_Image scene = create_color_image(graph, "scene");
+    const Render_Graph_Image bloom = create_color_image(graph, "bloom");
+    const Render_Graph_Image output = import_output_image(graph);
+
+    graph.add_pass("scene", nullptr)
+        .write(scene, Render_Graph_Usage::color_attachment())
+        .write(bloom, Render_Graph_Usage::color_attachment());
+    // Two reads of the same image in different stages become one barrier.
+    graph.add_pass("composite", nullptr)
+        .read(scene, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT))
+        .read(scene, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT))
+        .read(bloom, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT))
+        .write(output, Render_Graph_Usage::color_attachment());
+    // Same layout and stage as the previous read: the write is already visible.
+    graph.add_pass("overlay", nullptr)
+        .read(scene, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT))
+        .write(output, Render_Graph_Usage::color_attachment());
+    // Same layout, new stage: a memory dependency without a layout transition.
+    graph.add_pass("compute", nullptr)
+        .read(scene, Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT))
+        .write(output, Render_Graph_Usage::storage_write(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT));
+
+    const Render_Graph_Compiled compiled = graph.compile(fake_memory_requirements);
+    check(compiled.passes.size() == 4, "all passes survive");
+
+    check(compiled.barriers[0].size() == 2, "first pass transitions both attachments in one batch");
+    check(compiled.barriers[1].size() == 3, "composite pass has one barrier per image");
+    const Render_Graph_Barrier* merged = find_barrier(compiled.barriers[1], scene);
+    check(merged && merged->dst_stage == (VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT),
+        "reads of one image in a pass are merged");
+
+    check(find_barrier(compiled.barriers[2], scene) == nullptr, "visible write needs no barrier");
+    const Render_Graph_Barrier* output_write = find_barrier(compiled.barriers[2], output);
+    check(output_write && output_write->old_layout == output_write->new_layout &&
+        output_write->src_stage == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, "write after write keeps the layout");
+
+    const Render_Graph_Barrier* compute_read = find_barrier(compiled.barriers[3], scene);
+    check(compute_read && compute_read->old_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
+        compute_read->new_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
+        compute_read->dst_stage == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, "new reader stage waits without a transition");
+    const Render_Graph_Barrier* storage = find_barrier(compiled.barriers[3], output);
+    check(storage && storage->new_layout == VK_IMAGE_LAYOUT_GENERAL &&
+        (storage->src_stage & VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT), "storage write waits for the attachment writes");
+    check(compiled.get_barrier_count() == 2 + 3 + 1 + 2 + 1, "barrier count");
+}
+
+// Chain a -> b -> c: a and c do not live at the same time and share memory, b overlaps both.
+static void test_transient_aliasing() {
+    Render_Graph graph;
+    const Render_Graph_Image a = create_color_image(graph, "a");
+    const Render_Graph_Image b = create_color_image(graph, "b");
+    const Render_Graph_Image c = create_color_image(graph, "c");
+    const Render_Graph_Image output = import_output_image(graph);
+    const auto fragment_sampled = Render_Graph_Usage::sampled(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    graph.add_pass("a", nullptr).write(a, Render_Graph_Usage::color_attachment());
+    graph.add_pass("b", nullptr).read(a, fragment_sampled).write(b, Render_Graph_Usage::color_attachment());
+    graph.add_pass("c", nullptr).read(b, fragment_sampled).write(c, Render_Graph_Usage::color_attachment());
+    graph.add_pass("output", nullptr).read(c, fragment_sampled).write(output, Render_Graph_Usage::color_attachment());
+
+    const Render_Graph_Compiled compiled = graph.compile(fake_memory_requirements);
+    const Render_Graph_Transient_Image* image_a = find_transient_image(compiled, a);
+    const Render_Graph_Transient_Image* image_b = find_transient_image(compiled, b);
+    const Render_Graph_Transient_Image* image_c = find_transient_image(compiled, c);
+    check(image_a && image_b && image_c, "all transient images are allocated");
+    if (!image_a || !image_b || !image_c)
+        return;
+
+    check(image_a->first_pass == 0 && image_a->last_pass == 1 && image_c->first_pass == 2 && image_c->last_pass == 3,
+        "lifetimes in pass indices");
+    check(compiled.memory_blocks.size() == 1, "one memory block for compatible memory types");
+    check(image_a->memory_block == image_c->memory_block && image_a->offset == image_c->offset,
+        "images with disjoint lifetimes alias");
+    const bool b_overlaps_a = image_b->offset < image_a->offset + image_a->size && image_a->offset < image_b->offset + image_b->size;
+    check(!b_overlaps_a, "images with overlapping lifetimes do not alias");
+    check(image_b->offset % fake_alignment == 0, "offsets respect the alignment");
+    check(compiled.get_transient_images_size() == 3 * color_image_size, "size of all transient images");
+    check(compiled.get_transient_memory_size() == 2 * color_image_size, "aliased memory size");
+    check(image_a->create_info.usage == (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT),
+        "image usage is collected from all accesses");
+
+    // The new occupant of the memory waits for the last use of the previous one.
+    const Render_Graph_Barrier* c_write = find_barrier(compiled.barriers[2], c);
+    check(c_write && c_write->old_layout == VK_IMAGE_LAYOUT_UNDEFINED &&
+        (c_write->src_stage & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT), "aliased image waits for the previous occupant");
+}
+
+int main() {
+    test_pass_culling();
+    test_layout_transitions();
+    test_barrier_batching();
+    test_transient_aliasing();
+
+    printf("%s\n", failure_count == 0 ? "All checks passed" : "Some checks failed");
+    return failure_count;
+}
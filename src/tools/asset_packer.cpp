@@ -0,0 +1,14 @@
+#include "../asset_archive.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Builds the packed asset archive: asset_packer <data directory> <archive file> [--lz4]
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        printf("Usage: asset_packer <data directory> <archive file> [--lz4]\n");
+        return 1;
+    }
+    const bool compress = argc > 3 && strcmp(argv[3], "--lz4") == 0;
+    return write_asset_archive(argv[1], argv[2], compress) ? 0 : 1;
+}
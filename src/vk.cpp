@@ -8,14 +8,39 @@
 
 #include "glfw/glfw3.h"
 
+#include "asset_archive.h"
+#include "profiler.h"
+
 #include "vulkan/vk_enum_string_helper.h"
 const char* vk_result_to_string(VkResult result) { return string_VkResult(result); }
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <format>
 #include <fstream>
 
 constexpr uint32_t max_timestamp_queries = 64;
 
+// Warning is printed when heap usage exceeds the budget ratio, and rearmed below the lower ratio.
+constexpr float memory_budget_warning_ratio = 0.9f;
+constexpr float memory_budget_rearm_ratio = 0.85f;
+
+// Prepended to the pipeline cache data in the cache file. The driver validates its own cache header,
+// but the driver version is not a part of it, and the cache from another device should not be
+// passed to the driver at all.
+struct Pipeline_Cache_File_Header {
+    static constexpr uint32_t magic_value = 0x43504b56; // "VKPC"
+
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t device_uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+};
+
 //
 // Vk_Instance is a container that stores common Vulkan resources like vulkan instance,
 // device, command pool, swapchain, etc.
@@ -114,7 +139,9 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         vk.timestamp_period_ms = (double)gpu_properties.limits.timestampPeriod * 1e-6;
     }
 
-    VK_CHECK(glfwCreateWindowSurface(vk.instance, window, nullptr, &vk.surface));
+    if (!vk.headless) {
+        VK_CHECK(glfwCreateWindowSurface(vk.instance, window, nullptr, &vk.surface));
+    }
     vk.surface_usage_flags = params.surface_usage_flags;
 
     // select queue family
@@ -128,8 +155,10 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         // select queue family with presentation and graphics support
         vk.queue_family_index = -1;
         for (uint32_t i = 0; i < queue_family_count; i++) {
-            VkBool32 presentation_supported;
-            VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(vk.physical_device, i, vk.surface, &presentation_supported));
+            VkBool32 presentation_supported = VK_TRUE;
+            if (!vk.headless) {
+                VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(vk.physical_device, i, vk.surface, &presentation_supported));
+            }
 
             if (presentation_supported && (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
                 vk.queue_family_index = i;
@@ -162,6 +191,13 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
             }
         }
 
+        // Optional extensions.
+        std::vector<const char*> extensions(params.device_extensions.begin(), params.device_extensions.end());
+        vk.memory_budget_supported = is_extension_supported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (vk.memory_budget_supported) {
+            extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+
         const float priority = 1.0;
         VkDeviceQueueCreateInfo queue_create_info { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
         queue_create_info.queueFamilyIndex = vk.queue_family_index;
@@ -172,8 +208,8 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
         device_create_info.pNext = params.device_create_info_pnext;
         device_create_info.queueCreateInfoCount = 1;
         device_create_info.pQueueCreateInfos = &queue_create_info;
-        device_create_info.enabledExtensionCount = (uint32_t)params.device_extensions.size();
-        device_create_info.ppEnabledExtensionNames = params.device_extensions.data();
+        device_create_info.enabledExtensionCount = (uint32_t)extensions.size();
+        device_create_info.ppEnabledExtensionNames = extensions.data();
 
         VK_CHECK(vkCreateDevice(vk.physical_device, &device_create_info, nullptr, &vk.device));
     }
@@ -181,6 +217,7 @@ static void create_device(const Vk_Init_Params& params, GLFWwindow* window)
 
 void Vk_Image::destroy()
 {
+    vk_untrack_allocation(allocation);
     vmaDestroyImage(vk.allocator, handle, allocation);
     vkDestroyImageView(vk.device, view, nullptr);
     *this = Vk_Image{};
@@ -192,13 +229,102 @@ void Vk_Buffer::destroy()
     {
         return;
     }
+    vk_untrack_allocation(allocation);
     vmaDestroyBuffer(vk.allocator, handle, allocation);
     *this = Vk_Buffer{};
 }
 
+static void create_pipeline_cache()
+{
+    VkPhysicalDeviceIDProperties id_properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(vk.physical_device, &properties);
+
+    // Missing or stale cache is not an error, the pipelines are compiled from scratch in this case.
+    std::vector<char> data;
+    if (!vk.pipeline_cache_file.empty()) {
+        std::ifstream file(vk.pipeline_cache_file, std::ios_base::in | std::ios_base::binary);
+        Pipeline_Cache_File_Header header{};
+        if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+            header.magic == Pipeline_Cache_File_Header::magic_value &&
+            header.vendor_id == properties.properties.vendorID &&
+            header.device_id == properties.properties.deviceID &&
+            header.driver_version == properties.properties.driverVersion &&
+            memcmp(header.device_uuid, id_properties.deviceUUID, VK_UUID_SIZE) == 0)
+        {
+            data.resize(header.data_size);
+            if (!file.read(data.data(), data.size()))
+                data.clear();
+        }
+        if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+            VkPipelineCacheHeaderVersionOne cache_header;
+            memcpy(&cache_header, data.data(), sizeof(cache_header));
+            if (cache_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+                memcmp(cache_header.pipelineCacheUUID, properties.properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+                data.clear();
+        }
+        else {
+            data.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    create_info.initialDataSize = data.size();
+    create_info.pInitialData = data.empty() ? nullptr : data.data();
+    VK_CHECK(vkCreatePipelineCache(vk.device, &create_info, nullptr, &vk.pipeline_cache));
+    vk_set_debug_name(vk.pipeline_cache, "pipeline_cache");
+    vk.pipeline_cache_loaded = !data.empty();
+
+    if (!vk.pipeline_cache_file.empty())
+        printf("Pipeline cache: %s (%zu bytes)\n", vk.pipeline_cache_loaded ? "loaded" : "not found or stale", data.size());
+}
+
+static void save_pipeline_cache()
+{
+    if (vk.pipeline_cache_file.empty())
+        return;
+
+    size_t data_size = 0;
+    VK_CHECK(vkGetPipelineCacheData(vk.device, vk.pipeline_cache, &data_size, nullptr));
+    std::vector<char> data(data_size);
+    VK_CHECK(vkGetPipelineCacheData(vk.device, vk.pipeline_cache, &data_size, data.data()));
+
+    VkPhysicalDeviceIDProperties id_properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(vk.physical_device, &properties);
+
+    Pipeline_Cache_File_Header header{};
+    header.magic = Pipeline_Cache_File_Header::magic_value;
+    header.vendor_id = properties.properties.vendorID;
+    header.device_id = properties.properties.deviceID;
+    header.driver_version = properties.properties.driverVersion;
+    memcpy(header.device_uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+    header.data_size = data_size;
+
+    // Write to a temporary file first, so an interrupted write does not leave a truncated cache.
+    std::string temp_file = vk.pipeline_cache_file + ".tmp";
+    {
+        std::ofstream file(temp_file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), data_size);
+        if (!file) {
+            printf("Failed to write pipeline cache: %s\n", temp_file.c_str());
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp_file, vk.pipeline_cache_file, ec);
+    if (ec)
+        printf("Failed to write pipeline cache: %s\n", vk.pipeline_cache_file.c_str());
+}
+
 void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
 {
     vk.error = init_params.error_reporter;
+    vk.headless = init_params.headless;
+    vk.headless_extent = init_params.headless_extent;
     VK_CHECK(volkInitialize());
     uint32_t instance_version = volkGetInstanceVersion();
 
@@ -247,12 +373,19 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
 
         VmaAllocatorCreateInfo allocator_info{};
         allocator_info.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+        if (vk.memory_budget_supported) {
+            allocator_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+        }
         allocator_info.physicalDevice = vk.physical_device;
         allocator_info.device = vk.device;
         allocator_info.instance = vk.instance;
         allocator_info.pVulkanFunctions = &alloc_funcs;
         allocator_info.vulkanApiVersion = VK_API_VERSION_1_3;
         VK_CHECK(vmaCreateAllocator(&allocator_info, &vk.allocator));
+
+        const VkPhysicalDeviceMemoryProperties* memory_properties;
+        vmaGetMemoryProperties(vk.allocator, &memory_properties);
+        vk.memory_budget_warnings.assign(memory_properties->memoryHeapCount, false);
     }
 
     // Sync primitives.
@@ -304,8 +437,22 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
         vk_set_debug_name(vk.imgui_descriptor_pool, "imgui_descriptor_pool");
     }
 
-    // Select surface format.
-    {
+    // Select surface format. In headless mode it's the format of the offscreen images.
+    if (vk.headless) {
+        [&init_params]() {
+            for (VkFormat format : init_params.supported_surface_formats) {
+                VkFormatProperties props{};
+                vkGetPhysicalDeviceFormatProperties(vk.physical_device, format, &props);
+                const VkFormatFeatureFlags features = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+                if ((props.optimalTilingFeatures & features) == features) {
+                    vk.surface_format = { format, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+                    return;
+                }
+            }
+            vk.error("Failed to find supported offscreen image format");
+        } ();
+    }
+    else {
         uint32_t format_count;
         VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(vk.physical_device, vk.surface, &format_count, nullptr));
         assert(format_count > 0);
@@ -341,13 +488,24 @@ void vk_initialize(GLFWwindow* window, const Vk_Init_Params& init_params)
         VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[0]));
         VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[1]));
     }
+
+    vk.pipeline_cache_file = init_params.pipeline_cache_file;
+    create_pipeline_cache();
 }
 
 void vk_shutdown()
 {
     vkDeviceWaitIdle(vk.device);
 
+    for (Vk_Instance::Retired_Resource& resource : vk.retired_resources)
+        resource.destroy();
+    vk.retired_resources.clear();
+
+    save_pipeline_cache();
+    vkDestroyPipelineCache(vk.device, vk.pipeline_cache, nullptr);
+
     if (vk.staging_buffer != VK_NULL_HANDLE) {
+        vk_untrack_allocation(vk.staging_buffer_allocation);
         vmaDestroyBuffer(vk.allocator, vk.staging_buffer, vk.staging_buffer_allocation);
     }
 
@@ -365,14 +523,59 @@ void vk_shutdown()
     vk_destroy_swapchain();
     vmaDestroyAllocator(vk.allocator);
     vkDestroyDevice(vk.device, nullptr);
-    vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+    if (vk.surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+    }
     vkDestroyDebugUtilsMessengerEXT(vk.instance, vk.debug_utils_messenger, nullptr);
     vkDestroyInstance(vk.instance, nullptr);
 }
 
-void vk_create_swapchain(bool vsync)
+// Headless replacement of the swapchain: two offscreen images with the surface usage flags.
+static void create_offscreen_images()
 {
-    assert(vk.swapchain_info.handle == VK_NULL_HANDLE);
+    constexpr uint32_t image_count = 2;
+    vk.surface_size = vk.headless_extent;
+
+    vk.swapchain_info.images.resize(image_count);
+    vk.swapchain_info.image_views.resize(image_count);
+    vk.swapchain_info.allocations.resize(image_count);
+
+    for (uint32_t i = 0; i < image_count; i++) {
+        VkImageCreateInfo create_info{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        create_info.imageType = VK_IMAGE_TYPE_2D;
+        create_info.format = vk.surface_format.format;
+        create_info.extent = { vk.surface_size.width, vk.surface_size.height, 1 };
+        create_info.mipLevels = 1;
+        create_info.arrayLayers = 1;
+        create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        create_info.usage = vk.surface_usage_flags;
+        create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo alloc_create_info{};
+        alloc_create_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        VK_CHECK(vmaCreateImage(vk.allocator, &create_info, &alloc_create_info,
+            &vk.swapchain_info.images[i], &vk.swapchain_info.allocations[i], nullptr));
+        vk_track_allocation(vk.swapchain_info.allocations[i], Vk_Memory_Category::image, "offscreen swapchain image");
+        vk_set_debug_name(vk.swapchain_info.images[i], "offscreen_swapchain_image");
+
+        VkImageViewCreateInfo view_create_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        view_create_info.image = vk.swapchain_info.images[i];
+        view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_create_info.format = vk.surface_format.format;
+        view_create_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        VK_CHECK(vkCreateImageView(vk.device, &view_create_info, nullptr, &vk.swapchain_info.image_views[i]));
+    }
+    vk.swapchain_image_index = image_count - 1;
+}
+
+static void create_swapchain(bool vsync, VkSwapchainKHR old_swapchain)
+{
+    if (vk.headless) {
+        create_offscreen_images();
+        return;
+    }
 
     VkSurfaceCapabilitiesKHR surface_caps;
     VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk.physical_device, vk.surface, &surface_caps));
@@ -430,6 +633,7 @@ void vk_create_swapchain(bool vsync)
     desc.compositeAlpha     = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     desc.presentMode        = present_mode;
     desc.clipped            = VK_TRUE;
+    desc.oldSwapchain       = old_swapchain;
 
     VK_CHECK(vkCreateSwapchainKHR(vk.device, &desc, nullptr, &vk.swapchain_info.handle));
 
@@ -457,22 +661,98 @@ void vk_create_swapchain(bool vsync)
     }
 }
 
+void vk_create_swapchain(bool vsync)
+{
+    assert(vk.swapchain_info.handle == VK_NULL_HANDLE);
+    create_swapchain(vsync, VK_NULL_HANDLE);
+}
+
 void vk_destroy_swapchain()
 {
     for (auto image_view : vk.swapchain_info.image_views) {
         vkDestroyImageView(vk.device, image_view, nullptr);
     }
-    vkDestroySwapchainKHR(vk.device, vk.swapchain_info.handle, nullptr);
+    if (vk.headless) {
+        for (size_t i = 0; i < vk.swapchain_info.images.size(); i++) {
+            vk_untrack_allocation(vk.swapchain_info.allocations[i]);
+            vmaDestroyImage(vk.allocator, vk.swapchain_info.images[i], vk.swapchain_info.allocations[i]);
+        }
+    }
+    else {
+        vkDestroySwapchainKHR(vk.device, vk.swapchain_info.handle, nullptr);
+    }
     vk.swapchain_info = Swapchain_Info{};
 }
 
+void vk_recreate_swapchain(bool vsync)
+{
+    Swapchain_Info old_swapchain_info = std::move(vk.swapchain_info);
+    vk.swapchain_info = Swapchain_Info{};
+    create_swapchain(vsync, old_swapchain_info.handle);
+
+    vk_retire([info = std::move(old_swapchain_info)]() {
+        for (auto image_view : info.image_views) {
+            vkDestroyImageView(vk.device, image_view, nullptr);
+        }
+        if (vk.headless) {
+            for (size_t i = 0; i < info.images.size(); i++) {
+                vk_untrack_allocation(info.allocations[i]);
+                vmaDestroyImage(vk.allocator, info.images[i], info.allocations[i]);
+            }
+        }
+        else {
+            vkDestroySwapchainKHR(vk.device, info.handle, nullptr);
+        }
+    });
+}
+
+void vk_retire(std::function<void()> destroy)
+{
+    vk.retired_resources.push_back({ vk.frame_number, std::move(destroy) });
+}
+
+void vk_retire(Vk_Image& image)
+{
+    if (image.handle == VK_NULL_HANDLE)
+        return;
+    vk_retire([handle = image.handle, view = image.view, allocation = image.allocation]() {
+        Vk_Image retired;
+        retired.handle = handle;
+        retired.view = view;
+        retired.allocation = allocation;
+        retired.destroy();
+    });
+    image = Vk_Image{};
+}
+
+void vk_retire(Vk_Buffer& buffer)
+{
+    if (buffer.handle == VK_NULL_HANDLE)
+        return;
+    vk_retire([retired = buffer]() mutable { retired.destroy(); });
+    buffer = Vk_Buffer{};
+}
+
+// Runs the destroy functions of the resources retired two or more frames ago. The fence wait in
+// vk_begin_frame finished the frame before the previous one.
+static void destroy_retired_resources()
+{
+    auto retired = std::stable_partition(vk.retired_resources.begin(), vk.retired_resources.end(),
+        [](const Vk_Instance::Retired_Resource& resource) { return vk.frame_number - resource.frame_number < 2; });
+    for (auto it = retired; it != vk.retired_resources.end(); ++it)
+        it->destroy();
+    vk.retired_resources.erase(retired, vk.retired_resources.end());
+}
+
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size)
 {
     if (vk.staging_buffer_size >= size)
         return;
 
-    if (vk.staging_buffer != VK_NULL_HANDLE)
+    if (vk.staging_buffer != VK_NULL_HANDLE) {
+        vk_untrack_allocation(vk.staging_buffer_allocation);
         vmaDestroyBuffer(vk.allocator, vk.staging_buffer, vk.staging_buffer_allocation);
+    }
 
     VkBufferCreateInfo buffer_create_info { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
     buffer_create_info.size = size;
@@ -485,6 +765,7 @@ void vk_ensure_staging_buffer_allocation(VkDeviceSize size)
 
     VmaAllocationInfo alloc_info;
     VK_CHECK(vmaCreateBuffer(vk.allocator, &buffer_create_info, &alloc_create_info, &vk.staging_buffer, &vk.staging_buffer_allocation, &alloc_info));
+    vk_track_allocation(vk.staging_buffer_allocation, Vk_Memory_Category::staging, "staging_buffer");
 
     vk.staging_buffer_ptr = (uint8_t*)alloc_info.pMappedData;
     vk.staging_buffer_size = size;
@@ -509,6 +790,7 @@ Vk_Buffer vk_create_buffer_with_alignment(VkDeviceSize size, VkBufferUsageFlags
     VK_CHECK(vmaCreateBufferWithAlignment(vk.allocator, &buffer_create_info, &alloc_create_info, min_alignment,
         &buffer.handle, &buffer.allocation, nullptr));
     vk_set_debug_name(buffer.handle, name);
+    vk_track_allocation(buffer.allocation, Vk_Memory_Category::buffer, name);
 
     VkBufferDeviceAddressInfo buffer_address_info{ VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
     buffer_address_info.buffer = buffer.handle;
@@ -541,6 +823,7 @@ Vk_Buffer vk_create_mapped_buffer(VkDeviceSize size, VkBufferUsageFlags usage, v
     Vk_Buffer buffer;
     VK_CHECK(vmaCreateBuffer(vk.allocator, &buffer_create_info, &alloc_create_info, &buffer.handle, &buffer.allocation, &alloc_info));
     vk_set_debug_name(buffer.handle, name);
+    vk_track_allocation(buffer.allocation, Vk_Memory_Category::mapped_buffer, name);
 
     VkBufferDeviceAddressInfo buffer_address_info { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
     buffer_address_info.buffer = buffer.handle;
@@ -575,6 +858,7 @@ Vk_Image vk_create_image(int width, int height, VkFormat format, VkImageUsageFla
 
         VK_CHECK(vmaCreateImage(vk.allocator, &create_info, &alloc_create_info, &image.handle, &image.allocation, nullptr));
         vk_set_debug_name(image.handle, name);
+        vk_track_allocation(image.allocation, Vk_Memory_Category::image, name);
     }
     // create image view
     {
@@ -629,6 +913,7 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
 
         VK_CHECK(vmaCreateImage(vk.allocator, &image_create_info, &alloc_create_info, &image.handle, &image.allocation, nullptr));
         vk_set_debug_name(image.handle, name);
+        vk_track_allocation(image.allocation, Vk_Memory_Category::texture, name);
     }
 
     // create image view
@@ -702,6 +987,9 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
             int32_t w = (int32_t)width;
             int32_t h = (int32_t)height;
 
+            // Transitions of neighbouring mip levels are issued together: the previous level's
+            // move to SHADER_READ_ONLY goes with the next level's preparation for the blit.
+            Vk_Barrier_Batch barriers;
             for (uint32_t i = 1; i < mip_levels; i++) {
                 blit.srcSubresource.mipLevel = i - 1;
                 blit.srcOffsets[1] = VkOffset3D { w, h, 1 };
@@ -713,14 +1001,15 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
                 blit.dstOffsets[1] = VkOffset3D { w, h, 1 };
 
                 subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+                barriers.image_subresource(image.handle, subresource_range,
                     VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                     VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
                 subresource_range.baseMipLevel = i;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+                barriers.image_subresource(image.handle, subresource_range,
                     VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED,
                     VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+                barriers.flush(command_buffer);
 
                 vkCmdBlitImage(command_buffer,
                     image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -728,15 +1017,16 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
                     1, &blit, VK_FILTER_LINEAR);
 
                 subresource_range.baseMipLevel = i-1;
-                vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+                barriers.image_subresource(image.handle, subresource_range,
                     VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
                     VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
             }
 
             subresource_range.baseMipLevel = mip_levels - 1;
-            vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+            barriers.image_subresource(image.handle, subresource_range,
                 VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                 VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            barriers.flush(command_buffer);
         });
     }
 
@@ -748,7 +1038,12 @@ Vk_Image vk_load_texture(const std::string& texture_file)
     int w, h;
     int component_count;
 
-    auto rgba_pixels = stbi_load(texture_file.c_str(), &w, &h, &component_count,STBI_rgb_alpha);
+    // Decoded straight from the archive mapping when the file is packed.
+    Asset_File file;
+    stbi_uc* rgba_pixels = nullptr;
+    if (read_asset_file(texture_file, file)) {
+        rgba_pixels = stbi_load_from_memory(file.bytes.data(), int(file.bytes.size()), &w, &h, &component_count, STBI_rgb_alpha);
+    }
     if (rgba_pixels == nullptr) {
         vk.error("failed to load image file: " + texture_file);
     }
@@ -758,32 +1053,14 @@ Vk_Image vk_load_texture(const std::string& texture_file)
     return texture;
 }
 
-static std::vector<uint8_t> read_binary_file(const std::string& file_name)
-{
-    std::ifstream file(file_name, std::ios_base::in | std::ios_base::binary);
-    if (!file) {
-        vk.error("failed to open file: " + file_name);
-    }
-    // get file size
-    file.seekg(0, std::ios_base::end);
-    std::streampos file_size = file.tellg();
-    file.seekg(0, std::ios_base::beg);
-
-    if (file_size == std::streampos(-1) || !file) {
-        vk.error("failed to read file stats: " + file_name);
-    }
-    // read file content
-    std::vector<uint8_t> file_content(static_cast<size_t>(file_size));
-    file.read(reinterpret_cast<char*>(file_content.data()), file_size);
-    if (!file) {
-        vk.error("failed to read file content: " + file_name);
-    }
-    return file_content;
-}
-
 VkShaderModule vk_load_spirv(const std::string& spirv_file)
 {
-    std::vector<uint8_t> bytes = read_binary_file(spirv_file);
+    // Uncompressed archive entries are 64-byte aligned, the module is created from the mapping.
+    Asset_File file;
+    if (!read_asset_file(spirv_file, file)) {
+        vk.error("failed to read SPIR-V file: " + spirv_file);
+    }
+    const std::span<const uint8_t> bytes = file.bytes;
 
     if (bytes.size() % 4 != 0) {
         vk.error("Vulkan: SPIR-V binary buffer size is not multiple of 4");
@@ -893,19 +1170,21 @@ Vk_Graphics_Pipeline_State get_default_graphics_pipeline_state()
 
 VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
     VkShaderModule vertex_shader, VkShaderModule fragment_shader,
-    VkPipelineLayout pipeline_layout, const char* name)
+    VkPipelineLayout pipeline_layout, const char* name, const VkSpecializationInfo* fragment_specialization)
 {
-    auto get_shader_stage_create_info = [](VkShaderStageFlagBits stage, VkShaderModule shader_module) {
+    auto get_shader_stage_create_info = [](VkShaderStageFlagBits stage, VkShaderModule shader_module,
+        const VkSpecializationInfo* specialization) {
         VkPipelineShaderStageCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
         create_info.stage  = stage;
         create_info.module = shader_module;
         create_info.pName  = "main";
+        create_info.pSpecializationInfo = specialization;
         return create_info;
     };
 
     VkPipelineShaderStageCreateInfo shader_stages_state[2] {
-        get_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader),
-        get_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader)
+        get_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader, nullptr),
+        get_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader, fragment_specialization)
     };
 
     VkPipelineVertexInputStateCreateInfo vertex_input_state{ VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
@@ -932,7 +1211,7 @@ VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
     VkGraphicsPipelineCreateInfo create_info { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
     create_info.pNext                                   = &rendering_create_info;
     create_info.flags                                   = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
-    create_info.stageCount                              = (uint32_t)std::size(shader_stages_state);
+    create_info.stageCount                              = fragment_shader != VK_NULL_HANDLE ? 2 : 1;
     create_info.pStages                                 = shader_stages_state;
     create_info.pVertexInputState                       = &vertex_input_state;
     create_info.pInputAssemblyState                     = &state.input_assembly_state;
@@ -946,17 +1225,22 @@ VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
     create_info.subpass                                 = 0;
 
     VkPipeline pipeline{};
-    VK_CHECK(vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+    auto start_time = std::chrono::steady_clock::now();
+    VK_CHECK(vkCreateGraphicsPipelines(vk.device, vk.pipeline_cache, 1, &create_info, nullptr, &pipeline));
+    vk.pipeline_creation_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    vk.pipeline_creation_count++;
     vk_set_debug_name(pipeline, name);
     return pipeline;
 }
 
-VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader, VkPipelineLayout pipeline_layout, const char* name)
+VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader, VkPipelineLayout pipeline_layout, const char* name,
+    const VkSpecializationInfo* specialization)
 {
     VkPipelineShaderStageCreateInfo compute_stage{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
     compute_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
     compute_stage.module = compute_shader;
     compute_stage.pName = "main";
+    compute_stage.pSpecializationInfo = specialization;
 
     VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
     create_info.flags = VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
@@ -964,20 +1248,245 @@ VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader, VkPipelineL
     create_info.layout = pipeline_layout;
 
     VkPipeline pipeline{};
-    VK_CHECK(vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+    auto start_time = std::chrono::steady_clock::now();
+    VK_CHECK(vkCreateComputePipelines(vk.device, vk.pipeline_cache, 1, &create_info, nullptr, &pipeline));
+    vk.pipeline_creation_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    vk.pipeline_creation_count++;
     vk_set_debug_name(pipeline, name);
     return pipeline;
 }
 
+void Vk_Pipeline_Compiler::initialize()
+{
+    start_time = std::chrono::steady_clock::now();
+}
+
+void Vk_Pipeline_Compiler::shutdown()
+{
+    std::vector<Job_Handle> pending_jobs;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending_jobs.swap(jobs);
+    }
+    // Errors go to the futures, the jobs themselves do not throw.
+    for (const Job_Handle& job : pending_jobs)
+        g_job_system.wait(job);
+}
+
+Vk_Pipeline_Handle Vk_Pipeline_Compiler::submit(std::function<VkPipeline()> create_pipeline)
+{
+    auto task = std::make_shared<std::packaged_task<VkPipeline()>>(std::move(create_pipeline));
+    Vk_Pipeline_Handle handle;
+    handle.future = task->get_future().share();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running_jobs++;
+    handle.job = g_job_system.run([this, task] {
+        {
+            PROFILE_ZONE("Create pipeline");
+            (*task)();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running_jobs == 0) {
+            double wall_time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            printf("Pipeline creation: %u pipelines, %.2f ms of compilation, all done %.2f ms after start (%s pipeline cache)\n",
+                vk.pipeline_creation_count.load(), vk.pipeline_creation_time_ns.load() / 1e6, wall_time_ms,
+                vk.pipeline_cache_loaded ? "warm" : "cold");
+        }
+    });
+    std::erase_if(jobs, [](const Job_Handle& job) { return g_job_system.is_finished(job); });
+    jobs.push_back(handle.job);
+    return handle;
+}
+
+void Vk_Secondary_Recorder::initialize()
+{
+    thread_pools.resize(g_job_system.thread_count() + 1);
+    for (Thread_Pools& thread : thread_pools) {
+        VkCommandPoolCreateInfo desc{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+        desc.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        desc.queueFamilyIndex = vk.queue_family_index;
+        for (int i = 0; i < 2; i++) {
+            VK_CHECK(vkCreateCommandPool(vk.device, &desc, nullptr, &thread.pools[i]));
+            thread.used_count[i] = 0;
+        }
+    }
+}
+
+void Vk_Secondary_Recorder::shutdown()
+{
+    // Destroying a pool frees its command buffers.
+    for (Thread_Pools& thread : thread_pools) {
+        for (int i = 0; i < 2; i++)
+            vkDestroyCommandPool(vk.device, thread.pools[i], nullptr);
+    }
+    thread_pools.clear();
+}
+
+void Vk_Secondary_Recorder::begin_frame()
+{
+    for (Thread_Pools& thread : thread_pools) {
+        VK_CHECK(vkResetCommandPool(vk.device, thread.pools[vk.frame_index], 0));
+        thread.used_count[vk.frame_index] = 0;
+    }
+}
+
+void Vk_Secondary_Recorder::record(const VkCommandBufferInheritanceRenderingInfo& rendering_info, uint32_t job_count,
+    const std::function<void(VkCommandBuffer, uint32_t)>& record_job, std::vector<VkCommandBuffer>& command_buffers)
+{
+    command_buffers.assign(job_count, VK_NULL_HANDLE);
+    const int frame = vk.frame_index;
+
+    // One job per range. A thread records its ranges one after another into its own pool.
+    g_job_system.parallel_for(job_count, 1, [&](uint32_t begin, uint32_t end) {
+        Thread_Pools& thread = thread_pools[g_job_system.current_thread_index()];
+        for (uint32_t job = begin; job < end; job++) {
+            PROFILE_ZONE("Record secondary command buffer");
+            if (thread.used_count[frame] == thread.command_buffers[frame].size()) {
+                VkCommandBufferAllocateInfo alloc_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+                alloc_info.commandPool = thread.pools[frame];
+                alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                alloc_info.commandBufferCount = 1;
+                VkCommandBuffer command_buffer;
+                VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &command_buffer));
+                thread.command_buffers[frame].push_back(command_buffer);
+            }
+            VkCommandBuffer command_buffer = thread.command_buffers[frame][thread.used_count[frame]++];
+
+            VkCommandBufferInheritanceInfo inheritance_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+            inheritance_info.pNext = &rendering_info;
+
+            VkCommandBufferBeginInfo begin_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            begin_info.pInheritanceInfo = &inheritance_info;
+
+            VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+            record_job(command_buffer, job);
+            VK_CHECK(vkEndCommandBuffer(command_buffer));
+            command_buffers[job] = command_buffer;
+        }
+    });
+}
+
+const char* vk_memory_category_name(Vk_Memory_Category category)
+{
+    switch (category) {
+    case Vk_Memory_Category::buffer: return "buffer";
+    case Vk_Memory_Category::mapped_buffer: return "mapped_buffer";
+    case Vk_Memory_Category::texture: return "texture";
+    case Vk_Memory_Category::image: return "image";
+    case Vk_Memory_Category::render_graph: return "render_graph";
+    case Vk_Memory_Category::render_target_pool: return "render_target_pool";
+    case Vk_Memory_Category::staging: return "staging";
+    default: return "unknown";
+    }
+}
+
+// The category is stored in the allocation's user data (category + 1, so 0 means not tracked).
+void vk_track_allocation(VmaAllocation allocation, Vk_Memory_Category category, const char* name)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(vk.allocator, allocation, &info);
+    vmaSetAllocationUserData(vk.allocator, allocation, (void*)(uintptr_t(category) + 1));
+    if (name)
+        vmaSetAllocationName(vk.allocator, allocation, name);
+    vk.memory_category_bytes[uint32_t(category)] += info.size;
+}
+
+void vk_untrack_allocation(VmaAllocation allocation)
+{
+    if (allocation == VK_NULL_HANDLE)
+        return;
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(vk.allocator, allocation, &info);
+    const uintptr_t category = uintptr_t(info.pUserData);
+    if (category != 0) {
+        vk.memory_category_bytes[category - 1] -= info.size;
+        vmaSetAllocationUserData(vk.allocator, allocation, nullptr);
+    }
+}
+
+Vk_Memory_Stats vk_get_memory_stats()
+{
+    const VkPhysicalDeviceMemoryProperties* memory_properties;
+    vmaGetMemoryProperties(vk.allocator, &memory_properties);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(vk.allocator, budgets);
+
+    Vk_Memory_Stats stats{};
+    stats.heaps.resize(memory_properties->memoryHeapCount);
+    for (uint32_t i = 0; i < memory_properties->memoryHeapCount; i++) {
+        stats.heaps[i].flags = memory_properties->memoryHeaps[i].flags;
+        stats.heaps[i].size = memory_properties->memoryHeaps[i].size;
+        stats.heaps[i].usage = budgets[i].usage;
+        stats.heaps[i].budget = budgets[i].budget;
+        stats.heaps[i].allocation_bytes = budgets[i].statistics.allocationBytes;
+    }
+    for (uint32_t i = 0; i < vk_memory_category_count; i++)
+        stats.category_bytes[i] = vk.memory_category_bytes[i];
+    return stats;
+}
+
+void vk_write_memory_stats_json(const std::string& file_name)
+{
+    char* stats_string = nullptr;
+    vmaBuildStatsString(vk.allocator, &stats_string, VK_TRUE);
+    std::ofstream file(file_name);
+    if (file)
+        file << stats_string;
+    vmaFreeStatsString(vk.allocator, stats_string);
+    if (!file)
+        printf("Failed to write memory statistics to %s\n", file_name.c_str());
+    else
+        printf("Memory statistics written to %s\n", file_name.c_str());
+}
+
+// Without VK_EXT_memory_budget VMA estimates the budget as 80% of the heap size and usage
+// includes only this process's allocations.
+static void check_memory_budget()
+{
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(vk.allocator, budgets);
+    for (uint32_t i = 0; i < uint32_t(vk.memory_budget_warnings.size()); i++) {
+        if (budgets[i].budget == 0)
+            continue;
+        const float ratio = float(double(budgets[i].usage) / double(budgets[i].budget));
+        if (!vk.memory_budget_warnings[i] && ratio > memory_budget_warning_ratio) {
+            vk.memory_budget_warnings[i] = true;
+            printf("Warning: memory heap %u usage %.1f MB is %.0f%% of the budget %.1f MB\n", i,
+                budgets[i].usage / (1024.0 * 1024.0), ratio * 100.f, budgets[i].budget / (1024.0 * 1024.0));
+        }
+        else if (vk.memory_budget_warnings[i] && ratio < memory_budget_rearm_ratio) {
+            vk.memory_budget_warnings[i] = false;
+        }
+    }
+}
+
 void vk_begin_frame()
 {
-    VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[vk.frame_index], VK_FALSE, std::numeric_limits<uint64_t>::max()));
+    PROFILE_ZONE("vk_begin_frame");
+    {
+        PROFILE_ZONE("Wait for frame fence");
+        VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[vk.frame_index], VK_FALSE, std::numeric_limits<uint64_t>::max()));
+    }
     VK_CHECK(vkResetFences(vk.device, 1, &vk.frame_fence[vk.frame_index]));
     vkResetCommandPool(vk.device, vk.command_pools[vk.frame_index], 0);
     vk.command_buffer = vk.command_buffers[vk.frame_index];
     vk.timestamp_query_pool = vk.timestamp_query_pools[vk.frame_index];
 
-    VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
+    vk.last_frame_barrier_stats = vk.barrier_stats;
+    vk.barrier_stats = Vk_Barrier_Stats{};
+    vmaSetCurrentFrameIndex(vk.allocator, ++vk.frame_number);
+    destroy_retired_resources();
+    check_memory_budget();
+
+    if (vk.headless) {
+        vk.swapchain_image_index = (vk.swapchain_image_index + 1) % uint32_t(vk.swapchain_info.images.size());
+    }
+    else {
+        PROFILE_ZONE("Acquire swapchain image");
+        VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
+    }
 
     VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -986,6 +1495,7 @@ void vk_begin_frame()
 
 void vk_end_frame()
 {
+    PROFILE_ZONE("vk_end_frame");
     VK_CHECK(vkEndCommandBuffer(vk.command_buffer));
 
     VkSemaphoreSubmitInfo wait_info{ VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO };
@@ -999,15 +1509,26 @@ void vk_end_frame()
     signal_info.semaphore = vk.rendering_finished_semaphore[vk.frame_index];
     signal_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
 
+    // Offscreen images are not acquired or presented, the frame fence is the only synchronization.
+    const uint32_t semaphore_count = vk.headless ? 0 : 1;
+
     VkSubmitInfo2 submit_info{ VK_STRUCTURE_TYPE_SUBMIT_INFO_2 };
-    submit_info.waitSemaphoreInfoCount = 1;
+    submit_info.waitSemaphoreInfoCount = semaphore_count;
     submit_info.pWaitSemaphoreInfos = &wait_info;
     submit_info.commandBufferInfoCount = 1;
     submit_info.pCommandBufferInfos = &cmd_info;
-    submit_info.signalSemaphoreInfoCount = 1;
+    submit_info.signalSemaphoreInfoCount = semaphore_count;
     submit_info.pSignalSemaphoreInfos = &signal_info;
 
-    VK_CHECK(vkQueueSubmit2(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
+    {
+        PROFILE_ZONE("Queue submit");
+        VK_CHECK(vkQueueSubmit2(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
+    }
+
+    if (vk.headless) {
+        vk.frame_index = 1 - vk.frame_index;
+        return;
+    }
 
     VkPresentInfoKHR present_info { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
     present_info.waitSemaphoreCount = 1;
@@ -1016,7 +1537,10 @@ void vk_end_frame()
     present_info.pSwapchains        = &vk.swapchain_info.handle;
     present_info.pImageIndices      = &vk.swapchain_image_index;
 
-    VK_CHECK(vkQueuePresentKHR(vk.queue, &present_info));
+    {
+        PROFILE_ZONE("Present");
+        VK_CHECK(vkQueuePresentKHR(vk.queue, &present_info));
+    }
 
     vk.frame_index = 1 - vk.frame_index;
 }
@@ -1054,25 +1578,9 @@ void vk_cmd_image_barrier(VkCommandBuffer command_buffer, VkImage image,
     VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
     VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout)
 {
-    VkImageMemoryBarrier2 barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-    barrier.srcStageMask = src_stage_mask;
-    barrier.srcAccessMask = src_access_mask;
-    barrier.dstStageMask = dst_stage_mask;
-    barrier.dstAccessMask = dst_access_mask;
-    barrier.oldLayout = old_layout;
-    barrier.newLayout = new_layout;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-
-    VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-    dep_info.imageMemoryBarrierCount = 1;
-    dep_info.pImageMemoryBarriers = &barrier;
-
-    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    Vk_Barrier_Batch batch;
+    batch.image(image, src_stage_mask, src_access_mask, old_layout, dst_stage_mask, dst_access_mask, new_layout);
+    batch.flush(command_buffer);
 }
 
 void vk_cmd_image_barrier_for_subresource(
@@ -1080,7 +1588,34 @@ void vk_cmd_image_barrier_for_subresource(
     VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
     VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout)
 {
-    VkImageMemoryBarrier2 barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+    Vk_Barrier_Batch batch;
+    batch.image_subresource(image, subresource_range, src_stage_mask, src_access_mask, old_layout, dst_stage_mask, dst_access_mask, new_layout);
+    batch.flush(command_buffer);
+}
+
+void vk_cmd_pipeline_barrier(VkCommandBuffer command_buffer, const VkDependencyInfo& dependency_info)
+{
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+
+    vk.barrier_stats.pipeline_barrier_commands++;
+    vk.barrier_stats.image_barriers += dependency_info.imageMemoryBarrierCount;
+    vk.barrier_stats.buffer_barriers += dependency_info.bufferMemoryBarrierCount;
+    vk.barrier_stats.memory_barriers += dependency_info.memoryBarrierCount;
+}
+
+Vk_Barrier_Batch& Vk_Barrier_Batch::image(VkImage image,
+    VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
+    VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout)
+{
+    const VkImageSubresourceRange subresource_range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+    return image_subresource(image, subresource_range, src_stage_mask, src_access_mask, old_layout, dst_stage_mask, dst_access_mask, new_layout);
+}
+
+Vk_Barrier_Batch& Vk_Barrier_Batch::image_subresource(VkImage image, const VkImageSubresourceRange& subresource_range,
+    VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
+    VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout)
+{
+    VkImageMemoryBarrier2& barrier = image_barriers.emplace_back(VkImageMemoryBarrier2{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 });
     barrier.srcStageMask = src_stage_mask;
     barrier.srcAccessMask = src_access_mask;
     barrier.dstStageMask = dst_stage_mask;
@@ -1089,12 +1624,60 @@ void vk_cmd_image_barrier_for_subresource(
     barrier.newLayout = new_layout;
     barrier.image = image;
     barrier.subresourceRange = subresource_range;
+    return *this;
+}
 
-    VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-    dep_info.imageMemoryBarrierCount = 1;
-    dep_info.pImageMemoryBarriers = &barrier;
+Vk_Barrier_Batch& Vk_Barrier_Batch::buffer(VkBuffer buffer,
+    VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask,
+    VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask)
+{
+    VkBufferMemoryBarrier2& barrier = buffer_barriers.emplace_back(VkBufferMemoryBarrier2{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 });
+    barrier.srcStageMask = src_stage_mask;
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstStageMask = dst_stage_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    return *this;
+}
+
+Vk_Barrier_Batch& Vk_Barrier_Batch::memory(
+    VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask,
+    VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask)
+{
+    VkMemoryBarrier2& barrier = memory_barriers.emplace_back(VkMemoryBarrier2{ VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 });
+    barrier.srcStageMask = src_stage_mask;
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstStageMask = dst_stage_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    return *this;
+}
+
+bool Vk_Barrier_Batch::empty() const
+{
+    return image_barriers.empty() && buffer_barriers.empty() && memory_barriers.empty();
+}
+
+void Vk_Barrier_Batch::flush(VkCommandBuffer command_buffer)
+{
+    if (empty())
+        return;
 
-    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dep_info.memoryBarrierCount = uint32_t(memory_barriers.size());
+    dep_info.pMemoryBarriers = memory_barriers.data();
+    dep_info.bufferMemoryBarrierCount = uint32_t(buffer_barriers.size());
+    dep_info.pBufferMemoryBarriers = buffer_barriers.data();
+    dep_info.imageMemoryBarrierCount = uint32_t(image_barriers.size());
+    dep_info.pImageMemoryBarriers = image_barriers.data();
+    vk_cmd_pipeline_barrier(command_buffer, dep_info);
+
+    image_barriers.clear();
+    buffer_barriers.clear();
+    memory_barriers.clear();
 }
 
 uint32_t vk_allocate_timestamp_queries(uint32_t count)
@@ -1199,10 +1782,10 @@ Vk_Descriptor_Set_Layout& Vk_Descriptor_Set_Layout::accelerator(uint32_t binding
     return *this;
 }
 
-Vk_Descriptor_Set_Layout& Vk_Descriptor_Set_Layout::default_post_process()
+Vk_Descriptor_Set_Layout& Vk_Descriptor_Set_Layout::default_post_process(VkShaderStageFlags stage_flags)
 {
-    sampled_image(1, VK_SHADER_STAGE_FRAGMENT_BIT)
-        .sampler(2, VK_SHADER_STAGE_FRAGMENT_BIT);
+    sampled_image(1, stage_flags)
+        .sampler(2, stage_flags);
     return *this;
 }
 
@@ -1226,21 +1809,34 @@ VkDescriptorSetLayout Vk_Descriptor_Set_Layout::create(const char* name, bool is
 
 void Vk_GPU_Time_Interval::begin()
 {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+    begin(vk.command_buffer);
 }
 
 void Vk_GPU_Time_Interval::end()
 {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+    end(vk.command_buffer);
 }
 
-Vk_GPU_Time_Interval* Vk_GPU_Time_Keeper::allocate_time_interval()
+void Vk_GPU_Time_Interval::begin(VkCommandBuffer command_buffer)
+{
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+}
+
+void Vk_GPU_Time_Interval::end(VkCommandBuffer command_buffer)
+{
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+}
+
+Vk_GPU_Time_Interval* Vk_GPU_Time_Keeper::allocate_time_interval(const char* name)
 {
     assert(time_interval_count < max_time_intervals);
     Vk_GPU_Time_Interval* time_interval = &time_intervals[time_interval_count++];
 
+    time_interval->name = name;
     time_interval->start_query[0] = time_interval->start_query[1] = vk_allocate_timestamp_queries(2);
     time_interval->length_ms = 0.f;
+    time_interval->raw_length_ms = 0.f;
+    time_interval->measured = false;
     return time_interval;
 }
 
@@ -1256,6 +1852,16 @@ void Vk_GPU_Time_Keeper::initialize_time_intervals()
             vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1] + 1);
         }
         });
+
+    gpu_clock_offset_ns = 0;
+    if (time_interval_count > 0) {
+        // vk_execute waits for the queue, so the last timestamp was written just before now.
+        const uint64_t cpu_time_ns = profiler_now_ns();
+        uint64_t gpu_ticks = 0;
+        VK_CHECK(vkGetQueryPoolResults(vk.device, vk.timestamp_query_pools[1], time_intervals[time_interval_count - 1].start_query[1] + 1, 1,
+            sizeof(uint64_t), &gpu_ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        gpu_clock_offset_ns = int64_t(cpu_time_ns) - int64_t(double(gpu_ticks) * vk.timestamp_period_ms * 1e6);
+    }
 }
 
 void Vk_GPU_Time_Keeper::next_frame()
@@ -1265,13 +1871,22 @@ void Vk_GPU_Time_Keeper::next_frame()
     VkResult result = vkGetQueryPoolResults(vk.device, vk.timestamp_query_pool, 0, query_count,
         query_count * 2 * sizeof(uint64_t), query_results, 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
     VK_CHECK_RESULT(result);
-    assert(result != VK_NOT_READY);
 
     const float influence = 0.25f;
 
     for (uint32_t i = 0; i < time_interval_count; i++) {
+        // Queries of intervals that were skipped in that frame (e.g. a pass that was not executed)
+        // stay unavailable after the reset. The smoothed length keeps its last value.
+        time_intervals[i].measured = query_results[4 * i + 1] != 0 && query_results[4 * i + 3] != 0;
+        if (!time_intervals[i].measured) {
+            time_intervals[i].raw_length_ms = 0.f;
+            continue;
+        }
         assert(query_results[4 * i + 2] >= query_results[4 * i]);
-        time_intervals[i].length_ms = (1.f - influence) * time_intervals[i].length_ms + influence * float(double(query_results[4 * i + 2] - query_results[4 * i]) * vk.timestamp_period_ms);
+        time_intervals[i].raw_length_ms = float(double(query_results[4 * i + 2] - query_results[4 * i]) * vk.timestamp_period_ms);
+        time_intervals[i].start_ns = uint64_t(int64_t(double(query_results[4 * i]) * vk.timestamp_period_ms * 1e6) + gpu_clock_offset_ns);
+        time_intervals[i].end_ns = uint64_t(int64_t(double(query_results[4 * i + 2]) * vk.timestamp_period_ms * 1e6) + gpu_clock_offset_ns);
+        time_intervals[i].length_ms = (1.f - influence) * time_intervals[i].length_ms + influence * time_intervals[i].raw_length_ms;
     }
 
     vkCmdResetQueryPool(vk.command_buffer, vk.timestamp_query_pool, 0, query_count);
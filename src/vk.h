@@ -12,7 +12,13 @@
 
 #include "vma/vk_mem_alloc.h"
 
+#include "job_system.h"
+
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <mutex>
 #include <span>
 #include <string>
 #include <vector>
@@ -32,6 +38,13 @@ struct Vk_Init_Params {
     const VkBaseInStructure* device_create_info_pnext = nullptr;
     std::span<VkFormat> supported_surface_formats;
     VkImageUsageFlags surface_usage_flags = 0;
+    // If set, the pipeline cache is loaded from this file on initialization and saved on shutdown.
+    std::string pipeline_cache_file;
+    // Headless mode: no surface and no swapchain. vk_create_swapchain creates offscreen images of
+    // headless_extent instead, vk_begin_frame/vk_end_frame cycle through them without presentation.
+    // Surface and swapchain extensions should not be requested in this mode.
+    bool headless = false;
+    VkExtent2D headless_extent{};
 };
 
 struct Vk_Image {
@@ -102,8 +115,55 @@ void vk_shutdown();
 void vk_create_swapchain(bool vsync);
 void vk_destroy_swapchain();
 
+// Creates a swapchain for the current surface size and vsync mode while the frames in flight still
+// present to the old one. The old swapchain is passed as oldSwapchain and destroyed with vk_retire.
+void vk_recreate_swapchain(bool vsync);
+
+// Deferred destruction of resources that may still be used by the frames in flight. destroy runs in
+// vk_begin_frame once the frame that is recorded (or was submitted last) when vk_retire is called
+// has finished on the GPU, or in vk_shutdown.
+void vk_retire(std::function<void()> destroy);
+// Take ownership, the arguments are reset to empty handles.
+void vk_retire(Vk_Image& image);
+void vk_retire(Vk_Buffer& buffer);
+
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size);
 
+// Memory telemetry. The vk_create_* functions name their allocations after the resource and
+// count them in a category. Other code that allocates with VMA directly calls vk_track_allocation.
+enum class Vk_Memory_Category : uint32_t {
+    buffer,         // device local buffers
+    mapped_buffer,  // host visible buffers: uniforms, descriptors, readback
+    texture,
+    image,          // vk_create_image images and offscreen swapchain images
+    render_graph,   // memory of the render graph transient images
+    render_target_pool, // free memory kept by Render_Target_Pool for reuse
+    staging,
+    count
+};
+constexpr uint32_t vk_memory_category_count = uint32_t(Vk_Memory_Category::count);
+const char* vk_memory_category_name(Vk_Memory_Category category);
+
+struct Vk_Memory_Heap_Stats {
+    VkMemoryHeapFlags flags;
+    VkDeviceSize size;
+    VkDeviceSize usage;             // with VK_EXT_memory_budget it also includes other processes
+    VkDeviceSize budget;
+    VkDeviceSize allocation_bytes;  // VMA allocations of this process
+};
+
+struct Vk_Memory_Stats {
+    std::vector<Vk_Memory_Heap_Stats> heaps;
+    VkDeviceSize category_bytes[vk_memory_category_count];
+};
+
+void vk_track_allocation(VmaAllocation allocation, Vk_Memory_Category category, const char* name);
+// Should be called before the allocation is freed.
+void vk_untrack_allocation(VmaAllocation allocation);
+Vk_Memory_Stats vk_get_memory_stats();
+// Detailed VMA statistics (vmaBuildStatsString) including allocation names.
+void vk_write_memory_stats_json(const std::string& file_name);
+
 // Buffers
 Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
     const void* data = nullptr, const char* name = nullptr);
@@ -126,12 +186,80 @@ VkPipelineLayout vk_create_pipeline_layout(
 
 Vk_Graphics_Pipeline_State get_default_graphics_pipeline_state();
 
+// fragment_specialization provides specialization constant values for the fragment shader (optional).
+// Depth-only pipelines pass VK_NULL_HANDLE as fragment_shader.
 VkPipeline vk_create_graphics_pipeline(const Vk_Graphics_Pipeline_State& state,
     VkShaderModule vertex_shader, VkShaderModule fragment_shader,
-    VkPipelineLayout pipeline_layout, const char* name);
+    VkPipelineLayout pipeline_layout, const char* name,
+    const VkSpecializationInfo* fragment_specialization = nullptr);
 
 VkPipeline vk_create_compute_pipeline(VkShaderModule compute_shader,
-    VkPipelineLayout pipeline_layout, const char* name);
+    VkPipelineLayout pipeline_layout, const char* name,
+    const VkSpecializationInfo* specialization = nullptr);
+
+// Pipeline that is created by a g_job_system job of Vk_Pipeline_Compiler.
+// get() waits until the pipeline is ready, so callers wait only when the pipeline is used first time.
+// While it waits, the calling thread runs other jobs.
+struct Vk_Pipeline_Handle {
+    Job_Handle job;
+    std::shared_future<VkPipeline> future;
+
+    VkPipeline get() const {
+        g_job_system.wait(job);
+        return future.get();
+    }
+    bool is_ready() const { return g_job_system.is_finished(job); }
+};
+
+// Creates pipelines on g_job_system. vkCreate*Pipelines can be called concurrently
+// and the pipeline cache is internally synchronized, so startup work (mesh and texture loading)
+// overlaps with shader compilation in the driver.
+struct Vk_Pipeline_Compiler {
+    void initialize();
+    // Waits for the submitted jobs to finish.
+    void shutdown();
+
+    // create_pipeline runs on a job system thread. It should own everything it references
+    // (shader modules, specialization data). Errors are rethrown by Vk_Pipeline_Handle::get().
+    Vk_Pipeline_Handle submit(std::function<VkPipeline()> create_pipeline);
+
+private:
+    std::mutex mutex;
+    std::vector<Job_Handle> jobs; // not finished at the last submit
+    uint32_t running_jobs = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+// Records secondary command buffers with g_job_system.parallel_for. Every job system thread
+// has its own command pool per frame in flight, so threads never share a pool and pools are
+// reset as a whole when the frame slot is reused.
+struct Vk_Secondary_Recorder {
+    // Creates pools for the g_job_system workers and one for the thread that calls record().
+    void initialize();
+    void shutdown();
+    // Number of threads that record in parallel.
+    uint32_t thread_count() const { return uint32_t(thread_pools.size()); }
+
+    // Resets the pools of vk.frame_index. Call after vk_begin_frame.
+    void begin_frame();
+
+    // Calls record_job(command_buffer, job_index) for every job, each job gets its own
+    // secondary command buffer that continues the dynamic rendering described by rendering_info.
+    // Returns when all jobs are recorded. command_buffers are in job order, ready for vkCmdExecuteCommands.
+    // Only one thread that is not a g_job_system worker may call it.
+    void record(const VkCommandBufferInheritanceRenderingInfo& rendering_info, uint32_t job_count,
+        const std::function<void(VkCommandBuffer, uint32_t)>& record_job, std::vector<VkCommandBuffer>& command_buffers);
+
+private:
+    struct Thread_Pools {
+        VkCommandPool pools[2];
+        std::vector<VkCommandBuffer> command_buffers[2];
+        uint32_t used_count[2];
+    };
+
+    // Indexed by g_job_system.current_thread_index(), the last one is for the calling thread.
+    std::vector<Thread_Pools> thread_pools;
+};
 
 void vk_begin_frame();
 void vk_end_frame();
@@ -148,6 +276,42 @@ void vk_cmd_image_barrier_for_subresource(VkCommandBuffer command_buffer, VkImag
     VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
     VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout);
 
+// vkCmdPipelineBarrier2 that is accounted in vk.barrier_stats. All barriers should be issued through it.
+void vk_cmd_pipeline_barrier(VkCommandBuffer command_buffer, const VkDependencyInfo& dependency_info);
+
+// Accumulates barriers and issues them with a single vkCmdPipelineBarrier2 on flush.
+// Use it when several resources change state at the same point of the command stream.
+struct Vk_Barrier_Batch {
+    std::vector<VkImageMemoryBarrier2> image_barriers;
+    std::vector<VkBufferMemoryBarrier2> buffer_barriers;
+    std::vector<VkMemoryBarrier2> memory_barriers;
+
+    // Barrier for all subresources of non-depth image.
+    Vk_Barrier_Batch& image(VkImage image,
+        VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
+        VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout);
+    Vk_Barrier_Batch& image_subresource(VkImage image, const VkImageSubresourceRange& subresource_range,
+        VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkImageLayout old_layout,
+        VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask, VkImageLayout new_layout);
+    Vk_Barrier_Batch& buffer(VkBuffer buffer,
+        VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask,
+        VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask);
+    Vk_Barrier_Batch& memory(
+        VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask,
+        VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask);
+
+    bool empty() const;
+    // Issues accumulated barriers (if any) and clears the batch.
+    void flush(VkCommandBuffer command_buffer);
+};
+
+// Number of issued barriers. vk_begin_frame moves the counters to vk.last_frame_barrier_stats.
+struct Vk_Barrier_Stats {
+    uint32_t pipeline_barrier_commands;
+    uint32_t image_barriers;
+    uint32_t buffer_barriers;
+    uint32_t memory_barriers;
+};
 
 uint32_t vk_allocate_timestamp_queries(uint32_t count);
 
@@ -204,6 +368,7 @@ struct Swapchain_Info {
     VkSwapchainKHR handle = VK_NULL_HANDLE;
     std::vector<VkImage> images;
     std::vector<VkImageView> image_views;
+    std::vector<VmaAllocation> allocations; // offscreen images in headless mode
 };
 
 // Vk_Instance contains vulkan resources that do not depend on applicaton logic.
@@ -219,6 +384,9 @@ struct Vk_Instance {
 
     VmaAllocator                    allocator;
 
+    bool                            headless;
+    VkExtent2D                      headless_extent;
+
     VkSurfaceKHR                    surface;
     VkImageUsageFlags               surface_usage_flags;
     VkSurfaceFormatKHR              surface_format;
@@ -248,6 +416,26 @@ struct Vk_Instance {
 
     VkDebugUtilsMessengerEXT        debug_utils_messenger;
 
+    VkPipelineCache                 pipeline_cache;
+    std::string                     pipeline_cache_file;
+    bool                            pipeline_cache_loaded; // cache data from the previous run was accepted
+    std::atomic<uint32_t>           pipeline_creation_count;
+    std::atomic<uint64_t>           pipeline_creation_time_ns; // sum over all threads
+
+    Vk_Barrier_Stats                barrier_stats; // current frame
+    Vk_Barrier_Stats                last_frame_barrier_stats;
+
+    bool                            memory_budget_supported; // VK_EXT_memory_budget is enabled
+    std::atomic<uint64_t>           memory_category_bytes[vk_memory_category_count];
+    std::vector<bool>               memory_budget_warnings; // per heap, usage is close to the budget
+    uint32_t                        frame_number; // frames since initialization, for VMA budget updates
+
+    struct Retired_Resource {
+        uint32_t frame_number;
+        std::function<void()> destroy;
+    };
+    std::vector<Retired_Resource>   retired_resources; // vk_retire
+
     VkDescriptorPool                imgui_descriptor_pool;
 };
 
@@ -292,19 +480,28 @@ struct Vk_Descriptor_Set_Layout {
     Vk_Descriptor_Set_Layout& storage_buffer(uint32_t binding, VkShaderStageFlags stage_flags);
     Vk_Descriptor_Set_Layout& storage_buffer_array(uint32_t binding, uint32_t array_size, VkShaderStageFlags stage_flags);
     Vk_Descriptor_Set_Layout& accelerator(uint32_t binding, VkShaderStageFlags stage_flags);
-    Vk_Descriptor_Set_Layout& default_post_process();
+    Vk_Descriptor_Set_Layout& default_post_process(VkShaderStageFlags stage_flags = VK_SHADER_STAGE_FRAGMENT_BIT);
     VkDescriptorSetLayout create(const char* name, bool isPushDescriptor = false);
 };
 
 //
 // GPU time queries.
 //
+// The start timestamp is written at TOP_OF_PIPE and the end timestamp at BOTTOM_OF_PIPE, so an
+// interval lasts from the moment its first command starts until all its commands are finished.
 struct Vk_GPU_Time_Interval {
+    const char* name;
     uint32_t start_query[2]; // end query == (start_query[frame_index] + 1)
     float length_ms;
+    float raw_length_ms; // last measurement without smoothing, it's from the frame that used the same query pool
+    bool measured; // false if the interval was not recorded in that frame, raw_length_ms is 0 then
+    uint64_t start_ns; // raw measurement on the CPU clock (profiler_now_ns)
+    uint64_t end_ns;
 
     void begin();
     void end();
+    void begin(VkCommandBuffer command_buffer);
+    void end(VkCommandBuffer command_buffer);
 };
 
 struct Vk_GPU_Time_Keeper {
@@ -312,8 +509,11 @@ struct Vk_GPU_Time_Keeper {
 
     Vk_GPU_Time_Interval time_intervals[max_time_intervals];
     uint32_t time_interval_count;
+    // CPU time of GPU timestamp 0, estimated in initialize_time_intervals. The error is
+    // the latency between the GPU writing a timestamp and the CPU waking up from the wait.
+    int64_t gpu_clock_offset_ns;
 
-    Vk_GPU_Time_Interval* allocate_time_interval();
+    Vk_GPU_Time_Interval* allocate_time_interval(const char* name = nullptr);
     void initialize_time_intervals();
     void next_frame();
 };
@@ -353,11 +553,12 @@ private:
     VkCommandBuffer command_buffer;
 };
 
+// Antialiasing mode is not a part of push constants, it's a specialization constant of the post-process pipeline.
 struct Post_Process_Push_Constatnts
 {
-    uint32_t AAType;
     float threshold;
     uint32_t frameIndex;
+    float render_scale[2]; // rendered part of the input images, see Vk_Demo::render_extent
 };
 
 #define VK_GPU_MARKER_SCOPE(command_buffer, name) GPU_Marker_Scope gpu_marker_scope##__LINE__(command_buffer, name)